@@ -0,0 +1,86 @@
+//! Compares each kernel materializing its results with its count-only instantiation.
+//!
+//! ```text
+//! cargo bench --features simd --bench count_only
+//! ```
+use std::hint::black_box;
+use std::time::{Duration, Instant};
+
+use intersection::simd_intersection::*;
+
+type Kernel = fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize;
+
+const KERNELS: [(&str, Kernel); 7] = [
+    ("simd_gallop", intersect_simd_gallop),
+    ("qfilter", intersect_simd_qfilter),
+    ("qfilter_b8", intersect_simd_qfilter_b8),
+    ("qfilter_b16", intersect_simd_qfilter_b16),
+    ("shuffle", intersect_simd_shuffle),
+    ("shuffle_b8", intersect_simd_shuffle_b8),
+    ("shuffle_vec256", intersect_simd_shuffle_vec256),
+];
+
+/// `len` sorted values, each gap drawn from `1..=2 * gap`.
+fn sorted_set(len: usize, gap: u64, mut state: u64) -> Vec<u32> {
+    let mut v = 0u64;
+    (0..len)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            v += 1 + state % (2 * gap);
+            v as u32
+        })
+        .collect()
+}
+
+/// The mean time of one call over about 200ms.
+fn time(mut f: impl FnMut()) -> Duration {
+    let budget = Duration::from_millis(200);
+    let start = Instant::now();
+    let mut runs = 0;
+    while start.elapsed() < budget {
+        f();
+        runs += 1;
+    }
+
+    start.elapsed() / runs
+}
+
+fn main() {
+    println!("isa {:?}", isa_level());
+    println!(
+        "{:<16} {:>8} {:>8} {:>12} {:>12} {:>8}",
+        "kernel", "|A|", "|B|", "write ns", "count ns", "speedup"
+    );
+
+    for (len_a, len_b, gap_b) in [
+        (1 << 16, 1 << 16, 2),
+        (1 << 16, 1 << 17, 1),
+        (1 << 10, 1 << 18, 1),
+    ] {
+        let aaa = sorted_set(len_a, (len_b as u64 * gap_b) / len_a as u64, 1);
+        let bbb = sorted_set(len_b, gap_b, 2);
+        let mut results = Vec::with_capacity(len_a + 16);
+
+        for (name, kernel) in KERNELS {
+            let write = time(|| {
+                results.clear();
+                black_box(kernel(black_box(&aaa), black_box(&bbb), Some(&mut results)));
+            });
+            let count = time(|| {
+                black_box(kernel(black_box(&aaa), black_box(&bbb), None));
+            });
+
+            println!(
+                "{:<16} {:>8} {:>8} {:>12} {:>12} {:>7.2}x",
+                name,
+                len_a,
+                len_b,
+                write.as_nanos(),
+                count.as_nanos(),
+                write.as_secs_f64() / count.as_secs_f64()
+            );
+        }
+    }
+}
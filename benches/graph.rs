@@ -0,0 +1,89 @@
+//! End-to-end throughput of the clique drivers in [`intersection::graph`], on a CSR file or on a
+//! generated power-law graph, printing one JSON object per clique size.
+//!
+//! ```text
+//! cargo bench --features simd --bench graph -- --graph graph.csr --k-max 5
+//! cargo bench --features simd --bench graph -- --vertices 100000 --avg-degree 32
+//! ```
+use std::env;
+use std::time::Instant;
+
+use intersection::graph::{count_cliques, CsrGraph};
+
+/// splitmix64, so the generated graph does not depend on any crate's generator.
+fn splitmix64(state: &mut u64) -> u64 {
+    *state = state.wrapping_add(0x9e37_79b9_7f4a_7c15);
+    let mut z = *state;
+    z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+    z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+    z ^ (z >> 31)
+}
+
+/// A Chung-Lu graph with degree exponent 2.5: both ends of each edge fall on vertex `v` with
+/// weight `v^(-2/3)`.
+fn power_law(vertices: usize, avg_degree: usize, seed: u64) -> CsrGraph {
+    let mut state = seed;
+    let mut end = || {
+        let unit = (splitmix64(&mut state) >> 11) as f64 / (1u64 << 53) as f64;
+        ((vertices as f64 * unit.powi(3)) as usize).min(vertices - 1) as u32
+    };
+    let edges: Vec<(u32, u32)> = (0..vertices * avg_degree / 2)
+        .map(|_| (end(), end()))
+        .collect();
+
+    CsrGraph::from_edges(vertices, &edges)
+}
+
+fn main() {
+    let mut graph_path = None;
+    let (mut vertices, mut avg_degree, mut k_max) = (1 << 16, 32, 5);
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = || args.next().expect("a value");
+        match arg.as_str() {
+            "--graph" => graph_path = Some(value()),
+            "--vertices" => vertices = value().parse().unwrap(),
+            "--avg-degree" => avg_degree = value().parse().unwrap(),
+            "--k-max" => k_max = value().parse().unwrap(),
+            // cargo passes --bench to custom harnesses
+            _ => {}
+        }
+    }
+
+    let start = Instant::now();
+    let (name, graph) = match &graph_path {
+        Some(path) => (path.clone(), CsrGraph::open(path).unwrap()),
+        None => (
+            format!("power_law_{}_{}", vertices, avg_degree),
+            power_law(vertices, avg_degree, 1),
+        ),
+    };
+    let graph = if graph.is_oriented() {
+        graph
+    } else {
+        graph.degree_ordered().oriented()
+    };
+    eprintln!(
+        "{}: {} vertices, {} edges, ready in {:?}",
+        name,
+        graph.num_vertices(),
+        graph.num_edges(),
+        start.elapsed()
+    );
+
+    for k in 3..=k_max {
+        let start = Instant::now();
+        let cliques = count_cliques(&graph, k);
+        let elapsed = start.elapsed();
+        println!(
+            "{{\"graph\":\"{}\",\"vertices\":{},\"edges\":{},\"k\":{},\"cliques\":{},\"ns\":{},\"edges_per_s\":{:.0}}}",
+            name,
+            graph.num_vertices(),
+            graph.num_edges(),
+            k,
+            cliques,
+            elapsed.as_nanos(),
+            graph.num_edges() as f64 / elapsed.as_secs_f64()
+        );
+    }
+}
@@ -0,0 +1,323 @@
+//! Times every kernel over a grid of input distributions, |A|, |B| / |A| and selectivities, and
+//! prints one JSON object per measurement, so that runs can be diffed between releases.
+//!
+//! ```text
+//! cargo bench --features simd --bench suite -- --out suite.jsonl
+//! cargo bench --features simd --bench suite -- --quick --filter qfilter
+//! ```
+//!
+//! Inputs come from a fixed-seed generator and are the same on every run. Each line carries the
+//! median of several timed batches, and the count every kernel returned is checked against the
+//! scalar merge first.
+use std::borrow::Cow;
+use std::collections::HashSet;
+use std::env;
+use std::fs::File;
+use std::hint::black_box;
+use std::io::{self, BufWriter, Write};
+use std::time::{Duration, Instant};
+
+use intersection::intersect::{
+    intersect, intersect_multi, intersect_scalar_gallop, intersect_scalar_merge,
+};
+
+#[cfg(feature = "simd")]
+use intersection::simd_intersection::*;
+
+type Kernel = fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize;
+
+/// The number of timed batches a measurement takes the median of.
+const BATCHES: usize = 5;
+
+/// `intersect_multi` over A, B and B again, which walks all three at once when A is small enough
+/// and otherwise chains pairwise intersections.
+fn multi(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    let intersected = intersect_multi(vec![Cow::from(aaa), Cow::from(bbb), Cow::from(bbb)]);
+    let count = intersected.len();
+    if let Some(vec) = results {
+        vec.extend(intersected);
+    }
+
+    count
+}
+
+fn kernels() -> Vec<(&'static str, Kernel)> {
+    #[allow(unused_mut)]
+    let mut kernels: Vec<(&'static str, Kernel)> = vec![
+        ("scalar_merge", intersect_scalar_merge),
+        ("scalar_gallop", intersect_scalar_gallop),
+        ("intersect", intersect),
+        ("intersect_multi", multi),
+    ];
+    #[cfg(feature = "simd")]
+    kernels.extend([
+        ("simd_gallop", intersect_simd_gallop as Kernel),
+        ("qfilter", intersect_simd_qfilter),
+        ("qfilter_b8", intersect_simd_qfilter_b8),
+        ("qfilter_b16", intersect_simd_qfilter_b16),
+        ("shuffle", intersect_simd_shuffle),
+        ("shuffle_b8", intersect_simd_shuffle_b8),
+        ("shuffle_vec256", intersect_simd_shuffle_vec256),
+    ]);
+    #[cfg(feature = "simd_new")]
+    kernels.extend([
+        (
+            "setops_gallop",
+            intersection::simd_intersection_new::intersect_simd_gallop as Kernel,
+        ),
+        (
+            "setops_qfilter",
+            intersection::simd_intersection_new::intersect_simd_qfilter,
+        ),
+    ]);
+
+    kernels
+}
+
+/// splitmix64, so inputs do not depend on any crate's generator.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        z ^ (z >> 31)
+    }
+
+    /// Uniform in `[0, 1)`.
+    fn unit(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+enum Distribution {
+    /// Uniform over the universe.
+    Uniform,
+    /// Log-uniform, i.e. Zipf with exponent 1: small IDs are far more likely.
+    Zipf,
+    /// Dense runs of 64 to 1024 IDs at uniform starts.
+    Clustered,
+    /// Neighbors in a Chung-Lu power-law graph with degree exponent 2.5, where the weight of
+    /// vertex `v` falls as `v^(-2/3)`.
+    PowerLaw,
+}
+
+const DISTRIBUTIONS: [(&str, Distribution); 4] = [
+    ("uniform", Distribution::Uniform),
+    ("zipf", Distribution::Zipf),
+    ("clustered", Distribution::Clustered),
+    ("power_law", Distribution::PowerLaw),
+];
+
+/// Draws IDs below `universe` from one distribution.
+struct Sampler {
+    dist: Distribution,
+    universe: u64,
+    rng: Rng,
+    run: (u64, u64),
+}
+
+impl Sampler {
+    fn new(dist: Distribution, universe: u64, seed: u64) -> Self {
+        Self {
+            dist,
+            universe,
+            rng: Rng(seed),
+            run: (0, 0),
+        }
+    }
+
+    fn sample(&mut self) -> u32 {
+        let n = self.universe as f64;
+        let v = match self.dist {
+            Distribution::Uniform => self.rng.next() % self.universe,
+            Distribution::Zipf => n.powf(self.rng.unit()) as u64 - 1,
+            Distribution::Clustered => {
+                if self.run.1 == 0 {
+                    self.run = (self.rng.next() % self.universe, 64 + self.rng.next() % 961);
+                }
+                self.run.1 -= 1;
+                self.run.0 + self.run.1
+            }
+            Distribution::PowerLaw => (n * self.rng.unit().powi(3)) as u64,
+        };
+
+        v.min(self.universe - 1) as u32
+    }
+}
+
+/// A sorted pair with `|A| = len_a`, `|B| = len_b` and `|A ∩ B| = selectivity * |A|`.
+fn generate(
+    dist: Distribution,
+    len_a: usize,
+    len_b: usize,
+    selectivity: f64,
+    seed: u64,
+) -> (Vec<u32>, Vec<u32>) {
+    let universe = (16 * (len_a + len_b) as u64)
+        .max(1 << 20)
+        .min(u32::MAX as u64);
+    let mut sampler = Sampler::new(dist, universe, seed);
+
+    let mut bbb = HashSet::with_capacity(len_b);
+    while bbb.len() < len_b {
+        bbb.insert(sampler.sample());
+    }
+    let mut bbb: Vec<u32> = bbb.into_iter().collect();
+    bbb.sort_unstable();
+
+    // the shared part is a spread-out sample of B, the rest is drawn outside B
+    let shared = ((selectivity * len_a as f64) as usize).min(len_b);
+    let mut aaa: HashSet<u32> = (0..shared)
+        .map(|i| bbb[i * len_b / shared.max(1)])
+        .collect();
+    while aaa.len() < len_a {
+        let v = sampler.sample();
+        if bbb.binary_search(&v).is_err() {
+            aaa.insert(v);
+        }
+    }
+    let mut aaa: Vec<u32> = aaa.into_iter().collect();
+    aaa.sort_unstable();
+
+    (aaa, bbb)
+}
+
+/// The median over [`BATCHES`] of the mean time of one call, and the total number of calls.
+fn time(budget: Duration, mut f: impl FnMut()) -> (Duration, u32) {
+    let mut means = Vec::with_capacity(BATCHES);
+    let mut total = 0;
+    for _ in 0..BATCHES {
+        let start = Instant::now();
+        let mut runs = 0;
+        while runs == 0 || start.elapsed() < budget / BATCHES as u32 {
+            f();
+            runs += 1;
+        }
+        means.push(start.elapsed() / runs);
+        total += runs;
+    }
+    means.sort_unstable();
+
+    (means[BATCHES / 2], total)
+}
+
+struct Options {
+    budget: Duration,
+    quick: bool,
+    filter: Option<String>,
+    out: Option<String>,
+}
+
+fn options() -> Options {
+    let mut options = Options {
+        budget: Duration::from_millis(50),
+        quick: false,
+        filter: None,
+        out: None,
+    };
+    let mut args = env::args().skip(1);
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "--budget-ms" => {
+                let ms = args
+                    .next()
+                    .and_then(|ms| ms.parse().ok())
+                    .expect("--budget-ms <ms>");
+                options.budget = Duration::from_millis(ms);
+            }
+            "--quick" => options.quick = true,
+            "--filter" => options.filter = args.next(),
+            "--out" => options.out = args.next(),
+            // cargo passes --bench to custom harnesses
+            _ => {}
+        }
+    }
+
+    options
+}
+
+fn main() -> io::Result<()> {
+    let options = options();
+    let mut out: Box<dyn Write> = match &options.out {
+        Some(path) => Box::new(BufWriter::new(File::create(path)?)),
+        None => Box::new(io::stdout().lock()),
+    };
+
+    #[cfg(feature = "simd")]
+    let isa = format!("{:?}", isa_level());
+    #[cfg(not(feature = "simd"))]
+    let isa = "none".to_owned();
+
+    let (sizes, ratios, selectivities): (&[usize], &[usize], &[f64]) = if options.quick {
+        (&[1 << 12], &[1, 16], &[0.1, 0.9])
+    } else {
+        (
+            &[1 << 8, 1 << 12, 1 << 16],
+            &[1, 2, 4, 8, 16, 64, 256],
+            &[0.01, 0.1, 0.5, 0.9],
+        )
+    };
+    let kernels: Vec<(&str, Kernel)> = kernels()
+        .into_iter()
+        .filter(|(name, _)| {
+            options
+                .filter
+                .as_ref()
+                .map_or(true, |f| name.contains(f.as_str()))
+        })
+        .collect();
+
+    let mut seed = 0;
+    for (dist_name, dist) in DISTRIBUTIONS {
+        for &len_a in sizes {
+            for &ratio in ratios {
+                let len_b = len_a * ratio;
+                if len_b > 1 << 22 {
+                    continue;
+                }
+                for &selectivity in selectivities {
+                    seed += 1;
+                    let (aaa, bbb) = generate(dist, len_a, len_b, selectivity, seed);
+                    let expected = intersect_scalar_merge(&aaa, &bbb, None);
+                    let mut results = Vec::with_capacity(len_a + 16);
+
+                    for &(name, kernel) in &kernels {
+                        results.clear();
+                        assert_eq!(kernel(&aaa, &bbb, Some(&mut results)), expected, "{}", name);
+                        assert_eq!(kernel(&aaa, &bbb, None), expected, "{}", name);
+
+                        let (write, runs) = time(options.budget, || {
+                            results.clear();
+                            black_box(kernel(black_box(&aaa), black_box(&bbb), Some(&mut results)));
+                        });
+                        let (count, _) = time(options.budget, || {
+                            black_box(kernel(black_box(&aaa), black_box(&bbb), None));
+                        });
+
+                        writeln!(
+                            out,
+                            "{{\"isa\":\"{}\",\"dist\":\"{}\",\"len_a\":{},\"len_b\":{},\"selectivity\":{},\"kernel\":\"{}\",\"count\":{},\"write_ns\":{},\"count_ns\":{},\"runs\":{}}}",
+                            isa,
+                            dist_name,
+                            len_a,
+                            len_b,
+                            selectivity,
+                            name,
+                            expected,
+                            write.as_nanos(),
+                            count.as_nanos(),
+                            runs
+                        )?;
+                    }
+                    out.flush()?;
+                }
+            }
+        }
+    }
+
+    Ok(())
+}
@@ -1,3 +1,22 @@
+#[cfg(feature = "simd")]
+use std::env;
+#[cfg(feature = "simd")]
+use std::fs;
+#[cfg(feature = "simd")]
+use std::path::{Path, PathBuf};
+
+/// The ISA levels the kernels are compiled for, keep in sync with `IsaLevel` in dispatch.hpp.
+#[cfg(feature = "simd")]
+const ISA_LEVELS: &[(&str, &[&str])] = &[
+    ("scalar", &[]),
+    ("sse42", &["-msse4.2", "-mpopcnt"]),
+    ("avx2", &["-mavx2", "-mpopcnt"]),
+    (
+        "avx512",
+        &["-mavx512f", "-mavx512bw", "-mavx512vl", "-mavx512dq"],
+    ),
+];
+
 fn main() {
     #[cfg(feature = "simd")]
     {
@@ -7,17 +26,52 @@ fn main() {
 
 #[cfg(feature = "simd")]
 fn build_cxx() {
+    // Only the dispatcher and the lookup tables are built for the baseline ISA.
     cxx_build::bridge("src/simd_intersection.rs")
-        .file("include/intersection_algos.cpp")
+        .file("include/dispatch.cpp")
+        .file("include/intersection_tables.cpp")
         .flag_if_supported("-std=c++11")
-        .flag_if_supported("-mavx2")
         .flag_if_supported("-lmetis")
         .opt_level(3)
         .compile("simd_intersection");
 
+    let include_dir = include_dir();
+    for (isa, flags) in ISA_LEVELS {
+        let mut build = cc::Build::new();
+        build
+            .cpp(true)
+            .include(&include_dir)
+            .file("include/intersection_algos.cpp")
+            .define("INTERSECTION_ISA", Some(*isa))
+            .flag_if_supported("-std=c++11")
+            .opt_level(3);
+        for flag in flags.iter() {
+            build.flag(flag);
+        }
+        build.compile(&format!("intersection_algos_{}", isa));
+    }
+
     println!("cargo:rerun-if-changed=src/simd_intersection.rs");
+    println!("cargo:rerun-if-changed=include/dispatch.cpp");
+    println!("cargo:rerun-if-changed=include/dispatch.hpp");
     println!("cargo:rerun-if-changed=include/intersection_algos.cpp");
     println!("cargo:rerun-if-changed=include/intersection_algos.hpp");
+    println!("cargo:rerun-if-changed=include/intersection_tables.cpp");
+    println!("cargo:rerun-if-changed=include/intersection_tables.hpp");
     println!("cargo:rerun-if-changed=include/util.cpp");
     println!("cargo:rerun-if-changed=include/util.hpp");
 }
+
+/// A directory where `intersection/include/...` resolves to this crate, like the cxx bridge sees it.
+#[cfg(feature = "simd")]
+fn include_dir() -> PathBuf {
+    let dir = PathBuf::from(env::var("OUT_DIR").unwrap()).join("include");
+    let link = dir.join(env::var("CARGO_PKG_NAME").unwrap());
+    fs::create_dir_all(&dir).unwrap();
+    if fs::symlink_metadata(&link).is_err() {
+        let manifest_dir = env::var("CARGO_MANIFEST_DIR").unwrap();
+        std::os::unix::fs::symlink(Path::new(&manifest_dir), &link).unwrap();
+    }
+
+    dir
+}
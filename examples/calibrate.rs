@@ -0,0 +1,21 @@
+//! Measures the kernels on this host and writes the table `intersect` loads from
+//! `INTERSECTION_COST_MODEL`.
+//!
+//! ```text
+//! cargo run --release --features simd --example calibrate -- cost_model.txt
+//! INTERSECTION_COST_MODEL=cost_model.txt cargo run --release --features simd ...
+//! ```
+use std::env;
+
+use intersection::cost_model::{calibrate, CalibrationGrid};
+
+fn main() {
+    let path = env::args()
+        .nth(1)
+        .unwrap_or_else(|| "cost_model.txt".to_owned());
+
+    let model = calibrate(&CalibrationGrid::default());
+    print!("{}", model);
+    model.save(&path).unwrap();
+    eprintln!("saved to {}", path);
+}
@@ -0,0 +1,41 @@
+//! Converts a text edge list, one `u v` pair per line, into the binary CSR file
+//! [`CsrGraph::open`] maps.
+//!
+//! ```text
+//! cargo run --release --example csr_convert -- edges.txt graph.csr --degree-order --orient
+//! ```
+//!
+//! `--degree-order` relabels the vertices by degree, `--orient` keeps each edge once, which is
+//! what the clique drivers walk.
+use std::env;
+use std::fs::File;
+use std::io::{self, BufReader};
+
+use intersection::graph::CsrGraph;
+
+fn main() -> io::Result<()> {
+    let args: Vec<String> = env::args().skip(1).collect();
+    let paths: Vec<&String> = args.iter().filter(|a| !a.starts_with("--")).collect();
+    let flag = |name: &str| args.iter().any(|a| a == name);
+    let [input, output] = paths[..] else {
+        eprintln!("usage: csr_convert <edges.txt> <graph.csr> [--degree-order] [--orient]");
+        std::process::exit(2);
+    };
+
+    let mut graph = CsrGraph::from_edge_list(BufReader::new(File::open(input)?))?;
+    if flag("--degree-order") {
+        graph = graph.degree_ordered();
+    }
+    if flag("--orient") {
+        graph = graph.oriented();
+    }
+    graph.save(output)?;
+    eprintln!(
+        "{}: {} vertices, {} edges",
+        output,
+        graph.num_vertices(),
+        graph.num_edges()
+    );
+
+    Ok(())
+}
@@ -0,0 +1,331 @@
+#include "intersection/include/intersection_algos.hpp"
+
+#include <atomic>
+#include <cpuid.h>
+
+static const KernelTable *const kernel_tables[] = {
+    &scalar::kernels,
+    &sse42::kernels,
+    &avx2::kernels,
+    &avx512::kernels,
+};
+
+static const char *const isa_level_names[] = {"scalar", "sse4.2", "avx2",
+                                              "avx512"};
+
+static unsigned long long read_xcr0() {
+  unsigned int eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+}
+
+static int detect_isa_level() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return ISA_SCALAR;
+  if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_2) || !(ecx & bit_POPCNT))
+    return ISA_SCALAR;
+
+  // AVX code also needs the OS to save the ymm (and zmm) registers.
+  if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+    return ISA_SSE42;
+  unsigned long long xcr0 = read_xcr0();
+  if ((xcr0 & 0x6) != 0x6 || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return ISA_SSE42;
+  if (!(ebx & bit_AVX2))
+    return ISA_SSE42;
+
+  const unsigned int avx512 =
+      bit_AVX512F | bit_AVX512BW | bit_AVX512VL | bit_AVX512DQ;
+  if ((ebx & avx512) != avx512 || (xcr0 & 0xe0) != 0xe0)
+    return ISA_AVX2;
+  return ISA_AVX512;
+}
+
+static const int max_isa_level = detect_isa_level();
+
+static int default_isa_level() {
+  const char *env = getenv("INTERSECTION_ISA");
+  if (env == nullptr)
+    return max_isa_level;
+
+  for (int level = ISA_SCALAR; level <= ISA_AVX512; ++level) {
+    if (strcmp(env, isa_level_names[level]) == 0)
+      return std::min(level, max_isa_level);
+  }
+  std::cerr << "INTERSECTION_ISA: unknown level " << env << std::endl;
+  return max_isa_level;
+}
+
+static std::atomic<int> isa_level(default_isa_level());
+
+static inline const KernelTable &kernels() {
+  return *kernel_tables[isa_level.load(std::memory_order_relaxed)];
+}
+
+int intersection_max_isa_level() { return max_isa_level; }
+
+int intersection_isa_level() {
+  return isa_level.load(std::memory_order_relaxed);
+}
+
+bool intersection_set_isa_level(int level) {
+  if (level > max_isa_level)
+    return false;
+
+  isa_level.store(level < 0 ? default_isa_level() : level,
+                  std::memory_order_relaxed);
+  return true;
+}
+
+int intersect_scalarmerge_uint(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only) {
+  return kernels().scalarmerge_uint(set_a, size_a, set_b, size_b, set_c,
+                                    count_only);
+}
+
+int intersect_scalargalloping_uint(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, bool count_only) {
+  return kernels().scalargalloping_uint(set_a, size_a, set_b, size_b, set_c,
+                                        count_only);
+}
+
+int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
+                                 const unsigned int *set_b, int size_b,
+                                 unsigned int *set_c, bool count_only) {
+  return kernels().simdgalloping_uint(set_a, size_a, set_b, size_b, set_c,
+                                      count_only);
+}
+
+int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return kernels().qfilter_uint_b4(set_a, size_a, set_b, size_b, set_c,
+                                   count_only);
+}
+
+int intersect_qfilter_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return kernels().qfilter_uint_b8(set_a, size_a, set_b, size_b, set_c,
+                                   count_only);
+}
+
+int intersect_qfilter_uint_b16(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only) {
+  return kernels().qfilter_uint_b16(set_a, size_a, set_b, size_b, set_c,
+                                    count_only);
+}
+
+int intersect_qfilter_uint_b4_v2(const int *set_a, int size_a, const int *set_b,
+                                 int size_b, int *set_c) {
+  return kernels().qfilter_uint_b4_v2(set_a, size_a, set_b, size_b, set_c);
+}
+
+int intersect_shuffle_uint_b4(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return kernels().shuffle_uint_b4(set_a, size_a, set_b, size_b, set_c,
+                                   count_only);
+}
+
+int intersect_shuffle_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return kernels().shuffle_uint_b8(set_a, size_a, set_b, size_b, set_c,
+                                   count_only);
+}
+
+int intersect_shuffle_uint_vec256(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only) {
+  return kernels().shuffle_uint_vec256(set_a, size_a, set_b, size_b, set_c,
+                                       count_only);
+}
+
+int intersect_scalarmerge_bsr(const PackBase *bases_a, const PackState *states_a,
+                              int size_a, const PackBase *bases_b,
+                              const PackState *states_b, int size_b,
+                              PackBase *bases_c, PackState *states_c) {
+  return kernels().scalarmerge_bsr(bases_a, states_a, size_a, bases_b,
+                                   states_b, size_b, bases_c, states_c);
+}
+
+int intersect_scalargalloping_bsr(const PackBase *bases_a,
+                                  const PackState *states_a, int size_a,
+                                  const PackBase *bases_b,
+                                  const PackState *states_b, int size_b,
+                                  PackBase *bases_c, PackState *states_c) {
+  return kernels().scalargalloping_bsr(bases_a, states_a, size_a, bases_b,
+                                       states_b, size_b, bases_c, states_c);
+}
+
+int intersect_simdgalloping_bsr(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c) {
+  return kernels().simdgalloping_bsr(bases_a, states_a, size_a, bases_b,
+                                     states_b, size_b, bases_c, states_c);
+}
+
+int intersect_qfilter_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c) {
+  return kernels().qfilter_bsr_b4(bases_a, states_a, size_a, bases_b, states_b,
+                                  size_b, bases_c, states_c);
+}
+
+int intersect_qfilter_bsr_b4_v2(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c) {
+  return kernels().qfilter_bsr_b4_v2(bases_a, states_a, size_a, bases_b,
+                                     states_b, size_b, bases_c, states_c);
+}
+
+int intersect_shuffle_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c) {
+  return kernels().shuffle_bsr_b4(bases_a, states_a, size_a, bases_b, states_b,
+                                  size_b, bases_c, states_c);
+}
+
+int intersect_kway_uint(const std::size_t *sets, const int *sizes, int k,
+                        unsigned int *set_c, bool count_only) {
+  return kernels().kway_uint(sets, sizes, k, set_c, count_only);
+}
+
+std::size_t intersect_batch_uint(const unsigned int *values,
+                                 const std::size_t *offsets,
+                                 const unsigned int *pairs, int num_pairs,
+                                 int gallop_overhead, unsigned int *set_c,
+                                 std::size_t *offsets_c, bool count_only) {
+  return kernels().batch_uint(values, offsets, pairs, num_pairs,
+                              gallop_overhead, set_c, offsets_c, count_only);
+}
+
+int intersect_galloping_uint_positions(const unsigned int *set_a, int size_a,
+                                       const unsigned int *set_b, int size_b,
+                                       unsigned int *positions) {
+  return kernels().galloping_uint_positions(set_a, size_a, set_b, size_b,
+                                            positions);
+}
+
+int intersect_qfilter_uint_positions(const unsigned int *set_a, int size_a,
+                                     const unsigned int *set_b, int size_b,
+                                     unsigned int *positions) {
+  return kernels().qfilter_uint_positions(set_a, size_a, set_b, size_b,
+                                          positions);
+}
+
+int intersect_galloping_uint_callback(const unsigned int *set_a, int size_a,
+                                      const unsigned int *set_b, int size_b,
+                                      std::size_t callback,
+                                      std::size_t context) {
+  return kernels().galloping_uint_callback(set_a, size_a, set_b, size_b,
+                                           callback, context);
+}
+
+int intersect_qfilter_uint_callback(const unsigned int *set_a, int size_a,
+                                    const unsigned int *set_b, int size_b,
+                                    std::size_t callback, std::size_t context) {
+  return kernels().qfilter_uint_callback(set_a, size_a, set_b, size_b,
+                                         callback, context);
+}
+
+int intersect_galloping_u64(const uint64_t *set_a, int size_a,
+                            const uint64_t *set_b, int size_b,
+                            uint64_t *set_c, bool count_only) {
+  return kernels().galloping_u64(set_a, size_a, set_b, size_b, set_c,
+                                 count_only);
+}
+
+int intersect_qfilter_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only) {
+  return kernels().qfilter_u64(set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_shuffle_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only) {
+  return kernels().shuffle_u64(set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_galloping_u16(const uint16_t *set_a, int size_a,
+                            const uint16_t *set_b, int size_b,
+                            uint16_t *set_c, bool count_only) {
+  return kernels().galloping_u16(set_a, size_a, set_b, size_b, set_c,
+                                 count_only);
+}
+
+int intersect_qfilter_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only) {
+  return kernels().qfilter_u16(set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_shuffle_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only) {
+  return kernels().shuffle_u16(set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_partitioned_u16(const uint16_t *part_a, int size_a,
+                              const uint16_t *part_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return kernels().partitioned_u16(part_a, size_a, part_b, size_b, set_c,
+                                   count_only);
+}
+
+int set_union_uint(const unsigned int *set_a, int size_a,
+                   const unsigned int *set_b, int size_b, unsigned int *set_c,
+                   bool count_only) {
+  return kernels().set_union_uint(set_a, size_a, set_b, size_b, set_c,
+                                  count_only);
+}
+
+int set_difference_uint(const unsigned int *set_a, int size_a,
+                        const unsigned int *set_b, int size_b,
+                        unsigned int *set_c, bool count_only) {
+  return kernels().set_difference_uint(set_a, size_a, set_b, size_b, set_c,
+                                       count_only);
+}
+
+int set_symmetric_difference_uint(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only) {
+  return kernels().set_symmetric_difference_uint(set_a, size_a, set_b, size_b,
+                                                 set_c, count_only);
+}
+
+int intersect_galloping_uint_limit(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, int limit,
+                                   bool count_only) {
+  return kernels().galloping_uint_limit(set_a, size_a, set_b, size_b, set_c,
+                                        limit, count_only);
+}
+
+int intersect_qfilter_uint_limit(const unsigned int *set_a, int size_a,
+                                 const unsigned int *set_b, int size_b,
+                                 unsigned int *set_c, int limit,
+                                 bool count_only) {
+  return kernels().qfilter_uint_limit(set_a, size_a, set_b, size_b, set_c,
+                                      limit, count_only);
+}
+
+int intersect_bitmap_uint(const unsigned int *set_a, int size_a,
+                          const unsigned int *words, unsigned int base,
+                          int num_words, unsigned int *set_c,
+                          bool count_only) {
+  return kernels().bitmap_uint(set_a, size_a, words, base, num_words, set_c,
+                               count_only);
+}
@@ -0,0 +1,115 @@
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+
+#include "intersection/include/util.hpp"
+
+enum IsaLevel {
+  ISA_SCALAR = 0,
+  ISA_SSE42 = 1,
+  ISA_AVX2 = 2,
+  ISA_AVX512 = 3,
+};
+
+typedef int (*UintKernel)(const unsigned int *set_a, int size_a,
+                          const unsigned int *set_b, int size_b,
+                          unsigned int *set_c, bool count_only);
+typedef int (*IntKernel)(const int *set_a, int size_a, const int *set_b,
+                         int size_b, int *set_c);
+typedef int (*BsrKernel)(const PackBase *bases_a, const PackState *states_a,
+                         int size_a, const PackBase *bases_b,
+                         const PackState *states_b, int size_b,
+                         PackBase *bases_c, PackState *states_c);
+typedef int (*KwayKernel)(const std::size_t *sets, const int *sizes, int k,
+                          unsigned int *set_c, bool count_only);
+typedef int (*BitmapKernel)(const unsigned int *set_a, int size_a,
+                            const unsigned int *words, unsigned int base,
+                            int num_words, unsigned int *set_c,
+                            bool count_only);
+typedef std::size_t (*BatchKernel)(const unsigned int *values,
+                                   const std::size_t *offsets,
+                                   const unsigned int *pairs, int num_pairs,
+                                   int gallop_overhead, unsigned int *set_c,
+                                   std::size_t *offsets_c, bool count_only);
+typedef int (*PositionKernel)(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *positions);
+typedef int (*CallbackKernel)(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              std::size_t callback, std::size_t context);
+typedef int (*LimitKernel)(const unsigned int *set_a, int size_a,
+                           const unsigned int *set_b, int size_b,
+                           unsigned int *set_c, int limit, bool count_only);
+typedef int (*U64Kernel)(const uint64_t *set_a, int size_a,
+                         const uint64_t *set_b, int size_b, uint64_t *set_c,
+                         bool count_only);
+typedef int (*U16Kernel)(const uint16_t *set_a, int size_a,
+                         const uint16_t *set_b, int size_b, uint16_t *set_c,
+                         bool count_only);
+typedef int (*PartitionedKernel)(const uint16_t *part_a, int size_a,
+                                 const uint16_t *part_b, int size_b,
+                                 unsigned int *set_c, bool count_only);
+
+// One build of every kernel family, in the order of intersection_algos.hpp.
+struct KernelTable {
+  UintKernel scalarmerge_uint;
+  UintKernel scalargalloping_uint;
+  UintKernel simdgalloping_uint;
+  UintKernel qfilter_uint_b4;
+  UintKernel qfilter_uint_b8;
+  UintKernel qfilter_uint_b16;
+  IntKernel qfilter_uint_b4_v2;
+  UintKernel shuffle_uint_b4;
+  UintKernel shuffle_uint_b8;
+  UintKernel shuffle_uint_vec256;
+  BsrKernel scalarmerge_bsr;
+  BsrKernel scalargalloping_bsr;
+  BsrKernel simdgalloping_bsr;
+  BsrKernel qfilter_bsr_b4;
+  BsrKernel qfilter_bsr_b4_v2;
+  BsrKernel shuffle_bsr_b4;
+  KwayKernel kway_uint;
+  BatchKernel batch_uint;
+  PositionKernel galloping_uint_positions;
+  PositionKernel qfilter_uint_positions;
+  CallbackKernel galloping_uint_callback;
+  CallbackKernel qfilter_uint_callback;
+  U64Kernel galloping_u64;
+  U64Kernel qfilter_u64;
+  U64Kernel shuffle_u64;
+  U16Kernel galloping_u16;
+  U16Kernel qfilter_u16;
+  U16Kernel shuffle_u16;
+  PartitionedKernel partitioned_u16;
+  UintKernel set_union_uint;
+  UintKernel set_difference_uint;
+  UintKernel set_symmetric_difference_uint;
+  LimitKernel galloping_uint_limit;
+  LimitKernel qfilter_uint_limit;
+  BitmapKernel bitmap_uint;
+};
+
+// Defined by the per-ISA builds of intersection_algos.cpp.
+namespace scalar {
+extern const KernelTable kernels;
+}
+namespace sse42 {
+extern const KernelTable kernels;
+}
+namespace avx2 {
+extern const KernelTable kernels;
+}
+namespace avx512 {
+extern const KernelTable kernels;
+}
+
+// The highest level the host supports, from cpuid.
+int intersection_max_isa_level();
+// The level the kernels in intersection_algos.hpp currently run at. It
+// defaults to the highest supported one, or to INTERSECTION_ISA (one of
+// "scalar", "sse4.2", "avx2", "avx512") when that names a lower level.
+int intersection_isa_level();
+// Switches every kernel to `level`, a negative level restores the default.
+// Returns false, and keeps the current level, if the host lacks `level`.
+bool intersection_set_isa_level(int level);
+
+#endif
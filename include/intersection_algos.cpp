@@ -1,13 +1,21 @@
 #include "intersection/include/intersection_algos.hpp"
+#include "intersection/include/intersection_tables.hpp"
 
+// This file is compiled once per ISA level by build.rs, and each build puts
+// its kernels into the namespace named by INTERSECTION_ISA. Kernels that need
+// more than the build targets are swapped for the closest one that fits when
+// filling in the `kernels` table at the bottom.
+#ifndef INTERSECTION_ISA
+#error "INTERSECTION_ISA must name the ISA level this file is compiled for"
+#endif
+
+namespace INTERSECTION_ISA {
+
+#if defined(__SSE4_2__)
 constexpr int cyclic_shift1 = _MM_SHUFFLE(0, 3, 2, 1); // rotating right
 constexpr int cyclic_shift2 = _MM_SHUFFLE(2, 1, 0, 3); // rotating left
 constexpr int cyclic_shift3 = _MM_SHUFFLE(1, 0, 3, 2); // between
 
-static const __m128i all_zero_si128 = _mm_setzero_si128();
-static const __m128i all_one_si128 =
-    _mm_set_epi32(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff);
-
 static const uint8_t shuffle_pi8_array[256] = {
     255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
     255, 0,   1,   2,   3,   255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
@@ -29,87 +37,354 @@ static const uint8_t shuffle_pi8_array[256] = {
     15,
 };
 static const __m128i *shuffle_mask = (__m128i *)(shuffle_pi8_array);
+#endif
 
-uint32_t *prepare_shuffling_dict_avx() {
-  uint32_t *arr = new uint32_t[2048];
-  for (int i = 0; i < 256; ++i) {
-    int count = 0, rest = 7;
-    for (int b = 0; b < 8; ++b) {
-      if (i & (1 << b)) {
-        // n index at pos p - move nth element to pos p
-        arr[i * 8 + count] = b; // move all set bits to beginning
-        ++count;
-      } else {
-        arr[i * 8 + rest] = b; // move rest at the end
-        --rest;
-      }
+// Output policies. Every uint kernel is a template on one of them, so each
+// mode gets its own instantiation without a per-match branch. `scalar` takes
+// one matching element of set_a, `block4/8/16` a block of set_a together with
+// its loaded lanes and the mask of the lanes that matched. The galloping,
+// merge and QFilter kernels stop once `done` holds, given the most matches
+// the elements left could still make.
+struct CountOutput {
+  int size;
+
+  CountOutput() : size(0) {}
+
+  bool done(int) const { return false; }
+
+  void scalar(const unsigned int *) { size++; }
+#if defined(__SSE4_2__)
+  void block4(const unsigned int *, __m128i, int mask) {
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX2__)
+  void block8(const unsigned int *, __m256i, int mask) {
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  void block16(const unsigned int *, __m512i, __mmask16 mask) {
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+};
+
+// Writes the matches to set_c, the block stores run up to 16 elements past
+// the count.
+struct ArrayOutput {
+  unsigned int *set_c;
+  int size;
+
+  explicit ArrayOutput(unsigned int *set_c) : set_c(set_c), size(0) {}
+
+  bool done(int) const { return false; }
+
+  void scalar(const unsigned int *match) { set_c[size++] = *match; }
+#if defined(__SSE4_2__)
+  void block4(const unsigned int *, __m128i v_a, int mask) {
+    __m128i p = _mm_shuffle_epi8(v_a, shuffle_mask[mask]);
+    _mm_storeu_si128((__m128i *)(set_c + size), p);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX2__)
+  void block8(const unsigned int *, __m256i v_a, int mask) {
+    __m256i idx =
+        _mm256_loadu_si256((const __m256i *)&shuffle_mask_avx[mask * 8]);
+    __m256i p = _mm256_permutevar8x32_epi32(v_a, idx);
+    _mm256_storeu_si256((__m256i *)(set_c + size), p);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  void block16(const unsigned int *, __m512i v_a, __mmask16 mask) {
+    _mm512_mask_compressstoreu_epi32(set_c + size, mask, v_a);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+};
+
+// Calls back with every match in order.
+struct CallbackOutput {
+  MatchCallback callback;
+  void *context;
+  int size;
+
+  CallbackOutput(MatchCallback callback, void *context)
+      : callback(callback), context(context), size(0) {}
+
+  bool done(int) const { return false; }
+
+  void scalar(const unsigned int *match) {
+    callback(context, *match);
+    size++;
+  }
+  void lanes(const unsigned int *block, unsigned int mask) {
+    for (; mask != 0; mask &= mask - 1) {
+      callback(context, block[__builtin_ctz(mask)]);
+      size++;
+    }
+  }
+#if defined(__SSE4_2__)
+  void block4(const unsigned int *block, __m128i, int mask) {
+    lanes(block, mask);
+  }
+#endif
+#if defined(__AVX2__)
+  void block8(const unsigned int *block, __m256i, int mask) {
+    lanes(block, mask);
+  }
+#endif
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  void block16(const unsigned int *block, __m512i, __mmask16 mask) {
+    lanes(block, mask);
+  }
+#endif
+};
+
+// Writes the index in set_a of every match, with the same slack as
+// ArrayOutput.
+struct PositionOutput {
+  const unsigned int *set_a;
+  unsigned int *positions;
+  int size;
+
+  PositionOutput(const unsigned int *set_a, unsigned int *positions)
+      : set_a(set_a), positions(positions), size(0) {}
+
+  bool done(int) const { return false; }
+
+  void scalar(const unsigned int *match) {
+    positions[size++] = match - set_a;
+  }
+#if defined(__SSE4_2__)
+  void block4(const unsigned int *block, __m128i, int mask) {
+    __m128i lanes = _mm_add_epi32(_mm_set1_epi32(block - set_a),
+                                  _mm_setr_epi32(0, 1, 2, 3));
+    __m128i p = _mm_shuffle_epi8(lanes, shuffle_mask[mask]);
+    _mm_storeu_si128((__m128i *)(positions + size), p);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX2__)
+  void block8(const unsigned int *block, __m256i, int mask) {
+    __m256i lanes = _mm256_add_epi32(_mm256_set1_epi32(block - set_a),
+                                     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i idx =
+        _mm256_loadu_si256((const __m256i *)&shuffle_mask_avx[mask * 8]);
+    __m256i p = _mm256_permutevar8x32_epi32(lanes, idx);
+    _mm256_storeu_si256((__m256i *)(positions + size), p);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  void block16(const unsigned int *block, __m512i, __mmask16 mask) {
+    __m512i lanes =
+        _mm512_add_epi32(_mm512_set1_epi32(block - set_a),
+                         _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15));
+    _mm512_mask_compressstoreu_epi32(positions + size, mask, lanes);
+    size += _mm_popcnt_u32(mask);
+  }
+#endif
+};
+
+// Stops the kernel after `limit` matches, or with `cutoff` once the elements
+// left cannot make up the limit. A block may take the count past the limit.
+template <class Output> struct Limited : Output {
+  int limit;
+  bool cutoff;
+
+  Limited(const Output &out, int limit, bool cutoff)
+      : Output(out), limit(limit), cutoff(cutoff) {}
+
+  bool done(int remaining) const {
+    return this->size >= limit || (cutoff && this->size + remaining < limit);
+  }
+};
+
+template <class Output>
+using UintImpl = void (*)(const unsigned int *set_a, int size_a,
+                          const unsigned int *set_b, int size_b, Output &out);
+
+// The count_only entry point over the two instantiations of a kernel.
+static inline int run_uint(UintImpl<CountOutput> count_impl,
+                           UintImpl<ArrayOutput> array_impl,
+                           const unsigned int *set_a, int size_a,
+                           const unsigned int *set_b, int size_b,
+                           unsigned int *set_c, bool count_only) {
+  if (count_only) {
+    CountOutput out;
+    count_impl(set_a, size_a, set_b, size_b, out);
+    return out.size;
+  }
+
+  ArrayOutput out(set_c);
+  array_impl(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+template <class Output>
+static void scalarmerge_uint(const unsigned int *set_a, int size_a,
+                             const unsigned int *set_b, int size_b,
+                             Output &out) {
+  int i = 0, j = 0;
+  while (i < size_a && j < size_b) {
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
+    if (set_a[i] == set_b[j]) {
+      out.scalar(set_a + i);
+      i++;
+      j++;
+    } else if (set_a[i] < set_b[j]) {
+      i++;
+    } else {
+      j++;
     }
   }
-  return arr;
-}
-static const uint32_t *shuffle_mask_avx = prepare_shuffling_dict_avx();
-
-// int intersect_scalarmerge_bsr(int* bases_a, int* states_a, int size_a,
-//         int* bases_b, int* states_b, int size_b,
-//         int* bases_c, int* states_c)
-//{
-//     int i = 0, j = 0, size_c = 0;
-//     while (i < size_a && j < size_b) {
-//         if (bases_a[i] == bases_b[j]) {
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//             i++; j++;
-//         } else if (bases_a[i] < bases_b[j]){
-//             i++;
-//         } else {
-//             j++;
-//         }
-//     }
-//
-//     return size_c;
-// }
-
-// int intersect_scalargalloping_bsr(int* bases_a, int* states_a, int size_a,
-//             int* bases_b, int* states_b, int size_b,
-//             int* bases_c, int* states_c)
-//{
-//     if (size_a > size_b)
-//         return intersect_scalargalloping_bsr(bases_b, states_b, size_b,
-//                 bases_a, states_a, size_a,
-//                 bases_c, states_c);
-//
-//     int j = 0, size_c = 0;
-//     for (int i = 0; i < size_a; ++i) {
-//         // double-jump:
-//         int r = 1;
-//         while (j + r < size_b && bases_a[i] > bases_b[j + r]) r <<= 1;
-//         // binary search:
-//         int right = (j + r < size_b) ? (j + r) : (size_b - 1);
-//         if (bases_b[right] < bases_a[i]) break;
-//         int left = j + (r >> 1);
-//         while (left < right) {
-//             int mid = (left + right) >> 1;
-//             if (bases_b[mid] >= bases_a[i]) right = mid;
-//             else left = mid + 1;
-//         }
-//         j = left;
-//
-//         if (bases_a[i] == bases_b[j]) {
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//         }
-//     }
-//
-//     return size_c;
-// }
+}
 
-int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
+int intersect_scalarmerge_uint(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only) {
+  return run_uint(scalarmerge_uint<CountOutput>, scalarmerge_uint<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+
+template <class Output>
+static void scalargalloping_uint(const unsigned int *set_a, int size_a,
                                  const unsigned int *set_b, int size_b,
-                                 unsigned int *set_c, bool count_only) {
+                                 Output &out) {
+  int j = 0;
+  for (int i = 0; i < size_a && j < size_b; ++i) {
+    if (out.done(size_a - i))
+      return;
+    // double-jump:
+    int r = 1;
+    while (j + r < size_b && set_a[i] > set_b[j + r])
+      r <<= 1;
+    // binary search:
+    int right = (j + r < size_b) ? (j + r) : (size_b - 1);
+    if (set_b[right] < set_a[i])
+      break;
+    int left = j + (r >> 1);
+    while (left < right) {
+      int mid = (left + right) >> 1;
+      if (set_b[mid] >= set_a[i])
+        right = mid;
+      else
+        left = mid + 1;
+    }
+    j = left;
+
+    if (set_a[i] == set_b[j]) {
+      out.scalar(set_a + i);
+    }
+  }
+}
+
+int intersect_scalargalloping_uint(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, bool count_only) {
+  return run_uint(scalargalloping_uint<CountOutput>, scalargalloping_uint<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+
+int intersect_scalarmerge_bsr(const PackBase *bases_a, const PackState *states_a,
+                              int size_a, const PackBase *bases_b,
+                              const PackState *states_b, int size_b,
+                              PackBase *bases_c, PackState *states_c) {
+  int i = 0, j = 0, size_c = 0;
+  while (i < size_a && j < size_b) {
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+      i++;
+      j++;
+    } else if (bases_a[i] < bases_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return size_c;
+}
+
+int intersect_scalargalloping_bsr(const PackBase *bases_a,
+                                  const PackState *states_a, int size_a,
+                                  const PackBase *bases_b,
+                                  const PackState *states_b, int size_b,
+                                  PackBase *bases_c, PackState *states_c) {
+  if (size_a > size_b)
+    return intersect_scalargalloping_bsr(bases_b, states_b, size_b, bases_a,
+                                         states_a, size_a, bases_c, states_c);
+
+  int j = 0, size_c = 0;
+  for (int i = 0; i < size_a && j < size_b; ++i) {
+    // double-jump:
+    int r = 1;
+    while (j + r < size_b && bases_a[i] > bases_b[j + r])
+      r <<= 1;
+    // binary search:
+    int right = (j + r < size_b) ? (j + r) : (size_b - 1);
+    if (bases_b[right] < bases_a[i])
+      break;
+    int left = j + (r >> 1);
+    while (left < right) {
+      int mid = (left + right) >> 1;
+      if (bases_b[mid] >= bases_a[i])
+        right = mid;
+      else
+        left = mid + 1;
+    }
+    j = left;
+
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+    }
+  }
+
+  return size_c;
+}
 
+#if !defined(__SSE4_2__)
+// Stands in for the signed SIMD kernels below SSE4.2.
+static int intersect_scalarmerge_int(const int *set_a, int size_a,
+                                     const int *set_b, int size_b,
+                                     int *set_c) {
   int i = 0, j = 0, size_c = 0;
+  while (i < size_a && j < size_b) {
+    if (set_a[i] == set_b[j]) {
+      set_c[size_c++] = set_a[i];
+      i++;
+      j++;
+    } else if (set_a[i] < set_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return size_c;
+}
+#endif
+
+#if defined(__SSE4_2__)
+template <class Output>
+static void simdgalloping_uint(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               Output &out) {
+
+  int i = 0, j = 0;
   int qs_b = size_b - (size_b & 3);
-  for (i = 0; i < size_a; ++i) {
+  for (i = 0; i < size_a && j < qs_b; ++i) {
+    if (out.done(size_a - i))
+      return;
     // double-jump:
     int r = 1;
     while (j + (r << 2) < qs_b && set_a[i] > set_b[j + (r << 2) + 3])
@@ -133,21 +408,15 @@ int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
     __m128i cmp_mask = _mm_cmpeq_epi32(v_a, v_b);
     int mask = _mm_movemask_ps((__m128)cmp_mask);
     if (mask != 0) {
-      if (count_only) {
-        size_c++;
-      } else {
-        set_c[size_c++] = set_a[i];
-      }
+      out.scalar(set_a + i);
     }
   }
 
   while (i < size_a && j < size_b) {
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
     if (set_a[i] == set_b[j]) {
-      if (count_only) {
-        size_c++;
-      } else {
-        set_c[size_c++] = set_a[i];
-      }
+      out.scalar(set_a + i);
       i++;
       j++;
     } else if (set_a[i] < set_b[j]) {
@@ -156,135 +425,73 @@ int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
       j++;
     }
   }
+}
 
-  return size_c;
+int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
+                                 const unsigned int *set_b, int size_b,
+                                 unsigned int *set_c, bool count_only) {
+  return run_uint(simdgalloping_uint<CountOutput>, simdgalloping_uint<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
 }
 
-// int intersect_simdgalloping_bsr(int* bases_a, int* states_a, int size_a,
-//         int* bases_b, int* states_b, int size_b,
-//         int* bases_c, int* states_c)
-//{
-//     if (size_a > size_b)
-//         return intersect_simdgalloping_bsr(bases_b, states_b, size_b,
-//                 bases_a, states_a, size_a,
-//                 bases_c, states_c);
-//
-//     int i = 0, j = 0, size_c = 0;
-//     int qs_b = size_b - (size_b & 3);
-//     for (i = 0; i < size_a; ++i) {
-//         // double-jump:
-//         int r = 1;
-//         while (j + (r << 2) < qs_b && bases_a[i] > bases_b[j + (r << 2) + 3])
-//         r <<= 1;
-//         // binary search:
-//         int upper = (j + (r << 2) < qs_b) ? (r) : ((qs_b - j - 4) >> 2);
-//         if (bases_b[j + (upper << 2) + 3] < bases_a[i]) break;
-//         int lower = (r >> 1);
-//         while (lower < upper) {
-//             int mid = (lower + upper) >> 1;
-//             if (bases_b[j + (mid << 2) + 3] >= bases_a[i]) upper = mid;
-//             else lower = mid + 1;
-//         }
-//         j += (lower << 2);
-//
-//         __m128i bv_a = _mm_set_epi32(bases_a[i], bases_a[i], bases_a[i],
-//         bases_a[i]);
-//         __m128i bv_b = _mm_lddqu_si128((__m128i*)(bases_b + j));
-//         __m128i cmp_mask = _mm_cmpeq_epi32(bv_a, bv_b);
-//         int mask = _mm_movemask_ps((__m128)cmp_mask);
-//         if (mask != 0) {
-//             int p = __builtin_ctz(mask);
-//             states_c[size_c] = states_a[i] & states_b[j + p];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//         }
-//     }
-//
-//     while (i < size_a && j < size_b) {
-//         if (bases_a[i] == bases_b[j]) {
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//             i++; j++;
-//         } else if (bases_a[i] < bases_b[j]){
-//             i++;
-//         } else {
-//             j++;
-//         }
-//     }
-//
-//     return size_c;
-// }
-
-int *prepare_byte_check_mask_dict2() {
-  int *mask = new int[65536];
-
-  auto trans_c_s = [](const int c) -> int {
-    switch (c) {
-    case 0:
-      return -1; // no match
-    case 1:
-      return 0;
-    case 2:
-      return 1;
-    case 4:
-      return 2;
-    case 8:
-      return 3;
-    default:
-      return 4; // multiple matches.
-    }
-  };
-
-  for (int x = 0; x < 65536; ++x) {
-    int c0 = (x & 0xf), c1 = ((x >> 4) & 0xf);
-    int c2 = ((x >> 8) & 0xf), c3 = ((x >> 12) & 0xf);
-    int s0 = trans_c_s(c0), s1 = trans_c_s(c1);
-    int s2 = trans_c_s(c2), s3 = trans_c_s(c3);
-
-    bool is_multiple_match = (s0 == 4) || (s1 == 4) || (s2 == 4) || (s3 == 4);
-    if (is_multiple_match) {
-      mask[x] = -1;
-      continue;
-    }
-    bool is_no_match = (s0 == -1) && (s1 == -1) && (s2 == -1) && (s3 == -1);
-    if (is_no_match) {
-      mask[x] = -2;
-      continue;
-    }
-    if (s0 == -1) {
-      s0 = 0;
-    }
-    if (s1 == -1) {
-      s1 = 1;
-    }
-    if (s2 == -1) {
-      s2 = 2;
+int intersect_simdgalloping_bsr(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c) {
+  if (size_a > size_b)
+    return intersect_simdgalloping_bsr(bases_b, states_b, size_b, bases_a,
+                                       states_a, size_a, bases_c, states_c);
+
+  int i = 0, j = 0, size_c = 0;
+  int qs_b = size_b - (size_b & 3);
+  for (i = 0; i < size_a && j < qs_b; ++i) {
+    // double-jump:
+    int r = 1;
+    while (j + (r << 2) < qs_b && bases_a[i] > bases_b[j + (r << 2) + 3])
+      r <<= 1;
+    // binary search:
+    int upper = (j + (r << 2) < qs_b) ? (r) : ((qs_b - j - 4) >> 2);
+    if (bases_b[j + (upper << 2) + 3] < bases_a[i])
+      break;
+    int lower = (r >> 1);
+    while (lower < upper) {
+      int mid = (lower + upper) >> 1;
+      if (bases_b[j + (mid << 2) + 3] >= bases_a[i])
+        upper = mid;
+      else
+        lower = mid + 1;
     }
-    if (s3 == -1) {
-      s3 = 3;
+    j += (lower << 2);
+
+    __m128i bv_a = _mm_set1_epi32(bases_a[i]);
+    __m128i bv_b = _mm_lddqu_si128((__m128i *)(bases_b + j));
+    __m128i cmp_mask = _mm_cmpeq_epi32(bv_a, bv_b);
+    int mask = _mm_movemask_ps((__m128)cmp_mask);
+    if (mask != 0) {
+      int p = __builtin_ctz(mask);
+      states_c[size_c] = states_a[i] & states_b[j + p];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
     }
-    mask[x] = (s0) | (s1 << 2) | (s2 << 4) | (s3 << 6);
   }
 
-  return mask;
-}
-static const int *byte_check_mask_dict = prepare_byte_check_mask_dict2();
-
-uint8_t *prepare_match_shuffle_dict2() {
-  uint8_t *dict = new uint8_t[4096];
-
-  for (int x = 0; x < 256; ++x) {
-    for (int i = 0; i < 4; ++i) {
-      uint8_t c = (x >> (i << 1)) & 3; // c = 0, 1, 2, 3
-      int pos = x * 16 + i * 4;
-      for (uint8_t j = 0; j < 4; ++j)
-        dict[pos + j] = c * 4 + j;
+  while (i < size_a && j < size_b) {
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+      i++;
+      j++;
+    } else if (bases_a[i] < bases_b[j]) {
+      i++;
+    } else {
+      j++;
     }
   }
 
-  return dict;
+  return size_c;
 }
-static const __m128i *match_shuffle_dict =
-    (__m128i *)prepare_match_shuffle_dict2();
 
 static const uint8_t byte_check_group_a_pi8[64] = {
     0, 0, 0, 0, 4, 4, 4, 4, 8,  8,  8,  8,  12, 12, 12, 12,
@@ -303,19 +510,23 @@ static const __m128i *byte_check_group_a_order =
 static const __m128i *byte_check_group_b_order =
     (__m128i *)(byte_check_group_b_pi8);
 
-int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
-                              const unsigned int *set_b, int size_b,
-                              unsigned int *set_c, bool count_only) {
-  int i = 0, j = 0, size_c = 0;
+template <class Output>
+static void qfilter_uint_b4(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  int i = 0, j = 0;
   int qs_a = size_a - (size_a & 3);
   int qs_b = size_b - (size_b & 3);
 
   while (i < qs_a && j < qs_b) {
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
+    const unsigned int *block_a = set_a + i;
     __m128i v_a = _mm_lddqu_si128((__m128i *)(set_a + i));
     __m128i v_b = _mm_lddqu_si128((__m128i *)(set_b + j));
 
-    int a_max = set_a[i + 3];
-    int b_max = set_b[j + 3];
+    unsigned int a_max = set_a[i + 3];
+    unsigned int b_max = set_b[j + 3];
     // i += (a_max <= b_max) * 4;
     // j += (b_max <= a_max) * 4;
     if (a_max == b_max) {
@@ -369,22 +580,14 @@ int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
     __m128i cmp_mask = _mm_cmpeq_epi32(v_a, sf_v_b);
 
     int mask = _mm_movemask_ps((__m128)cmp_mask);
-    __m128i p = _mm_shuffle_epi8(v_a, shuffle_mask[mask]);
-
-    if (!count_only) {
-      _mm_storeu_si128((__m128i *)(set_c + size_c), p);
-    }
-
-    size_c += _mm_popcnt_u32(mask);
+    out.block4(block_a, v_a, mask);
   }
 
   while (i < size_a && j < size_b) {
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
     if (set_a[i] == set_b[j]) {
-      if (count_only) {
-        size_c++;
-      } else {
-        set_c[size_c++] = set_a[i];
-      }
+      out.scalar(set_a + i);
       i++;
       j++;
     } else if (set_a[i] < set_b[j]) {
@@ -393,8 +596,13 @@ int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
       j++;
     }
   }
+}
 
-  return size_c;
+int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return run_uint(qfilter_uint_b4<CountOutput>, qfilter_uint_b4<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
 }
 
 int intersect_qfilter_uint_b4_v2(const int *set_a, int size_a, const int *set_b,
@@ -467,291 +675,74 @@ int intersect_qfilter_uint_b4_v2(const int *set_a, int size_a, const int *set_b,
   return size_c;
 }
 
-// int intersect_qfilter_bsr_b4(int* bases_a, int* states_a, int size_a,
-//             int* bases_b, int* states_b, int size_b,
-//             int* bases_c, int* states_c)
-//{
-//     int i = 0, j = 0, size_c = 0;
-//     int qs_a = size_a - (size_a & 3);
-//     int qs_b = size_b - (size_b & 3);
-//
-//     while (i < qs_a && j < qs_b) {
-//         __m128i base_a = _mm_lddqu_si128((__m128i*)(bases_a + i));
-//         __m128i base_b = _mm_lddqu_si128((__m128i*)(bases_b + j));
-//         __m128i state_a = _mm_lddqu_si128((__m128i*)(states_a + i));
-//         __m128i state_b = _mm_lddqu_si128((__m128i*)(states_b + j));
-//
-//         int a_max = bases_a[i + 3];
-//         int b_max = bases_b[j + 3];
-//         if (a_max == b_max) {
-//             i += 4;
-//             j += 4;
-//             _mm_prefetch((char*) (bases_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (bases_b + j), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_b + j), _MM_HINT_NTA);
-//         } else if (a_max < b_max) {
-//             i += 4;
-//             _mm_prefetch((char*) (bases_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_a + i), _MM_HINT_NTA);
-//         } else {
-//             j += 4;
-//             _mm_prefetch((char*) (bases_b + j), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_b + j), _MM_HINT_NTA);
-//         }
-//
-//         __m128i byte_group_a = _mm_shuffle_epi8(base_a,
-//         byte_check_group_a_order[0]);
-//         __m128i byte_group_b = _mm_shuffle_epi8(base_b,
-//         byte_check_group_b_order[0]);
-//         __m128i byte_check_mask = _mm_cmpeq_epi8(byte_group_a, byte_group_b);
-//         int bc_mask = _mm_movemask_epi8(byte_check_mask);
-//         int ms_order = byte_check_mask_dict[bc_mask];
-//         if (__builtin_expect(ms_order == -1, 0)) {
-//             byte_group_a = _mm_shuffle_epi8(base_a,
-//             byte_check_group_a_order[1]); byte_group_b =
-//             _mm_shuffle_epi8(base_b, byte_check_group_b_order[1]);
-//             byte_check_mask = _mm_and_si128(byte_check_mask,
-//                     _mm_cmpeq_epi8(byte_group_a, byte_group_b));
-//             bc_mask = _mm_movemask_epi8(byte_check_mask);
-//             ms_order = byte_check_mask_dict[bc_mask];
-//             if (__builtin_expect(ms_order == -1, 0)) {
-//                 byte_group_a = _mm_shuffle_epi8(base_a,
-//                 byte_check_group_a_order[2]); byte_group_b =
-//                 _mm_shuffle_epi8(base_b, byte_check_group_b_order[2]);
-//                 byte_check_mask = _mm_and_si128(byte_check_mask,
-//                         _mm_cmpeq_epi8(byte_group_a, byte_group_b));
-//                 bc_mask = _mm_movemask_epi8(byte_check_mask);
-//                 ms_order = byte_check_mask_dict[bc_mask];
-//                 if (__builtin_expect(ms_order == -1, 0)) {
-//                     byte_group_a = _mm_shuffle_epi8(base_a,
-//                     byte_check_group_a_order[3]); byte_group_b =
-//                     _mm_shuffle_epi8(base_b, byte_check_group_b_order[3]);
-//                     byte_check_mask = _mm_and_si128(byte_check_mask,
-//                             _mm_cmpeq_epi8(byte_group_a, byte_group_b));
-//                     bc_mask = _mm_movemask_epi8(byte_check_mask);
-//                     ms_order = byte_check_mask_dict[bc_mask];
-//                 }
-//             }
-//         }
-//
-//         if (ms_order == -2) continue; // "no match" in this two block.
-//
-//         __m128i sf_base_b = _mm_shuffle_epi8(base_b,
-//         match_shuffle_dict[ms_order]);
-//         __m128i sf_state_b = _mm_shuffle_epi8(state_b,
-//         match_shuffle_dict[ms_order]);
-//         __m128i cmp_mask = _mm_cmpeq_epi32(base_a, sf_base_b);
-//         __m128i and_state = _mm_and_si128(state_a, sf_state_b);
-//         __m128i state_mask = _mm_cmpeq_epi32(and_state, all_zero_si128);
-//         cmp_mask = _mm_andnot_si128(state_mask, cmp_mask);
-//
-//         int mask = _mm_movemask_ps((__m128)cmp_mask);
-//         __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
-//         __m128i res_s = _mm_shuffle_epi8(and_state, shuffle_mask[mask]);
-//         _mm_storeu_si128((__m128i*)(bases_c + size_c), res_b);
-//         _mm_storeu_si128((__m128i*)(states_c + size_c), res_s);
-//
-//         size_c += _mm_popcnt_u32(mask);
-//     }
-//
-//     while (i < size_a && j < size_b) {
-//         if (bases_a[i] == bases_b[j]) {
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//             i++; j++;
-//         } else if (bases_a[i] < bases_b[j]){
-//             i++;
-//         } else {
-//             j++;
-//         }
-//     }
-//
-//     return size_c;
-// }
-
-// int intersect_qfilter_bsr_b4_v2(int* bases_a, int* states_a, int size_a,
-//             int* bases_b, int* states_b, int size_b,
-//             int* bases_c, int* states_c)
-//{
-//     int i = 0, j = 0, size_c = 0;
-//     int qs_a = size_a - (size_a & 3);
-//     int qs_b = size_b - (size_b & 3);
-//
-//     __m128i base_a = _mm_lddqu_si128((__m128i*)bases_a + i);
-//     __m128i base_b = _mm_lddqu_si128((__m128i*)bases_b + j);
-//     __m128i byte_group_a = _mm_shuffle_epi8(base_a,
-//     byte_check_group_a_order[0]);
-//     __m128i byte_group_b = _mm_shuffle_epi8(base_b,
-//     byte_check_group_b_order[0]);
-//     __m128i cmp_mask, and_state;
-//
-//     while (i < qs_a && j < qs_b) {
-//         __m128i byte_check_mask = _mm_cmpeq_epi8(byte_group_a, byte_group_b);
-//         int bc_mask = _mm_movemask_epi8(byte_check_mask);
-//         int ms_order = byte_check_mask_dict[bc_mask];
-//
-//         if (__builtin_expect(ms_order != -2, 0)) {
-//             __m128i state_a = _mm_lddqu_si128((__m128i*)(states_a + i));
-//             __m128i state_b = _mm_lddqu_si128((__m128i*)(states_b + j));
-//             if (ms_order > 0) {
-//                 __m128i sf_base_b = _mm_shuffle_epi8(base_b,
-//                 match_shuffle_dict[ms_order]);
-//                 __m128i sf_state_b = _mm_shuffle_epi8(state_b,
-//                 match_shuffle_dict[ms_order]); cmp_mask =
-//                 _mm_cmpeq_epi32(base_a, sf_base_b); and_state =
-//                 _mm_and_si128(state_a, sf_state_b);
-//                 __m128i state_mask = _mm_cmpeq_epi32(and_state,
-//                 all_zero_si128); cmp_mask = _mm_andnot_si128(state_mask,
-//                 cmp_mask);
-//             } else {
-//                 __m128i cmp_mask0 = _mm_cmpeq_epi32(base_a, base_b);
-//                 __m128i state_c0 = _mm_and_si128(
-//                         _mm_and_si128(state_a, state_b), cmp_mask0);
-//                 __m128i base_sf1 = _mm_shuffle_epi32(base_b, cyclic_shift1);
-//                 __m128i state_sf1 = _mm_shuffle_epi32(state_b,
-//                 cyclic_shift1);
-//                 __m128i cmp_mask1 = _mm_cmpeq_epi32(base_a, base_sf1);
-//                 __m128i state_c1 = _mm_and_si128(
-//                         _mm_and_si128(state_a, state_sf1), cmp_mask1);
-//                 __m128i base_sf2 = _mm_shuffle_epi32(base_b, cyclic_shift2);
-//                 __m128i state_sf2 = _mm_shuffle_epi32(state_b,
-//                 cyclic_shift2);
-//                 __m128i cmp_mask2 = _mm_cmpeq_epi32(base_a, base_sf2);
-//                 __m128i state_c2 = _mm_and_si128(
-//                         _mm_and_si128(state_a, state_sf2), cmp_mask2);
-//                 __m128i base_sf3 = _mm_shuffle_epi32(base_b, cyclic_shift3);
-//                 __m128i state_sf3 = _mm_shuffle_epi32(state_b,
-//                 cyclic_shift3);
-//                 __m128i cmp_mask3 = _mm_cmpeq_epi32(base_a, base_sf3);
-//                 __m128i state_c3 = _mm_and_si128(
-//                         _mm_and_si128(state_a, state_sf3), cmp_mask3);
-//                 and_state = _mm_or_si128(
-//                         _mm_or_si128(state_c0, state_c1),
-//                         _mm_or_si128(state_c2, state_c3)
-//                         );
-//                 __m128i state_mask = _mm_cmpeq_epi32(and_state,
-//                 all_zero_si128); cmp_mask = _mm_andnot_si128(state_mask,
-//                 all_one_si128);
-//             }
-//
-//             int mask = _mm_movemask_ps((__m128)cmp_mask);
-//             __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
-//             __m128i res_s = _mm_shuffle_epi8(and_state, shuffle_mask[mask]);
-//             _mm_storeu_si128((__m128i*)(bases_c + size_c), res_b);
-//             _mm_storeu_si128((__m128i*)(states_c + size_c), res_s);
-//
-//             size_c += _mm_popcnt_u32(mask);
-//         }
-//
-//         int a_max = bases_a[i + 3];
-//         int b_max = bases_b[j + 3];
-//         if (a_max <= b_max) {
-//             i += 4;
-//             base_a = _mm_load_si128((__m128i*)(bases_a + i));
-//             byte_group_a = _mm_shuffle_epi8(base_a,
-//             byte_check_group_a_order[0]); _mm_prefetch((char*) (bases_a + i +
-//             16), _MM_HINT_T0); _mm_prefetch((char*) (states_a + i + 16),
-//             _MM_HINT_T0);
-//         }
-//         if (a_max >= b_max) {
-//             j += 4;
-//             base_b = _mm_load_si128((__m128i*)(bases_b + j));
-//             byte_group_b = _mm_shuffle_epi8(base_b,
-//             byte_check_group_b_order[0]); _mm_prefetch((char*) (bases_b + j +
-//             16), _MM_HINT_T0); _mm_prefetch((char*) (states_b + j + 16),
-//             _MM_HINT_T0);
-//         }
-//     }
-//
-//     while (i < size_a && j < size_b) {
-//         if (bases_a[i] == bases_b[j]) {
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//             i++; j++;
-//         } else if (bases_a[i] < bases_b[j]){
-//             i++;
-//         } else {
-//             j++;
-//         }
-//     }
-//
-//     return size_c;
-// }
-
-int intersect_shuffle_uint_b4(const int *set_a, int size_a, const int *set_b,
-                              int size_b, int *set_c) {
-  int i = 0, j = 0, size_c = 0;
-  int qs_a = size_a - (size_a & 3);
-  int qs_b = size_b - (size_b & 3);
-
-  while (i < qs_a && j < qs_b) {
-    __m128i v_a = _mm_lddqu_si128((__m128i *)(set_a + i));
-    __m128i v_b = _mm_lddqu_si128((__m128i *)(set_b + j));
-
-    int a_max = set_a[i + 3];
-    int b_max = set_b[j + 3];
-    // i += (a_max <= b_max) * 4;
-    // j += (b_max <= a_max) * 4;
-    if (a_max == b_max) {
-      i += 4;
-      j += 4;
-      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
-      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
-    } else if (a_max < b_max) {
-      i += 4;
-      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
-    } else {
-      j += 4;
-      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
-    }
-
-    __m128i cmp_mask0 = _mm_cmpeq_epi32(v_a, v_b);        // pairwise comparison
-    __m128i rot1 = _mm_shuffle_epi32(v_b, cyclic_shift1); // shuffling
-    __m128i cmp_mask1 = _mm_cmpeq_epi32(v_a, rot1);
-    __m128i rot2 = _mm_shuffle_epi32(v_b, cyclic_shift2);
-    __m128i cmp_mask2 = _mm_cmpeq_epi32(v_a, rot2);
-    __m128i rot3 = _mm_shuffle_epi32(v_b, cyclic_shift3);
-    __m128i cmp_mask3 = _mm_cmpeq_epi32(v_a, rot3);
-    __m128i cmp_mask = _mm_or_si128(_mm_or_si128(cmp_mask0, cmp_mask1),
-                                    _mm_or_si128(cmp_mask2, cmp_mask3));
-
-    int mask = _mm_movemask_ps((__m128)cmp_mask);
-    __m128i p = _mm_shuffle_epi8(v_a, shuffle_mask[mask]);
-    _mm_storeu_si128((__m128i *)(set_c + size_c), p);
-
-    size_c += _mm_popcnt_u32(mask);
-  }
+#if defined(__AVX2__)
+// Moves byte k of every 32-bit lane into the low 4 bytes of its 128-bit half,
+// one row per k.
+alignas(32) static const uint8_t byte_check_pack_avx2_pi8[64] = {
+    0, 4, 8, 12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    0, 4, 8, 12, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    1, 5, 9, 13, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    1, 5, 9, 13, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+};
+// Spreads the packed bytes of set_a over two vectors, so that comparing them
+// with the packed bytes of set_b checks all 8 x 8 pairs.
+alignas(32) static const uint8_t byte_check_group_a_avx2_pi8[64] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7,
+};
+// Row r rotates the lanes of a block by r, so 8 rotations of v_b line every
+// element of set_b up with every element of set_a.
+alignas(32) static const uint32_t match_rotate_avx2_epi32[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7,
+    1, 2, 3, 4, 5, 6, 7, 0,
+    2, 3, 4, 5, 6, 7, 0, 1,
+    3, 4, 5, 6, 7, 0, 1, 2,
+    4, 5, 6, 7, 0, 1, 2, 3,
+    5, 6, 7, 0, 1, 2, 3, 4,
+    6, 7, 0, 1, 2, 3, 4, 5,
+    7, 0, 1, 2, 3, 4, 5, 6,
+};
 
-  while (i < size_a && j < size_b) {
-    if (set_a[i] == set_b[j]) {
-      set_c[size_c++] = set_a[i];
-      i++;
-      j++;
-    } else if (set_a[i] < set_b[j]) {
-      i++;
-    } else {
-      j++;
-    }
-  }
+static inline __m256i byte_check_pack_avx2(__m256i v, int k) {
+  __m256i packed = _mm256_shuffle_epi8(
+      v, _mm256_load_si256((__m256i *)byte_check_pack_avx2_pi8 + k));
+  return _mm256_permutevar8x32_epi32(packed,
+                                     _mm256_setr_epi32(0, 4, 0, 4, 0, 4, 0, 4));
+}
 
-  return size_c;
+// Returns whether two blocks of 8 share byte k in any pair of elements.
+static inline bool byte_check_avx2(__m256i v_a, __m256i v_b, int k) {
+  __m256i bytes_a = byte_check_pack_avx2(v_a, k);
+  __m256i bytes_b = byte_check_pack_avx2(v_b, k);
+  __m256i group_a0 = _mm256_shuffle_epi8(
+      bytes_a, _mm256_load_si256((__m256i *)byte_check_group_a_avx2_pi8));
+  __m256i group_a1 = _mm256_shuffle_epi8(
+      bytes_a, _mm256_load_si256((__m256i *)byte_check_group_a_avx2_pi8 + 1));
+  __m256i byte_check_mask =
+      _mm256_or_si256(_mm256_cmpeq_epi8(group_a0, bytes_b),
+                      _mm256_cmpeq_epi8(group_a1, bytes_b));
+  return !_mm256_testz_si256(byte_check_mask, byte_check_mask);
 }
 
-int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
-                              int size_b, int *set_c) {
-  int i = 0, j = 0, size_c = 0;
+template <class Output>
+static void qfilter_uint_b8(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  int i = 0, j = 0;
   int qs_a = size_a - (size_a & 7);
   int qs_b = size_b - (size_b & 7);
 
   while (i < qs_a && j < qs_b) {
-    __m128i v_a0 = _mm_lddqu_si128((__m128i *)(set_a + i));
-    __m128i v_a1 = _mm_lddqu_si128((__m128i *)(set_a + i + 4));
-    __m128i v_b0 = _mm_lddqu_si128((__m128i *)(set_b + j));
-    __m128i v_b1 = _mm_lddqu_si128((__m128i *)(set_b + j + 4));
-
-    int a_max = set_a[i + 7];
-    int b_max = set_b[j + 7];
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
+    const unsigned int *block_a = set_a + i;
+    __m256i v_a = _mm256_lddqu_si256((__m256i *)(set_a + i));
+    __m256i v_b = _mm256_lddqu_si256((__m256i *)(set_b + j));
+
+    unsigned int a_max = set_a[i + 7];
+    unsigned int b_max = set_b[j + 7];
     if (a_max == b_max) {
       i += 8;
       j += 8;
@@ -765,12 +756,472 @@ int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
       _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
     }
 
-    // a0 -- b0:
-    __m128i cmp_mask0 = _mm_cmpeq_epi32(v_a0, v_b0);
-    __m128i rot1 = _mm_shuffle_epi32(v_b0, cyclic_shift1);
-    __m128i cmp_mask1 = _mm_cmpeq_epi32(v_a0, rot1);
-    __m128i rot2 = _mm_shuffle_epi32(v_b0, cyclic_shift2);
-    __m128i cmp_mask2 = _mm_cmpeq_epi32(v_a0, rot2);
+    // Most blocks are ruled out by the lowest byte, the next byte removes most
+    // false positives before the exact 8 x 8 comparison.
+    if (__builtin_expect(!byte_check_avx2(v_a, v_b, 0), 1))
+      continue;
+    if (!byte_check_avx2(v_a, v_b, 1))
+      continue;
+
+    __m256i cmp_mask = _mm256_cmpeq_epi32(v_a, v_b);
+    for (int r = 1; r < 8; ++r) {
+      __m256i rot = _mm256_permutevar8x32_epi32(
+          v_b, _mm256_load_si256((__m256i *)match_rotate_avx2_epi32 + r));
+      cmp_mask = _mm256_or_si256(cmp_mask, _mm256_cmpeq_epi32(v_a, rot));
+    }
+
+    int mask = _mm256_movemask_ps((__m256)cmp_mask);
+    out.block8(block_a, v_a, mask);
+  }
+
+  qfilter_uint_b4(set_a + i, size_a - i, set_b + j, size_b - j, out);
+}
+
+int intersect_qfilter_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return run_uint(qfilter_uint_b8<CountOutput>, qfilter_uint_b8<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// GCC's AVX-512 intrinsics start from self-initialized "undefined" vectors,
+// which trip -Wmaybe-uninitialized once inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// Zmm g spreads the packed bytes of set_a elements 4g..4g+3, one per 128-bit
+// lane, so that comparing them with the packed bytes of set_b checks all
+// 16 x 16 pairs.
+alignas(64) static const uint8_t byte_check_group_a_avx512_pi8[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+};
+// Row r rotates the lanes of a block by r.
+alignas(64) static const uint32_t match_rotate_avx512_epi32[256] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0,
+    2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1,
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2,
+    4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3,
+    5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4,
+    6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5,
+    7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6,
+    8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+    9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8,
+    10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+    11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+    12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+    13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+    14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+    15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+};
+
+// Returns whether two blocks of 16 share byte k in any pair of elements.
+static inline bool byte_check_avx512(__m512i v_a, __m512i v_b, int k) {
+  __m512i bytes_a = _mm512_broadcast_i32x4(
+      _mm512_cvtepi32_epi8(_mm512_srli_epi32(v_a, 8 * k)));
+  __m512i bytes_b = _mm512_broadcast_i32x4(
+      _mm512_cvtepi32_epi8(_mm512_srli_epi32(v_b, 8 * k)));
+  __mmask64 byte_check_mask = 0;
+  for (int g = 0; g < 4; ++g) {
+    __m512i group_a = _mm512_shuffle_epi8(
+        bytes_a, _mm512_load_si512(byte_check_group_a_avx512_pi8 + 64 * g));
+    byte_check_mask |= _mm512_cmpeq_epi8_mask(group_a, bytes_b);
+  }
+  return byte_check_mask != 0;
+}
+
+template <class Output>
+static void qfilter_uint_b16(const unsigned int *set_a, int size_a,
+                             const unsigned int *set_b, int size_b,
+                             Output &out) {
+  int i = 0, j = 0;
+  int qs_a = size_a - (size_a & 15);
+  int qs_b = size_b - (size_b & 15);
+
+  while (i < qs_a && j < qs_b) {
+    if (out.done(std::min(size_a - i, size_b - j)))
+      return;
+    const unsigned int *block_a = set_a + i;
+    __m512i v_a = _mm512_loadu_si512(set_a + i);
+    __m512i v_b = _mm512_loadu_si512(set_b + j);
+
+    unsigned int a_max = set_a[i + 15];
+    unsigned int b_max = set_b[j + 15];
+    if (a_max == b_max) {
+      i += 16;
+      j += 16;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    } else if (a_max < b_max) {
+      i += 16;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+    } else {
+      j += 16;
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    }
+
+    if (__builtin_expect(!byte_check_avx512(v_a, v_b, 0), 1))
+      continue;
+    if (!byte_check_avx512(v_a, v_b, 1))
+      continue;
+
+    __mmask16 mask = _mm512_cmpeq_epi32_mask(v_a, v_b);
+    for (int r = 1; r < 16; ++r) {
+      __m512i rot = _mm512_permutexvar_epi32(
+          _mm512_load_si512(match_rotate_avx512_epi32 + 16 * r), v_b);
+      mask |= _mm512_cmpeq_epi32_mask(v_a, rot);
+    }
+
+    out.block16(block_a, v_a, mask);
+  }
+
+  qfilter_uint_b4(set_a + i, size_a - i, set_b + j, size_b - j, out);
+}
+
+int intersect_qfilter_uint_b16(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only) {
+  return run_uint(qfilter_uint_b16<CountOutput>, qfilter_uint_b16<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+
+#pragma GCC diagnostic pop
+#endif
+
+int intersect_qfilter_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c) {
+  const __m128i all_zero_si128 = _mm_setzero_si128();
+  int i = 0, j = 0, size_c = 0;
+  int qs_a = size_a - (size_a & 3);
+  int qs_b = size_b - (size_b & 3);
+
+  while (i < qs_a && j < qs_b) {
+    __m128i base_a = _mm_lddqu_si128((__m128i *)(bases_a + i));
+    __m128i base_b = _mm_lddqu_si128((__m128i *)(bases_b + j));
+    __m128i state_a = _mm_lddqu_si128((__m128i *)(states_a + i));
+    __m128i state_b = _mm_lddqu_si128((__m128i *)(states_b + j));
+
+    PackBase a_max = bases_a[i + 3];
+    PackBase b_max = bases_b[j + 3];
+    if (a_max == b_max) {
+      i += 4;
+      j += 4;
+      _mm_prefetch((char *)(bases_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(bases_b + j), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_b + j), _MM_HINT_NTA);
+    } else if (a_max < b_max) {
+      i += 4;
+      _mm_prefetch((char *)(bases_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_a + i), _MM_HINT_NTA);
+    } else {
+      j += 4;
+      _mm_prefetch((char *)(bases_b + j), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_b + j), _MM_HINT_NTA);
+    }
+
+    __m128i byte_group_a =
+        _mm_shuffle_epi8(base_a, byte_check_group_a_order[0]);
+    __m128i byte_group_b =
+        _mm_shuffle_epi8(base_b, byte_check_group_b_order[0]);
+    __m128i byte_check_mask = _mm_cmpeq_epi8(byte_group_a, byte_group_b);
+    int bc_mask = _mm_movemask_epi8(byte_check_mask);
+    int ms_order = byte_check_mask_dict[bc_mask];
+    if (__builtin_expect(ms_order == -1, 0)) {
+      byte_group_a = _mm_shuffle_epi8(base_a, byte_check_group_a_order[1]);
+      byte_group_b = _mm_shuffle_epi8(base_b, byte_check_group_b_order[1]);
+      byte_check_mask = _mm_and_si128(
+          byte_check_mask, _mm_cmpeq_epi8(byte_group_a, byte_group_b));
+      bc_mask = _mm_movemask_epi8(byte_check_mask);
+      ms_order = byte_check_mask_dict[bc_mask];
+
+      if (__builtin_expect(ms_order == -1, 0)) {
+        byte_group_a = _mm_shuffle_epi8(base_a, byte_check_group_a_order[2]);
+        byte_group_b = _mm_shuffle_epi8(base_b, byte_check_group_b_order[2]);
+        byte_check_mask = _mm_and_si128(
+            byte_check_mask, _mm_cmpeq_epi8(byte_group_a, byte_group_b));
+        bc_mask = _mm_movemask_epi8(byte_check_mask);
+        ms_order = byte_check_mask_dict[bc_mask];
+
+        if (__builtin_expect(ms_order == -1, 0)) {
+          byte_group_a =
+              _mm_shuffle_epi8(base_a, byte_check_group_a_order[3]);
+          byte_group_b =
+              _mm_shuffle_epi8(base_b, byte_check_group_b_order[3]);
+          byte_check_mask = _mm_and_si128(
+              byte_check_mask, _mm_cmpeq_epi8(byte_group_a, byte_group_b));
+          bc_mask = _mm_movemask_epi8(byte_check_mask);
+          ms_order = byte_check_mask_dict[bc_mask];
+        }
+      }
+    }
+    if (ms_order == -2)
+      continue; // "no match" in this two block.
+
+    __m128i sf_base_b = _mm_shuffle_epi8(base_b, match_shuffle_dict[ms_order]);
+    __m128i sf_state_b =
+        _mm_shuffle_epi8(state_b, match_shuffle_dict[ms_order]);
+    __m128i cmp_mask = _mm_cmpeq_epi32(base_a, sf_base_b);
+    __m128i and_state = _mm_and_si128(state_a, sf_state_b);
+    __m128i state_mask = _mm_cmpeq_epi32(and_state, all_zero_si128);
+    cmp_mask = _mm_andnot_si128(state_mask, cmp_mask);
+
+    int mask = _mm_movemask_ps((__m128)cmp_mask);
+    __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
+    __m128i res_s = _mm_shuffle_epi8(and_state, shuffle_mask[mask]);
+    _mm_storeu_si128((__m128i *)(bases_c + size_c), res_b);
+    _mm_storeu_si128((__m128i *)(states_c + size_c), res_s);
+
+    size_c += _mm_popcnt_u32(mask);
+  }
+
+  while (i < size_a && j < size_b) {
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+      i++;
+      j++;
+    } else if (bases_a[i] < bases_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return size_c;
+}
+
+int intersect_qfilter_bsr_b4_v2(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c) {
+  const __m128i all_zero_si128 = _mm_setzero_si128();
+  const __m128i all_one_si128 = _mm_set1_epi32(-1);
+  int i = 0, j = 0, size_c = 0;
+  int qs_a = size_a - (size_a & 3);
+  int qs_b = size_b - (size_b & 3);
+
+  __m128i base_a = all_zero_si128, base_b = all_zero_si128;
+  __m128i byte_group_a = all_zero_si128, byte_group_b = all_zero_si128;
+  if (qs_a > 0 && qs_b > 0) {
+    base_a = _mm_lddqu_si128((__m128i *)bases_a);
+    base_b = _mm_lddqu_si128((__m128i *)bases_b);
+    byte_group_a = _mm_shuffle_epi8(base_a, byte_check_group_a_order[0]);
+    byte_group_b = _mm_shuffle_epi8(base_b, byte_check_group_b_order[0]);
+  }
+  __m128i cmp_mask, and_state;
+
+  while (i < qs_a && j < qs_b) {
+    __m128i byte_check_mask = _mm_cmpeq_epi8(byte_group_a, byte_group_b);
+    int bc_mask = _mm_movemask_epi8(byte_check_mask);
+    int ms_order = byte_check_mask_dict[bc_mask];
+
+    if (__builtin_expect(ms_order != -2, 0)) {
+      __m128i state_a = _mm_lddqu_si128((__m128i *)(states_a + i));
+      __m128i state_b = _mm_lddqu_si128((__m128i *)(states_b + j));
+      if (ms_order >= 0) {
+        __m128i sf_base_b =
+            _mm_shuffle_epi8(base_b, match_shuffle_dict[ms_order]);
+        __m128i sf_state_b =
+            _mm_shuffle_epi8(state_b, match_shuffle_dict[ms_order]);
+        cmp_mask = _mm_cmpeq_epi32(base_a, sf_base_b);
+        and_state = _mm_and_si128(state_a, sf_state_b);
+        __m128i state_mask = _mm_cmpeq_epi32(and_state, all_zero_si128);
+        cmp_mask = _mm_andnot_si128(state_mask, cmp_mask);
+      } else {
+        __m128i cmp_mask0 = _mm_cmpeq_epi32(base_a, base_b);
+        __m128i state_c0 =
+            _mm_and_si128(_mm_and_si128(state_a, state_b), cmp_mask0);
+        __m128i base_sf1 = _mm_shuffle_epi32(base_b, cyclic_shift1);
+        __m128i state_sf1 = _mm_shuffle_epi32(state_b, cyclic_shift1);
+        __m128i cmp_mask1 = _mm_cmpeq_epi32(base_a, base_sf1);
+        __m128i state_c1 =
+            _mm_and_si128(_mm_and_si128(state_a, state_sf1), cmp_mask1);
+        __m128i base_sf2 = _mm_shuffle_epi32(base_b, cyclic_shift2);
+        __m128i state_sf2 = _mm_shuffle_epi32(state_b, cyclic_shift2);
+        __m128i cmp_mask2 = _mm_cmpeq_epi32(base_a, base_sf2);
+        __m128i state_c2 =
+            _mm_and_si128(_mm_and_si128(state_a, state_sf2), cmp_mask2);
+        __m128i base_sf3 = _mm_shuffle_epi32(base_b, cyclic_shift3);
+        __m128i state_sf3 = _mm_shuffle_epi32(state_b, cyclic_shift3);
+        __m128i cmp_mask3 = _mm_cmpeq_epi32(base_a, base_sf3);
+        __m128i state_c3 =
+            _mm_and_si128(_mm_and_si128(state_a, state_sf3), cmp_mask3);
+        and_state = _mm_or_si128(_mm_or_si128(state_c0, state_c1),
+                                 _mm_or_si128(state_c2, state_c3));
+        __m128i state_mask = _mm_cmpeq_epi32(and_state, all_zero_si128);
+        cmp_mask = _mm_andnot_si128(state_mask, all_one_si128);
+      }
+
+      int mask = _mm_movemask_ps((__m128)cmp_mask);
+      __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
+      __m128i res_s = _mm_shuffle_epi8(and_state, shuffle_mask[mask]);
+      _mm_storeu_si128((__m128i *)(bases_c + size_c), res_b);
+      _mm_storeu_si128((__m128i *)(states_c + size_c), res_s);
+
+      size_c += _mm_popcnt_u32(mask);
+    }
+
+    PackBase a_max = bases_a[i + 3];
+    PackBase b_max = bases_b[j + 3];
+    if (a_max <= b_max) {
+      i += 4;
+      if (i < qs_a) {
+        base_a = _mm_lddqu_si128((__m128i *)(bases_a + i));
+        byte_group_a = _mm_shuffle_epi8(base_a, byte_check_group_a_order[0]);
+      }
+      _mm_prefetch((char *)(bases_a + i + 16), _MM_HINT_T0);
+      _mm_prefetch((char *)(states_a + i + 16), _MM_HINT_T0);
+    }
+    if (a_max >= b_max) {
+      j += 4;
+      if (j < qs_b) {
+        base_b = _mm_lddqu_si128((__m128i *)(bases_b + j));
+        byte_group_b = _mm_shuffle_epi8(base_b, byte_check_group_b_order[0]);
+      }
+      _mm_prefetch((char *)(bases_b + j + 16), _MM_HINT_T0);
+      _mm_prefetch((char *)(states_b + j + 16), _MM_HINT_T0);
+    }
+  }
+
+  while (i < size_a && j < size_b) {
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+      i++;
+      j++;
+    } else if (bases_a[i] < bases_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return size_c;
+}
+
+template <class Output>
+static void shuffle_uint_b4(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  int i = 0, j = 0;
+  int qs_a = size_a - (size_a & 3);
+  int qs_b = size_b - (size_b & 3);
+
+  while (i < qs_a && j < qs_b) {
+    const unsigned int *block_a = set_a + i;
+    __m128i v_a = _mm_lddqu_si128((__m128i *)(set_a + i));
+    __m128i v_b = _mm_lddqu_si128((__m128i *)(set_b + j));
+
+    unsigned int a_max = set_a[i + 3];
+    unsigned int b_max = set_b[j + 3];
+    // i += (a_max <= b_max) * 4;
+    // j += (b_max <= a_max) * 4;
+    if (a_max == b_max) {
+      i += 4;
+      j += 4;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    } else if (a_max < b_max) {
+      i += 4;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+    } else {
+      j += 4;
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    }
+
+    __m128i cmp_mask0 = _mm_cmpeq_epi32(v_a, v_b);        // pairwise comparison
+    __m128i rot1 = _mm_shuffle_epi32(v_b, cyclic_shift1); // shuffling
+    __m128i cmp_mask1 = _mm_cmpeq_epi32(v_a, rot1);
+    __m128i rot2 = _mm_shuffle_epi32(v_b, cyclic_shift2);
+    __m128i cmp_mask2 = _mm_cmpeq_epi32(v_a, rot2);
+    __m128i rot3 = _mm_shuffle_epi32(v_b, cyclic_shift3);
+    __m128i cmp_mask3 = _mm_cmpeq_epi32(v_a, rot3);
+    __m128i cmp_mask = _mm_or_si128(_mm_or_si128(cmp_mask0, cmp_mask1),
+                                    _mm_or_si128(cmp_mask2, cmp_mask3));
+
+    int mask = _mm_movemask_ps((__m128)cmp_mask);
+    out.block4(block_a, v_a, mask);
+  }
+
+  while (i < size_a && j < size_b) {
+    if (set_a[i] == set_b[j]) {
+      out.scalar(set_a + i);
+      i++;
+      j++;
+    } else if (set_a[i] < set_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+}
+
+int intersect_shuffle_uint_b4(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return run_uint(shuffle_uint_b4<CountOutput>, shuffle_uint_b4<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+
+template <class Output>
+static void shuffle_uint_b8(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  int i = 0, j = 0;
+  int qs_a = size_a - (size_a & 7);
+  int qs_b = size_b - (size_b & 7);
+
+  while (i < qs_a && j < qs_b) {
+    const unsigned int *block_a = set_a + i;
+    __m128i v_a0 = _mm_lddqu_si128((__m128i *)(set_a + i));
+    __m128i v_a1 = _mm_lddqu_si128((__m128i *)(set_a + i + 4));
+    __m128i v_b0 = _mm_lddqu_si128((__m128i *)(set_b + j));
+    __m128i v_b1 = _mm_lddqu_si128((__m128i *)(set_b + j + 4));
+
+    unsigned int a_max = set_a[i + 7];
+    unsigned int b_max = set_b[j + 7];
+    if (a_max == b_max) {
+      i += 8;
+      j += 8;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    } else if (a_max < b_max) {
+      i += 8;
+      _mm_prefetch((char *)(set_a + i), _MM_HINT_NTA);
+    } else {
+      j += 8;
+      _mm_prefetch((char *)(set_b + j), _MM_HINT_NTA);
+    }
+
+    // a0 -- b0:
+    __m128i cmp_mask0 = _mm_cmpeq_epi32(v_a0, v_b0);
+    __m128i rot1 = _mm_shuffle_epi32(v_b0, cyclic_shift1);
+    __m128i cmp_mask1 = _mm_cmpeq_epi32(v_a0, rot1);
+    __m128i rot2 = _mm_shuffle_epi32(v_b0, cyclic_shift2);
+    __m128i cmp_mask2 = _mm_cmpeq_epi32(v_a0, rot2);
     __m128i rot3 = _mm_shuffle_epi32(v_b0, cyclic_shift3);
     __m128i cmp_mask3 = _mm_cmpeq_epi32(v_a0, rot3);
 
@@ -790,9 +1241,7 @@ int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
                                   _mm_or_si128(cmp_mask6, cmp_mask7)));
 
     int maskx = _mm_movemask_ps((__m128)cmp_maskx);
-    __m128i px = _mm_shuffle_epi8(v_a0, shuffle_mask[maskx]);
-    _mm_storeu_si128((__m128i *)(set_c + size_c), px);
-    size_c += _mm_popcnt_u32(maskx);
+    out.block4(block_a, v_a0, maskx);
 
     // a1 -- b0:
     cmp_mask0 = _mm_cmpeq_epi32(v_a1, v_b0);
@@ -819,14 +1268,12 @@ int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
                                   _mm_or_si128(cmp_mask6, cmp_mask7)));
 
     int masky = _mm_movemask_ps((__m128)cmp_masky);
-    __m128i py = _mm_shuffle_epi8(v_a1, shuffle_mask[masky]);
-    _mm_storeu_si128((__m128i *)(set_c + size_c), py);
-    size_c += _mm_popcnt_u32(masky);
+    out.block4(block_a + 4, v_a1, masky);
   }
 
   while (i < size_a && j < size_b) {
     if (set_a[i] == set_b[j]) {
-      set_c[size_c++] = set_a[i];
+      out.scalar(set_a + i);
       i++;
       j++;
     } else if (set_a[i] < set_b[j]) {
@@ -835,22 +1282,31 @@ int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
       j++;
     }
   }
+}
 
-  return size_c;
+int intersect_shuffle_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  return run_uint(shuffle_uint_b8<CountOutput>, shuffle_uint_b8<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
 }
 
-int intersect_shuffle_uint_vec256(const int *set_a, int size_a,
-                                  const int *set_b, int size_b, int *set_c) {
-  int i = 0, j = 0, size_c = 0;
+#if defined(__AVX2__)
+template <class Output>
+static void shuffle_uint_vec256(const unsigned int *set_a, int size_a,
+                                const unsigned int *set_b, int size_b,
+                                Output &out) {
+  int i = 0, j = 0;
   int qs_a = size_a - (size_a & 7);
   int qs_b = size_b - (size_b & 7);
 
   while (i < qs_a && j < qs_b) {
-    __m256i v_a = _mm256_load_si256((__m256i *)(set_a + i));
-    __m256i v_b = _mm256_load_si256((__m256i *)(set_b + j));
+    const unsigned int *block_a = set_a + i;
+    __m256i v_a = _mm256_loadu_si256((__m256i *)(set_a + i));
+    __m256i v_b = _mm256_loadu_si256((__m256i *)(set_b + j));
 
-    int a_max = set_a[i + 7];
-    int b_max = set_b[j + 7];
+    unsigned int a_max = set_a[i + 7];
+    unsigned int b_max = set_b[j + 7];
     if (a_max == b_max) {
       i += 8;
       j += 8;
@@ -888,18 +1344,12 @@ int intersect_shuffle_uint_vec256(const int *set_a, int size_a,
                         _mm256_or_si256(_mm256_or_si256(cmp_mask5, cmp_mask6),
                                         _mm256_or_si256(cmp_mask7, cmp_mask8)));
     int mask = _mm256_movemask_ps((__m256)cmp_mask);
-
-    __m256i idx =
-        _mm256_load_si256((const __m256i *)&shuffle_mask_avx[mask * 8]);
-    __m256i p = _mm256_permutevar8x32_epi32(v_a, idx);
-    _mm256_storeu_si256((__m256i *)(set_c + size_c), p);
-
-    size_c += _mm_popcnt_u32(mask);
+    out.block8(block_a, v_a, mask);
   }
 
   while (i < size_a && j < size_b) {
     if (set_a[i] == set_b[j]) {
-      set_c[size_c++] = set_a[i];
+      out.scalar(set_a + i);
       i++;
       j++;
     } else if (set_a[i] < set_b[j]) {
@@ -908,101 +1358,1219 @@ int intersect_shuffle_uint_vec256(const int *set_a, int size_a,
       j++;
     }
   }
+}
+
+int intersect_shuffle_uint_vec256(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only) {
+  return run_uint(shuffle_uint_vec256<CountOutput>, shuffle_uint_vec256<ArrayOutput>, set_a, size_a,
+                  set_b, size_b, set_c, count_only);
+}
+#endif
+
+int intersect_shuffle_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c) {
+  const __m128i all_zero_si128 = _mm_setzero_si128();
+  int i = 0, j = 0, size_c = 0;
+  int qs_a = size_a - (size_a & 3);
+  int qs_b = size_b - (size_b & 3);
+
+  while (i < qs_a && j < qs_b) {
+    __m128i base_a = _mm_lddqu_si128((__m128i *)(bases_a + i));
+    __m128i base_b = _mm_lddqu_si128((__m128i *)(bases_b + j));
+    __m128i state_a = _mm_lddqu_si128((__m128i *)(states_a + i));
+    __m128i state_b = _mm_lddqu_si128((__m128i *)(states_b + j));
+
+    PackBase a_max = bases_a[i + 3];
+    PackBase b_max = bases_b[j + 3];
+    if (a_max == b_max) {
+      i += 4;
+      j += 4;
+      _mm_prefetch((char *)(bases_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(bases_b + j), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_b + j), _MM_HINT_NTA);
+    } else if (a_max < b_max) {
+      i += 4;
+      _mm_prefetch((char *)(bases_a + i), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_a + i), _MM_HINT_NTA);
+    } else {
+      j += 4;
+      _mm_prefetch((char *)(bases_b + j), _MM_HINT_NTA);
+      _mm_prefetch((char *)(states_b + j), _MM_HINT_NTA);
+    }
+
+    // shift0:
+    __m128i cmp_mask0 = _mm_cmpeq_epi32(base_a, base_b);
+    __m128i state_c0 =
+        _mm_and_si128(_mm_and_si128(state_a, state_b), cmp_mask0);
+
+    // shift1:
+    __m128i base_sf1 = _mm_shuffle_epi32(base_b, cyclic_shift1);
+    __m128i state_sf1 = _mm_shuffle_epi32(state_b, cyclic_shift1);
+    __m128i cmp_mask1 = _mm_cmpeq_epi32(base_a, base_sf1);
+    __m128i state_c1 =
+        _mm_and_si128(_mm_and_si128(state_a, state_sf1), cmp_mask1);
+
+    // shift2:
+    __m128i base_sf2 = _mm_shuffle_epi32(base_b, cyclic_shift2);
+    __m128i state_sf2 = _mm_shuffle_epi32(state_b, cyclic_shift2);
+    __m128i cmp_mask2 = _mm_cmpeq_epi32(base_a, base_sf2);
+    __m128i state_c2 =
+        _mm_and_si128(_mm_and_si128(state_a, state_sf2), cmp_mask2);
+
+    // shift3:
+    __m128i base_sf3 = _mm_shuffle_epi32(base_b, cyclic_shift3);
+    __m128i state_sf3 = _mm_shuffle_epi32(state_b, cyclic_shift3);
+    __m128i cmp_mask3 = _mm_cmpeq_epi32(base_a, base_sf3);
+    __m128i state_c3 =
+        _mm_and_si128(_mm_and_si128(state_a, state_sf3), cmp_mask3);
+
+    __m128i state_all = _mm_or_si128(_mm_or_si128(state_c0, state_c1),
+                                     _mm_or_si128(state_c2, state_c3));
+    __m128i cmp_mask = _mm_or_si128(_mm_or_si128(cmp_mask0, cmp_mask1),
+                                    _mm_or_si128(cmp_mask2, cmp_mask3));
+    __m128i state_mask = _mm_cmpeq_epi32(state_all, all_zero_si128);
+    int mask = (_mm_movemask_ps((__m128)cmp_mask) &
+                ~(_mm_movemask_ps((__m128)state_mask)));
+
+    __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
+    __m128i res_s = _mm_shuffle_epi8(state_all, shuffle_mask[mask]);
+    _mm_storeu_si128((__m128i *)(bases_c + size_c), res_b);
+    _mm_storeu_si128((__m128i *)(states_c + size_c), res_s);
+
+    size_c += _mm_popcnt_u32(mask);
+  }
+
+  while (i < size_a && j < size_b) {
+    if (bases_a[i] == bases_b[j]) {
+      states_c[size_c] = states_a[i] & states_b[j];
+      if (states_c[size_c] != 0)
+        bases_c[size_c++] = bases_a[i];
+      i++;
+      j++;
+    } else if (bases_a[i] < bases_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+
+  return size_c;
+}
+#endif // __SSE4_2__
+
+// 64-bit and 16-bit elements. These kernels only count or write, so their
+// policies take a block as the mask of its matching lanes and write the
+// matches one by one, which needs no slack past the count.
+template <class T> struct CountOutputOf {
+  int size;
+
+  CountOutputOf() : size(0) {}
+
+  void scalar(const T *) { size++; }
+  void block(const T *, unsigned int mask) { size += __builtin_popcount(mask); }
+};
+
+template <class T> struct ArrayOutputOf {
+  T *set_c;
+  int size;
+
+  explicit ArrayOutputOf(T *set_c) : set_c(set_c), size(0) {}
+
+  void scalar(const T *match) { set_c[size++] = *match; }
+  void block(const T *block, unsigned int mask) {
+    for (; mask != 0; mask &= mask - 1)
+      set_c[size++] = block[__builtin_ctz(mask)];
+  }
+};
+
+template <class T>
+static inline int
+run_typed(void (*count_impl)(const T *, int, const T *, int,
+                             CountOutputOf<T> &),
+          void (*array_impl)(const T *, int, const T *, int,
+                             ArrayOutputOf<T> &),
+          const T *set_a, int size_a, const T *set_b, int size_b, T *set_c,
+          bool count_only) {
+  if (count_only) {
+    CountOutputOf<T> out;
+    count_impl(set_a, size_a, set_b, size_b, out);
+    return out.size;
+  }
+
+  ArrayOutputOf<T> out(set_c);
+  array_impl(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+template <class T, class Output>
+static void scalarmerge_typed(const T *set_a, int size_a, const T *set_b,
+                              int size_b, Output &out) {
+  int i = 0, j = 0;
+  while (i < size_a && j < size_b) {
+    if (set_a[i] == set_b[j]) {
+      out.scalar(set_a + i);
+      i++;
+      j++;
+    } else if (set_a[i] < set_b[j]) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+}
+
+
+// All-pairs compares of a block of set_a with a block of set_b, `mask` returns
+// the lanes of block_a found in block_b. Without SIMD the blocks are single
+// elements, which makes the block walk below a plain merge.
+template <class T> struct ScalarMatch {
+  typedef T type;
+  enum { width = 1 };
+  static unsigned int mask(const T *block_a, const T *block_b) {
+    return block_a[0] == block_b[0];
+  }
+};
+
+#if !defined(__SSE4_2__)
+typedef ScalarMatch<uint64_t> ShuffleU64;
+typedef ScalarMatch<uint64_t> QFilterU64;
+typedef ScalarMatch<uint16_t> ShuffleU16;
+typedef ScalarMatch<uint16_t> QFilterU16;
+#else
+// Whether the 128-bit block at `block` holds `key`.
+static inline bool block_holds(const uint64_t *block, uint64_t key) {
+  __m128i v = _mm_lddqu_si128((const __m128i *)block);
+  return _mm_movemask_epi8(_mm_cmpeq_epi64(v, _mm_set1_epi64x(key))) != 0;
+}
+
+static inline bool block_holds(const uint16_t *block, uint16_t key) {
+  __m128i v = _mm_lddqu_si128((const __m128i *)block);
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_set1_epi16(key))) != 0;
+}
+
+#if defined(__AVX2__)
+// The lanes of v_a found anywhere in v_b, for 4 x 64-bit lanes.
+static inline unsigned int all_pairs(__m256i v_a, __m256i v_b) {
+  __m256i sf1 = _mm256_permute4x64_epi64(v_b, cyclic_shift1);
+  __m256i sf2 = _mm256_permute4x64_epi64(v_b, cyclic_shift2);
+  __m256i sf3 = _mm256_permute4x64_epi64(v_b, cyclic_shift3);
+  __m256i cmp = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi64(v_a, v_b),
+                      _mm256_cmpeq_epi64(v_a, sf1)),
+      _mm256_or_si256(_mm256_cmpeq_epi64(v_a, sf2),
+                      _mm256_cmpeq_epi64(v_a, sf3)));
+  return _mm256_movemask_pd(_mm256_castsi256_pd(cmp));
+}
+#endif
+
+#if defined(__AVX512F__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+// 8 x 8, rotating v_b one lane at a time.
+struct ShuffleU64 {
+  typedef uint64_t type;
+  enum { width = 8 };
+  static unsigned int mask(const uint64_t *block_a, const uint64_t *block_b) {
+    __m512i v_a = _mm512_loadu_si512((const void *)block_a);
+    __m512i v_b = _mm512_loadu_si512((const void *)block_b);
+    __mmask8 m = _mm512_cmpeq_epi64_mask(v_a, v_b);
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 1));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 2));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 3));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 4));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 5));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 6));
+    m |= _mm512_cmpeq_epi64_mask(v_a, _mm512_alignr_epi64(v_b, v_b, 7));
+    return m;
+  }
+};
+#pragma GCC diagnostic pop
+#elif defined(__AVX2__)
+// 4 x 4, with the same rotations as the 32-bit shuffle.
+struct ShuffleU64 {
+  typedef uint64_t type;
+  enum { width = 4 };
+  static unsigned int mask(const uint64_t *block_a, const uint64_t *block_b) {
+    __m256i v_a = _mm256_loadu_si256((const __m256i *)block_a);
+    __m256i v_b = _mm256_loadu_si256((const __m256i *)block_b);
+    return all_pairs(v_a, v_b);
+  }
+};
+#else
+// 2 x 2, swapping the halves of v_b.
+struct ShuffleU64 {
+  typedef uint64_t type;
+  enum { width = 2 };
+  static unsigned int mask(const uint64_t *block_a, const uint64_t *block_b) {
+    __m128i v_a = _mm_lddqu_si128((const __m128i *)block_a);
+    __m128i v_b = _mm_lddqu_si128((const __m128i *)block_b);
+    __m128i cmp = _mm_or_si128(
+        _mm_cmpeq_epi64(v_a, v_b),
+        _mm_cmpeq_epi64(v_a, _mm_shuffle_epi32(v_b, cyclic_shift3)));
+    return _mm_movemask_pd(_mm_castsi128_pd(cmp));
+  }
+};
+#endif
+
+#if defined(__AVX2__)
+// Gathers the low byte of every lane of a 4 x 64-bit block into 16 bytes, in
+// the order of `group`: set_a's bytes repeated 4 times each, set_b's bytes
+// cycling, so one byte compare checks all 16 pairs.
+static const uint8_t u64_byte_group_a[32] = {
+    0,   0,   0,   0,   8,   8,   8,   8,   128, 128, 128,
+    128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+    128, 128, 0,   0,   0,   0,   8,   8,   8,   8,
+};
+static const uint8_t u64_byte_group_b[32] = {
+    0,   8,   128, 128, 0,   8, 128, 128, 0,   8,   128, 128, 0,   8, 128, 128,
+    128, 128, 0,   8,   128, 128, 0, 8,   128, 128, 0,   8,   128, 128, 0, 8,
+};
+
+static inline __m128i u64_byte_group(__m256i v, const uint8_t *group) {
+  __m256i g =
+      _mm256_shuffle_epi8(v, _mm256_loadu_si256((const __m256i *)group));
+  return _mm_or_si128(_mm256_castsi256_si128(g),
+                      _mm256_extracti128_si256(g, 1));
+}
+
+// 4 x 4, only running the full compare when some pair shares its low byte.
+struct QFilterU64 {
+  typedef uint64_t type;
+  enum { width = 4 };
+  static unsigned int mask(const uint64_t *block_a, const uint64_t *block_b) {
+    __m256i v_a = _mm256_loadu_si256((const __m256i *)block_a);
+    __m256i v_b = _mm256_loadu_si256((const __m256i *)block_b);
+    __m128i byte_check =
+        _mm_cmpeq_epi8(u64_byte_group(v_a, u64_byte_group_a),
+                       u64_byte_group(v_b, u64_byte_group_b));
+    if (_mm_movemask_epi8(byte_check) == 0)
+      return 0;
+
+    return all_pairs(v_a, v_b);
+  }
+};
+#else
+typedef ShuffleU64 QFilterU64;
+#endif
+
+// 8 x 8, rotating v_b one 16-bit lane at a time.
+struct ShuffleU16 {
+  typedef uint16_t type;
+  enum { width = 8 };
+  static unsigned int mask(const uint16_t *block_a, const uint16_t *block_b) {
+    __m128i v_a = _mm_lddqu_si128((const __m128i *)block_a);
+    __m128i v_b = _mm_lddqu_si128((const __m128i *)block_b);
+    __m128i cmp = _mm_cmpeq_epi16(v_a, v_b);
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 2)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 4)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 6)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 8)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 10)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 12)));
+    cmp = _mm_or_si128(cmp,
+                       _mm_cmpeq_epi16(v_a, _mm_alignr_epi8(v_b, v_b, 14)));
+    return _mm_movemask_epi8(_mm_packs_epi16(cmp, _mm_setzero_si128()));
+  }
+};
+
+// 8 x 8 in one STTNI instruction, which already costs less than a byte
+// filter would.
+struct QFilterU16 {
+  typedef uint16_t type;
+  enum { width = 8 };
+  static unsigned int mask(const uint16_t *block_a, const uint16_t *block_b) {
+    __m128i v_a = _mm_lddqu_si128((const __m128i *)block_a);
+    __m128i v_b = _mm_lddqu_si128((const __m128i *)block_b);
+    __m128i hits = _mm_cmpestrm(v_b, 8, v_a, 8,
+                                _SIDD_UWORD_OPS | _SIDD_CMP_EQUAL_ANY |
+                                    _SIDD_BIT_MASK);
+    return _mm_cvtsi128_si32(hits) & 0xff;
+  }
+};
+#endif
+
+// Walks both sets in blocks of Match::width, advancing the block with the
+// smaller last element, then merges the tails.
+template <class Match, class Output>
+static void blocks_typed(const typename Match::type *set_a, int size_a,
+                         const typename Match::type *set_b, int size_b,
+                         Output &out) {
+  const int w = Match::width;
+  int i = 0, j = 0;
+  int qs_a = size_a - (size_a % w);
+  int qs_b = size_b - (size_b % w);
+  while (i < qs_a && j < qs_b) {
+    out.block(set_a + i, Match::mask(set_a + i, set_b + j));
+
+    typename Match::type a_max = set_a[i + w - 1];
+    typename Match::type b_max = set_b[j + w - 1];
+    if (a_max <= b_max)
+      i += w;
+    if (b_max <= a_max)
+      j += w;
+  }
+
+  scalarmerge_typed(set_a + i, size_a - i, set_b + j, size_b - j, out);
+}
+
+template <class T, class Output>
+static void galloping_typed(const T *set_a, int size_a, const T *set_b,
+                            int size_b, Output &out) {
+#if defined(__SSE4_2__)
+  // blocks of one 128-bit vector:
+  const int w = 16 / sizeof(T);
+  int i = 0, j = 0;
+  int qs_b = size_b - (size_b % w);
+  for (; i < size_a && j < qs_b; ++i) {
+    // double-jump over the last elements of the blocks:
+    int r = 1;
+    while (j + r * w < qs_b && set_a[i] > set_b[j + r * w + w - 1])
+      r <<= 1;
+    // binary search:
+    int upper = (j + r * w < qs_b) ? r : (qs_b - j - w) / w;
+    if (set_b[j + upper * w + w - 1] < set_a[i])
+      break;
+    int lower = r >> 1;
+    while (lower < upper) {
+      int mid = (lower + upper) >> 1;
+      if (set_b[j + mid * w + w - 1] >= set_a[i])
+        upper = mid;
+      else
+        lower = mid + 1;
+    }
+    j += lower * w;
+
+    if (block_holds(set_b + j, set_a[i]))
+      out.scalar(set_a + i);
+  }
+
+  scalarmerge_typed(set_a + i, size_a - i, set_b + j, size_b - j, out);
+#else
+  int j = 0;
+  for (int i = 0; i < size_a && j < size_b; ++i) {
+    // double-jump:
+    int r = 1;
+    while (j + r < size_b && set_a[i] > set_b[j + r])
+      r <<= 1;
+    // binary search:
+    int right = (j + r < size_b) ? (j + r) : (size_b - 1);
+    if (set_b[right] < set_a[i])
+      break;
+    int left = j + (r >> 1);
+    while (left < right) {
+      int mid = (left + right) >> 1;
+      if (set_b[mid] >= set_a[i])
+        right = mid;
+      else
+        left = mid + 1;
+    }
+    j = left;
+
+    if (set_a[i] == set_b[j])
+      out.scalar(set_a + i);
+  }
+#endif
+}
+
+int intersect_galloping_u64(const uint64_t *set_a, int size_a,
+                            const uint64_t *set_b, int size_b,
+                            uint64_t *set_c, bool count_only) {
+  return run_typed(galloping_typed<uint64_t, CountOutputOf<uint64_t> >,
+                   galloping_typed<uint64_t, ArrayOutputOf<uint64_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_qfilter_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only) {
+  return run_typed(blocks_typed<QFilterU64, CountOutputOf<uint64_t> >,
+                   blocks_typed<QFilterU64, ArrayOutputOf<uint64_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_shuffle_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only) {
+  return run_typed(blocks_typed<ShuffleU64, CountOutputOf<uint64_t> >,
+                   blocks_typed<ShuffleU64, ArrayOutputOf<uint64_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_galloping_u16(const uint16_t *set_a, int size_a,
+                            const uint16_t *set_b, int size_b,
+                            uint16_t *set_c, bool count_only) {
+  return run_typed(galloping_typed<uint16_t, CountOutputOf<uint16_t> >,
+                   galloping_typed<uint16_t, ArrayOutputOf<uint16_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_qfilter_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only) {
+  return run_typed(blocks_typed<QFilterU16, CountOutputOf<uint16_t> >,
+                   blocks_typed<QFilterU16, ArrayOutputOf<uint16_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+int intersect_shuffle_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only) {
+  return run_typed(blocks_typed<ShuffleU16, CountOutputOf<uint16_t> >,
+                   blocks_typed<ShuffleU16, ArrayOutputOf<uint16_t> >,
+                   set_a, size_a, set_b, size_b, set_c, count_only);
+}
+
+// The partitioned layout: each partition is its high half, its length minus
+// one and its low halves. Matching partitions go through the 16-bit QFilter,
+// with the matches widened back to 32 bits.
+struct PartitionCount : CountOutputOf<uint16_t> {
+  unsigned int high;
+};
+
+struct PartitionArray {
+  unsigned int *set_c;
+  unsigned int high;
+  int size;
+
+  explicit PartitionArray(unsigned int *set_c)
+      : set_c(set_c), high(0), size(0) {}
+
+  void scalar(const uint16_t *match) { set_c[size++] = high | *match; }
+  void block(const uint16_t *block, unsigned int mask) {
+    for (; mask != 0; mask &= mask - 1)
+      set_c[size++] = high | block[__builtin_ctz(mask)];
+  }
+};
+
+template <class Output>
+static void partitioned_u16(const uint16_t *part_a, int size_a,
+                            const uint16_t *part_b, int size_b, Output &out) {
+  int i = 0, j = 0;
+  while (i < size_a && j < size_b) {
+    int len_a = part_a[i + 1] + 1, len_b = part_b[j + 1] + 1;
+    if (part_a[i] == part_b[j]) {
+      out.high = (unsigned int)part_a[i] << 16;
+      blocks_typed<QFilterU16>(part_a + i + 2, len_a, part_b + j + 2, len_b,
+                               out);
+      i += len_a + 2;
+      j += len_b + 2;
+    } else if (part_a[i] < part_b[j]) {
+      i += len_a + 2;
+    } else {
+      j += len_b + 2;
+    }
+  }
+}
+
+int intersect_partitioned_u16(const uint16_t *part_a, int size_a,
+                              const uint16_t *part_b, int size_b,
+                              unsigned int *set_c, bool count_only) {
+  if (count_only) {
+    PartitionCount out;
+    partitioned_u16(part_a, size_a, part_b, size_b, out);
+    return out.size;
+  }
+
+  PartitionArray out(set_c);
+  partitioned_u16(part_a, size_a, part_b, size_b, out);
+  return out.size;
+}
+
+// The first index at or after `from` whose value is not below `key`. The next
+// block is probed with one unsigned SIMD compare, as the cursors of the k-way
+// kernel usually move only a few elements.
+static inline int kway_lower_bound(const unsigned int *set, int from, int size,
+                                   unsigned int key) {
+#if defined(__AVX2__)
+  if (from + 8 <= size) {
+    const __m256i sign = _mm256_set1_epi32(0x80000000);
+    __m256i v_key = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+    __m256i v_set = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *)(set + from)), sign);
+    int below = _mm_popcnt_u32(
+        _mm256_movemask_ps((__m256)_mm256_cmpgt_epi32(v_key, v_set)));
+    if (below < 8)
+      return from + below;
+    from += 8;
+  }
+#elif defined(__SSE4_2__)
+  if (from + 4 <= size) {
+    const __m128i sign = _mm_set1_epi32(0x80000000);
+    __m128i v_key = _mm_xor_si128(_mm_set1_epi32(key), sign);
+    __m128i v_set =
+        _mm_xor_si128(_mm_lddqu_si128((const __m128i *)(set + from)), sign);
+    int below =
+        _mm_popcnt_u32(_mm_movemask_ps((__m128)_mm_cmpgt_epi32(v_key, v_set)));
+    if (below < 4)
+      return from + below;
+    from += 4;
+  }
+#endif
+  if (from >= size || set[from] >= key)
+    return from;
+
+  // double-jump, keeping set[left] < key:
+  int left = from, r = 1;
+  while (from + r < size && set[from + r] < key) {
+    left = from + r;
+    r <<= 1;
+  }
+  // binary search in (left, right]:
+  int right = (from + r < size) ? (from + r) : size;
+  while (left + 1 < right) {
+    int mid = (left + right) >> 1;
+    if (set[mid] < key)
+      left = mid;
+    else
+      right = mid;
+  }
+
+  return right;
+}
+
+template <class Output>
+static void kway_uint(const std::size_t *sets, const int *sizes, int k,
+                      Output &out) {
+  if (k <= 0)
+    return;
+
+  const unsigned int *set_a = (const unsigned int *)sets[0];
+  int size_a = sizes[0];
+  std::vector<int> cursors(k, 0);
+
+  for (int i = 0; i < size_a;) {
+    unsigned int candidate = set_a[i];
+    int l = 1;
+    for (; l < k; ++l) {
+      const unsigned int *set_l = (const unsigned int *)sets[l];
+      int j = kway_lower_bound(set_l, cursors[l], sizes[l], candidate);
+      cursors[l] = j;
+      if (j == sizes[l])
+        return;
+      if (set_l[j] != candidate) {
+        // leap the first list to the value that beat the candidate
+        i = kway_lower_bound(set_a, i + 1, size_a, set_l[j]);
+        break;
+      }
+    }
+
+    if (l == k) {
+      out.scalar(set_a + i);
+      i++;
+    }
+  }
+}
+
+int intersect_kway_uint(const std::size_t *sets, const int *sizes, int k,
+                        unsigned int *set_c, bool count_only) {
+  if (count_only) {
+    CountOutput out;
+    kway_uint(sets, sizes, k, out);
+    return out.size;
+  }
+
+  ArrayOutput out(set_c);
+  kway_uint(sets, sizes, k, out);
+  return out.size;
+}
+
+// Bit `x - base` of `words` is set for every x of the prepared set. Eight
+// elements of set_a are looked up by one gather, those off the bitmap masked
+// out, so the work follows set_a alone.
+template <class Output>
+static void bitmap_uint(const unsigned int *set_a, int size_a,
+                        const unsigned int *words, unsigned int base,
+                        int num_words, Output &out) {
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256i v_base = _mm256_set1_epi32(base);
+  const __m256i v_num_words = _mm256_set1_epi32(num_words);
+  const __m256i v_31 = _mm256_set1_epi32(31);
+  const __m256i v_one = _mm256_set1_epi32(1);
+  for (; i + 8 <= size_a; i += 8) {
+    __m256i v_a = _mm256_loadu_si256((const __m256i *)(set_a + i));
+    __m256i v_bit = _mm256_sub_epi32(v_a, v_base);
+    // word indexes are below 2^27, so the signed compare holds
+    __m256i v_word = _mm256_srli_epi32(v_bit, 5);
+    __m256i v_on = _mm256_cmpgt_epi32(v_num_words, v_word);
+    __m256i v_words = _mm256_mask_i32gather_epi32(
+        _mm256_setzero_si256(), (const int *)words, v_word, v_on, 4);
+    __m256i v_set = _mm256_and_si256(
+        _mm256_srlv_epi32(v_words, _mm256_and_si256(v_bit, v_31)), v_one);
+    int mask = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpeq_epi32(v_set, v_one)));
+    if (mask)
+      out.block8(set_a + i, v_a, mask);
+  }
+#endif
+  for (; i < size_a; ++i) {
+    unsigned int bit = set_a[i] - base;
+    if ((bit >> 5) < (unsigned int)num_words &&
+        (words[bit >> 5] >> (bit & 31)) & 1)
+      out.scalar(set_a + i);
+  }
+}
+
+int intersect_bitmap_uint(const unsigned int *set_a, int size_a,
+                          const unsigned int *words, unsigned int base,
+                          int num_words, unsigned int *set_c,
+                          bool count_only) {
+  if (count_only) {
+    CountOutput out;
+    bitmap_uint(set_a, size_a, words, base, num_words, out);
+    return out.size;
+  }
+
+  ArrayOutput out(set_c);
+  bitmap_uint(set_a, size_a, words, base, num_words, out);
+  return out.size;
+}
+
+// The galloping and QFilter kernels for positions and callbacks, the widest
+// this build has.
+template <class Output>
+static void galloping_uint_best(const unsigned int *set_a, int size_a,
+                                const unsigned int *set_b, int size_b,
+                                Output &out) {
+#if defined(__SSE4_2__)
+  simdgalloping_uint(set_a, size_a, set_b, size_b, out);
+#else
+  scalargalloping_uint(set_a, size_a, set_b, size_b, out);
+#endif
+}
+
+template <class Output>
+static void qfilter_uint_best(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              Output &out) {
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+  qfilter_uint_b16(set_a, size_a, set_b, size_b, out);
+#elif defined(__AVX2__)
+  qfilter_uint_b8(set_a, size_a, set_b, size_b, out);
+#elif defined(__SSE4_2__)
+  qfilter_uint_b4(set_a, size_a, set_b, size_b, out);
+#else
+  scalarmerge_uint(set_a, size_a, set_b, size_b, out);
+#endif
+}
+
+int intersect_galloping_uint_positions(const unsigned int *set_a, int size_a,
+                                       const unsigned int *set_b, int size_b,
+                                       unsigned int *positions) {
+  PositionOutput out(set_a, positions);
+  galloping_uint_best(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+int intersect_qfilter_uint_positions(const unsigned int *set_a, int size_a,
+                                     const unsigned int *set_b, int size_b,
+                                     unsigned int *positions) {
+  PositionOutput out(set_a, positions);
+  qfilter_uint_best(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+int intersect_galloping_uint_callback(const unsigned int *set_a, int size_a,
+                                      const unsigned int *set_b, int size_b,
+                                      std::size_t callback,
+                                      std::size_t context) {
+  CallbackOutput out((MatchCallback)callback, (void *)context);
+  galloping_uint_best(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+int intersect_qfilter_uint_callback(const unsigned int *set_a, int size_a,
+                                    const unsigned int *set_b, int size_b,
+                                    std::size_t callback, std::size_t context) {
+  CallbackOutput out((MatchCallback)callback, (void *)context);
+  qfilter_uint_best(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+// The count alone asks whether the intersection reaches `limit`, and stops
+// once the rest cannot. Both return at most `limit`.
+static inline int run_limit(UintImpl<Limited<CountOutput> > count_impl,
+                            UintImpl<Limited<ArrayOutput> > array_impl,
+                            const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            unsigned int *set_c, int limit, bool count_only) {
+  if (count_only) {
+    Limited<CountOutput> out(CountOutput(), limit, true);
+    count_impl(set_a, size_a, set_b, size_b, out);
+    return std::min(out.size, limit);
+  }
+
+  Limited<ArrayOutput> out(ArrayOutput(set_c), limit, false);
+  array_impl(set_a, size_a, set_b, size_b, out);
+  return std::min(out.size, limit);
+}
+
+int intersect_galloping_uint_limit(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, int limit,
+                                   bool count_only) {
+  return run_limit(galloping_uint_best<Limited<CountOutput> >,
+                   galloping_uint_best<Limited<ArrayOutput> >, set_a, size_a,
+                   set_b, size_b, set_c, limit, count_only);
+}
+
+int intersect_qfilter_uint_limit(const unsigned int *set_a, int size_a,
+                                 const unsigned int *set_b, int size_b,
+                                 unsigned int *set_c, int limit,
+                                 bool count_only) {
+  return run_limit(qfilter_uint_best<Limited<CountOutput> >,
+                   qfilter_uint_best<Limited<ArrayOutput> >, set_a, size_a,
+                   set_b, size_b, set_c, limit, count_only);
+}
+
+// The size of the intersection, by galloping when one set is 4 times (the
+// default gallop overhead) smaller than the other, by QFilter otherwise.
+static int intersection_size(const unsigned int *set_a, int size_a,
+                             const unsigned int *set_b, int size_b) {
+  if (size_a > size_b) {
+    std::swap(set_a, set_b);
+    std::swap(size_a, size_b);
+  }
+
+  CountOutput out;
+  if (size_a < size_b / 4)
+    galloping_uint_best(set_a, size_a, set_b, size_b, out);
+  else
+    qfilter_uint_best(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+// Sinks for the scalar merges below, which push every element of both sets
+// in order, repeats included.
+// Passes on each value of the stream once.
+template <class Output> struct UniqueSink {
+  Output &out;
+  unsigned int last;
+  bool empty;
+
+  explicit UniqueSink(Output &out) : out(out), last(0), empty(true) {}
+  UniqueSink(Output &out, unsigned int last)
+      : out(out), last(last), empty(false) {}
+
+  void push(unsigned int value) {
+    if (empty || value != last)
+      out.scalar(&value);
+    last = value;
+    empty = false;
+  }
+  void finish() {}
+};
+
+// Passes on the values that occur once in the stream.
+template <class Output> struct SingleSink {
+  Output &out;
+  unsigned int value;
+  int count;
+
+  explicit SingleSink(Output &out) : out(out), value(0), count(0) {}
+  SingleSink(Output &out, unsigned int value, int count)
+      : out(out), value(value), count(count) {}
+
+  void push(unsigned int next) {
+    if (count > 0 && next == value) {
+      count++;
+      return;
+    }
+    finish();
+    value = next;
+    count = 1;
+  }
+  void finish() {
+    if (count == 1)
+      out.scalar(&value);
+  }
+};
+
+// Collects the stream in a buffer.
+struct BufferSink {
+  unsigned int *buffer;
+  int size;
+
+  explicit BufferSink(unsigned int *buffer) : buffer(buffer), size(0) {}
+
+  void push(unsigned int value) { buffer[size++] = value; }
+  void finish() {}
+};
+
+template <class Sink>
+static void scalarmerge_stream(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               Sink &sink) {
+  int i = 0, j = 0;
+  while (i < size_a && j < size_b) {
+    if (set_a[i] <= set_b[j])
+      sink.push(set_a[i++]);
+    else
+      sink.push(set_b[j++]);
+  }
+  for (; i < size_a; ++i)
+    sink.push(set_a[i]);
+  for (; j < size_b; ++j)
+    sink.push(set_b[j]);
+}
+
+// Drops the values of set_a at positions whose bit is set in `found`, and
+// those also in set_b.
+template <class Output>
+static void scalar_difference_uint(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   Output &out, unsigned int found = 0) {
+  int j = 0;
+  for (int i = 0; i < size_a; ++i, found >>= 1) {
+    while (j < size_b && set_b[j] < set_a[i])
+      j++;
+    if (!(found & 1) && (j == size_b || set_b[j] != set_a[i]))
+      out.scalar(set_a + i);
+  }
+}
+
+#if defined(__SSE4_2__)
+// Merges the sorted lanes of v_a and v_b into the 4 smallest, in order, and
+// the 4 largest of them, with the bitonic network of Inoue and Taura.
+static inline void merge_4x4(__m128i v_a, __m128i v_b, __m128i &v_min,
+                             __m128i &v_max) {
+  __m128i tmp = _mm_min_epu32(v_a, v_b);
+  v_max = _mm_max_epu32(v_a, v_b);
+  for (int round = 0; round < 3; ++round) {
+    tmp = _mm_alignr_epi8(tmp, tmp, 4);
+    v_min = _mm_min_epu32(tmp, v_max);
+    v_max = _mm_max_epu32(tmp, v_max);
+    tmp = v_min;
+  }
+  v_min = _mm_alignr_epi8(v_min, v_min, 4);
+}
+
+// How merge_uint outputs a block of the merged order, and the sink taking
+// the rest after the last lane of `previous`: the union keeps one of every
+// value, the symmetric difference only the values that are not repeated.
+struct UnionPolicy {
+  // The lanes of v that differ from the one before, the lane before the first
+  // being the last of `previous`.
+  template <class Output>
+  static void store(__m128i previous, __m128i v, Output &out) {
+    __m128i before = _mm_alignr_epi8(v, previous, 12);
+    int repeated = _mm_movemask_ps((__m128)_mm_cmpeq_epi32(before, v));
+    out.block4(nullptr, v, repeated ^ 0xF);
+  }
+
+  template <class Output>
+  static UniqueSink<Output> sink(Output &out, __m128i previous) {
+    return UniqueSink<Output>(out, _mm_extract_epi32(previous, 3));
+  }
+};
+
+struct SinglePolicy {
+  // The lanes of (previous[3], v[0], v[1], v[2]) that differ from both
+  // neighbours, v[3] waits for the next block.
+  template <class Output>
+  static void store(__m128i previous, __m128i v, Output &out) {
+    __m128i middle = _mm_alignr_epi8(v, previous, 12);
+    __m128i before = _mm_alignr_epi8(v, previous, 8);
+    __m128i repeated = _mm_or_si128(_mm_cmpeq_epi32(middle, before),
+                                    _mm_cmpeq_epi32(middle, v));
+    out.block4(nullptr, middle, _mm_movemask_ps((__m128)repeated) ^ 0xF);
+  }
+
+  template <class Output>
+  static SingleSink<Output> sink(Output &out, __m128i previous) {
+    unsigned int value = _mm_extract_epi32(previous, 3);
+    unsigned int before = _mm_extract_epi32(previous, 2);
+    return SingleSink<Output>(out, value, value == before ? 2 : 1);
+  }
+};
+
+// Merges both sets 4 elements at a time, loading from the set whose next
+// element is smaller, so the 4 smallest of each merge are final and go to the
+// policy. The rest goes through the scalar merge. Both sets need 4 elements.
+template <class Policy, class Output>
+static void merge_uint(const unsigned int *set_a, int size_a,
+                       const unsigned int *set_b, int size_b, Output &out) {
+  __m128i v_min, v_max;
+  merge_4x4(_mm_lddqu_si128((__m128i *)set_a),
+            _mm_lddqu_si128((__m128i *)set_b), v_min, v_max);
+  int i = 4, j = 4;
+  // one below the first lane, so nothing before it repeats it
+  __m128i previous = _mm_set1_epi32(_mm_cvtsi128_si32(v_min) - 1);
+  Policy::store(previous, v_min, out);
+  previous = v_min;
+
+  while (i + 4 <= size_a && j + 4 <= size_b) {
+    // a select instead of a branch, the order of the blocks is not predictable
+    bool from_a = set_a[i] <= set_b[j];
+    const unsigned int *next = from_a ? set_a + i : set_b + j;
+    i += from_a ? 4 : 0;
+    j += from_a ? 0 : 4;
+    __m128i v = _mm_lddqu_si128((__m128i *)next);
+    merge_4x4(v, v_max, v_min, v_max);
+    Policy::store(previous, v_min, out);
+    previous = v_min;
+  }
+
+  // The set with fewer than 4 elements left joins the largest lanes, then
+  // both are merged with the other set.
+  const unsigned int *rest = set_a + i, *other = set_b + j;
+  int size_rest = size_a - i, size_other = size_b - j;
+  if (size_rest >= 4) {
+    std::swap(rest, other);
+    std::swap(size_rest, size_other);
+  }
+  unsigned int largest[4], buffer[8];
+  _mm_storeu_si128((__m128i *)largest, v_max);
+  BufferSink merged(buffer);
+  scalarmerge_stream(largest, 4, rest, size_rest, merged);
+
+  auto sink = Policy::sink(out, previous);
+  scalarmerge_stream(buffer, merged.size, other, size_other, sink);
+  sink.finish();
+}
+
+template <class Output>
+static void union_uint(const unsigned int *set_a, int size_a,
+                       const unsigned int *set_b, int size_b, Output &out) {
+  if (size_a < 4 || size_b < 4) {
+    UniqueSink<Output> sink(out);
+    scalarmerge_stream(set_a, size_a, set_b, size_b, sink);
+    return;
+  }
+  merge_uint<UnionPolicy>(set_a, size_a, set_b, size_b, out);
+}
+
+template <class Output>
+static void symmetric_difference_uint(const unsigned int *set_a, int size_a,
+                                      const unsigned int *set_b, int size_b,
+                                      Output &out) {
+  if (size_a < 4 || size_b < 4) {
+    SingleSink<Output> sink(out);
+    scalarmerge_stream(set_a, size_a, set_b, size_b, sink);
+    sink.finish();
+    return;
+  }
+  merge_uint<SinglePolicy>(set_a, size_a, set_b, size_b, out);
+}
+
+// Compares every block of set_a with all rotations of the blocks of set_b
+// its range overlaps, and outputs the lanes that never matched once the
+// block is done.
+template <class Output>
+static void difference_uint(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  int i = 0, j = 0;
+  int qs_a = size_a - (size_a & 3);
+  int qs_b = size_b - (size_b & 3);
+  int found = 0; // the lanes of the block at i matched so far
+
+  while (i < qs_a && j < qs_b) {
+    __m128i v_a = _mm_lddqu_si128((__m128i *)(set_a + i));
+    __m128i v_b = _mm_lddqu_si128((__m128i *)(set_b + j));
+    unsigned int a_max = set_a[i + 3];
+    unsigned int b_max = set_b[j + 3];
+
+    __m128i cmp_mask0 = _mm_cmpeq_epi32(v_a, v_b);
+    __m128i cmp_mask1 =
+        _mm_cmpeq_epi32(v_a, _mm_shuffle_epi32(v_b, cyclic_shift1));
+    __m128i cmp_mask2 =
+        _mm_cmpeq_epi32(v_a, _mm_shuffle_epi32(v_b, cyclic_shift2));
+    __m128i cmp_mask3 =
+        _mm_cmpeq_epi32(v_a, _mm_shuffle_epi32(v_b, cyclic_shift3));
+    __m128i cmp_mask = _mm_or_si128(_mm_or_si128(cmp_mask0, cmp_mask1),
+                                    _mm_or_si128(cmp_mask2, cmp_mask3));
+    found |= _mm_movemask_ps((__m128)cmp_mask);
+
+    if (a_max <= b_max) {
+      out.block4(set_a + i, v_a, found ^ 0xF);
+      i += 4;
+      found = 0;
+    }
+    if (b_max <= a_max)
+      j += 4;
+  }
+
+  scalar_difference_uint(set_a + i, size_a - i, set_b + j, size_b - j, out,
+                         found);
+}
+#else
+template <class Output>
+static void union_uint(const unsigned int *set_a, int size_a,
+                       const unsigned int *set_b, int size_b, Output &out) {
+  UniqueSink<Output> sink(out);
+  scalarmerge_stream(set_a, size_a, set_b, size_b, sink);
+}
+
+template <class Output>
+static void symmetric_difference_uint(const unsigned int *set_a, int size_a,
+                                      const unsigned int *set_b, int size_b,
+                                      Output &out) {
+  SingleSink<Output> sink(out);
+  scalarmerge_stream(set_a, size_a, set_b, size_b, sink);
+  sink.finish();
+}
+
+template <class Output>
+static void difference_uint(const unsigned int *set_a, int size_a,
+                            const unsigned int *set_b, int size_b,
+                            Output &out) {
+  scalar_difference_uint(set_a, size_a, set_b, size_b, out);
+}
+#endif
+
+int set_union_uint(const unsigned int *set_a, int size_a,
+                   const unsigned int *set_b, int size_b, unsigned int *set_c,
+                   bool count_only) {
+  if (count_only)
+    return size_a + size_b - intersection_size(set_a, size_a, set_b, size_b);
+
+  ArrayOutput out(set_c);
+  union_uint(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+int set_difference_uint(const unsigned int *set_a, int size_a,
+                        const unsigned int *set_b, int size_b,
+                        unsigned int *set_c, bool count_only) {
+  if (count_only)
+    return size_a - intersection_size(set_a, size_a, set_b, size_b);
+
+  ArrayOutput out(set_c);
+  difference_uint(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+int set_symmetric_difference_uint(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only) {
+  if (count_only)
+    return size_a + size_b -
+           2 * intersection_size(set_a, size_a, set_b, size_b);
+
+  ArrayOutput out(set_c);
+  symmetric_difference_uint(set_a, size_a, set_b, size_b, out);
+  return out.size;
+}
+
+std::size_t intersect_batch_uint(const unsigned int *values,
+                                 const std::size_t *offsets,
+                                 const unsigned int *pairs, int num_pairs,
+                                 int gallop_overhead, unsigned int *set_c,
+                                 std::size_t *offsets_c, bool count_only);
+
+const KernelTable kernels = {
+    intersect_scalarmerge_uint,
+    intersect_scalargalloping_uint,
+#if defined(__SSE4_2__)
+    intersect_simdgalloping_uint,
+    intersect_qfilter_uint_b4,
+#if defined(__AVX2__)
+    intersect_qfilter_uint_b8,
+#else
+    intersect_qfilter_uint_b4,
+#endif
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    intersect_qfilter_uint_b16,
+#elif defined(__AVX2__)
+    intersect_qfilter_uint_b8,
+#else
+    intersect_qfilter_uint_b4,
+#endif
+    intersect_qfilter_uint_b4_v2,
+    intersect_shuffle_uint_b4,
+    intersect_shuffle_uint_b8,
+#if defined(__AVX2__)
+    intersect_shuffle_uint_vec256,
+#else
+    intersect_shuffle_uint_b8,
+#endif
+#else
+    intersect_scalargalloping_uint,
+    intersect_scalarmerge_uint,
+    intersect_scalarmerge_uint,
+    intersect_scalarmerge_uint,
+    intersect_scalarmerge_int,
+    intersect_scalarmerge_uint,
+    intersect_scalarmerge_uint,
+    intersect_scalarmerge_uint,
+#endif
+    intersect_scalarmerge_bsr,
+    intersect_scalargalloping_bsr,
+#if defined(__SSE4_2__)
+    intersect_simdgalloping_bsr,
+    intersect_qfilter_bsr_b4,
+    intersect_qfilter_bsr_b4_v2,
+    intersect_shuffle_bsr_b4,
+#else
+    intersect_scalargalloping_bsr,
+    intersect_scalarmerge_bsr,
+    intersect_scalarmerge_bsr,
+    intersect_scalarmerge_bsr,
+#endif
+    intersect_kway_uint,
+    intersect_batch_uint,
+    intersect_galloping_uint_positions,
+    intersect_qfilter_uint_positions,
+    intersect_galloping_uint_callback,
+    intersect_qfilter_uint_callback,
+    intersect_galloping_u64,
+    intersect_qfilter_u64,
+    intersect_shuffle_u64,
+    intersect_galloping_u16,
+    intersect_qfilter_u16,
+    intersect_shuffle_u16,
+    intersect_partitioned_u16,
+    set_union_uint,
+    set_difference_uint,
+    set_symmetric_difference_uint,
+    intersect_galloping_uint_limit,
+    intersect_qfilter_uint_limit,
+    intersect_bitmap_uint,
+};
+
+// Calls the kernels through this build's table, so the batch kernel picks up
+// the same fallbacks.
+std::size_t intersect_batch_uint(const unsigned int *values,
+                                 const std::size_t *offsets,
+                                 const unsigned int *pairs, int num_pairs,
+                                 int gallop_overhead, unsigned int *set_c,
+                                 std::size_t *offsets_c, bool count_only) {
+  std::size_t size_c = 0;
+  for (int p = 0; p < num_pairs; ++p) {
+    unsigned int l_a = pairs[2 * p], l_b = pairs[2 * p + 1];
+    const unsigned int *set_a = values + offsets[l_a];
+    const unsigned int *set_b = values + offsets[l_b];
+    int size_a = offsets[l_a + 1] - offsets[l_a];
+    int size_b = offsets[l_b + 1] - offsets[l_b];
+    if (size_a > size_b) {
+      std::swap(set_a, set_b);
+      std::swap(size_a, size_b);
+    }
+
+    UintKernel kernel;
+    if (size_a < size_b / gallop_overhead)
+      kernel = (size_a < 4) ? kernels.scalargalloping_uint
+                            : kernels.simdgalloping_uint;
+    else
+      kernel = (size_a < 4) ? kernels.scalarmerge_uint
+                            : kernels.qfilter_uint_b16;
+
+    size_c += kernel(set_a, size_a, set_b, size_b, set_c + size_c, count_only);
+    offsets_c[p] = size_c;
+  }
 
   return size_c;
 }
 
-// int intersect_shuffle_bsr_b4(int* bases_a, int* states_a, int size_a,
-//             int* bases_b, int* states_b, int size_b,
-//             int* bases_c, int* states_c)
-//{
-//     int i = 0, j = 0, size_c = 0;
-//     int qs_a = size_a - (size_a & 3);
-//     int qs_b = size_b - (size_b & 3);
-//
-//     while (i < qs_a && j < qs_b) {
-//         __m128i base_a = _mm_lddqu_si128((__m128i*)(bases_a + i));
-//         __m128i base_b = _mm_lddqu_si128((__m128i*)(bases_b + j));
-//         __m128i state_a = _mm_lddqu_si128((__m128i*)(states_a + i));
-//         __m128i state_b = _mm_lddqu_si128((__m128i*)(states_b + j));
-//
-//         int a_max = bases_a[i + 3];
-//         int b_max = bases_b[j + 3];
-//         if (a_max == b_max) {
-//             i += 4;
-//             j += 4;
-//             _mm_prefetch((char*) (bases_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (bases_b + j), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_b + j), _MM_HINT_NTA);
-//         } else if (a_max < b_max) {
-//             i += 4;
-//             _mm_prefetch((char*) (bases_a + i), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_a + i), _MM_HINT_NTA);
-//         } else {
-//             j += 4;
-//             _mm_prefetch((char*) (bases_b + j), _MM_HINT_NTA);
-//             _mm_prefetch((char*) (states_b + j), _MM_HINT_NTA);
-//         }
-//
-//         // shift0:
-//         __m128i cmp_mask0 = _mm_cmpeq_epi32(base_a, base_b);
-//         __m128i state_c0 = _mm_and_si128(
-//                 _mm_and_si128(state_a, state_b), cmp_mask0);
-//
-//         // shift1:
-//         __m128i base_sf1 = _mm_shuffle_epi32(base_b, cyclic_shift1);
-//         __m128i state_sf1 = _mm_shuffle_epi32(state_b, cyclic_shift1);
-//         __m128i cmp_mask1 = _mm_cmpeq_epi32(base_a, base_sf1);
-//         __m128i state_c1 = _mm_and_si128(
-//                 _mm_and_si128(state_a, state_sf1), cmp_mask1);
-//
-//         // shift2:
-//         __m128i base_sf2 = _mm_shuffle_epi32(base_b, cyclic_shift2);
-//         __m128i state_sf2 = _mm_shuffle_epi32(state_b, cyclic_shift2);
-//         __m128i cmp_mask2 = _mm_cmpeq_epi32(base_a, base_sf2);
-//         __m128i state_c2 = _mm_and_si128(
-//                 _mm_and_si128(state_a, state_sf2), cmp_mask2);
-//
-//         // shift3:
-//         __m128i base_sf3 = _mm_shuffle_epi32(base_b, cyclic_shift3);
-//         __m128i state_sf3 = _mm_shuffle_epi32(state_b, cyclic_shift3);
-//         __m128i cmp_mask3 = _mm_cmpeq_epi32(base_a, base_sf3);
-//         __m128i state_c3 = _mm_and_si128(
-//                 _mm_and_si128(state_a, state_sf3), cmp_mask3);
-//
-//         __m128i state_all = _mm_or_si128(
-//                 _mm_or_si128(state_c0, state_c1),
-//                 _mm_or_si128(state_c2, state_c3)
-//                 );
-//         __m128i cmp_mask = _mm_or_si128(
-//                 _mm_or_si128(cmp_mask0, cmp_mask1),
-//                 _mm_or_si128(cmp_mask2, cmp_mask3)
-//                 );
-//         __m128i state_mask = _mm_cmpeq_epi32(state_all, all_zero_si128);
-//         int mask = (_mm_movemask_ps((__m128)cmp_mask) &
-//                 ~(_mm_movemask_ps((__m128)state_mask)));
-//
-//         __m128i res_b = _mm_shuffle_epi8(base_a, shuffle_mask[mask]);
-//         __m128i res_s = _mm_shuffle_epi8(state_all, shuffle_mask[mask]);
-//         _mm_storeu_si128((__m128i*)(bases_c + size_c), res_b);
-//         _mm_storeu_si128((__m128i*)(states_c + size_c), res_s);
-//
-//         size_c += _mm_popcnt_u32(mask);
-//     }
-//
-//     while (i < size_a && j < size_b) {
-//         if (bases_a[i] == bases_b[j]) {
-//             bases_c[size_c] = bases_a[i];
-//             states_c[size_c] = states_a[i] & states_b[j];
-//             if (states_c[size_c] != 0) bases_c[size_c++] = bases_a[i];
-//             i++; j++;
-//         } else if (bases_a[i] < bases_b[j]){
-//             i++;
-//         } else {
-//             j++;
-//         }
-//     }
-//
-//     return size_c;
-// }
\ No newline at end of file
+} // namespace INTERSECTION_ISA
@@ -1,57 +1,198 @@
 #ifndef _INTER_ALGOS_H
 #define _INTER_ALGOS_H
 
+#include "intersection/include/dispatch.hpp"
 #include "intersection/include/util.hpp"
 
+// Every kernel below forwards to the build for the ISA level picked at
+// startup, see dispatch.hpp.
+
+// All BSR kernels take sets in base + state form: value `v` lives in the
+// base `v >> PACK_SHIFT` with bit `v & PACK_MASK` set in the matching state.
+// Bases are strictly increasing, and every output state is non-zero. They
+// return the number of (base, state) pairs written to `bases_c`/`states_c`,
+// and the SIMD ones may store up to 4 pairs past that count.
+static_assert(sizeof(PackState) == sizeof(PackBase),
+              "the SIMD BSR kernels process bases and states lane by lane");
+
 // ScalarMerge:
-// int intersect_scalarmerge_uint(const int *set_a, int size_a,
-//            const int *set_b, int size_b, int *set_c);
+int intersect_scalarmerge_uint(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only);
 // ScalarMerge+BSR:
-// int intersect_scalarmerge_bsr(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
+int intersect_scalarmerge_bsr(const PackBase *bases_a, const PackState *states_a,
+                              int size_a, const PackBase *bases_b,
+                              const PackState *states_b, int size_b,
+                              PackBase *bases_c, PackState *states_c);
 
 // ScalarGalloping:
-// int intersect_scalargalloping_uint(const int *set_a, int size_a,
-//            const int *set_b, int size_b, int *set_c);
+int intersect_scalargalloping_uint(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, bool count_only);
 // ScalarGalloping+BSR:
-// int intersect_scalargalloping_bsr(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
+int intersect_scalargalloping_bsr(const PackBase *bases_a,
+                                  const PackState *states_a, int size_a,
+                                  const PackBase *bases_b,
+                                  const PackState *states_b, int size_b,
+                                  PackBase *bases_c, PackState *states_c);
 
 // SIMDGalloping:
 int intersect_simdgalloping_uint(const unsigned int *set_a, int size_a,
                                  const unsigned int *set_b, int size_b,
                                  unsigned int *set_c, bool count_only);
 // SIMDGalloping+BSR:
-// int intersect_simdgalloping_bsr(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
+int intersect_simdgalloping_bsr(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c);
 
 // QFilter:
 int intersect_qfilter_uint_b4(const unsigned int *set_a, int size_a,
                               const unsigned int *set_b, int size_b,
                               unsigned int *set_c, bool count_only);
+// The 8 x 8 (AVX2) and 16 x 16 (AVX-512) blocks compare 2 bytes of every pair
+// of elements before the exact comparison, and finish the tails with b4. They
+// may store 8 (b8) elements past the count, and run as the widest variant the
+// current ISA level has.
+int intersect_qfilter_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only);
+int intersect_qfilter_uint_b16(const unsigned int *set_a, int size_a,
+                               const unsigned int *set_b, int size_b,
+                               unsigned int *set_c, bool count_only);
 int intersect_qfilter_uint_b4_v2(const int *set_a, int size_a, const int *set_b,
                                  int size_b, int *set_c);
 
 // QFilter+BSR:
-// int intersect_qfilter_bsr_b4(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
-// int intersect_qfilter_bsr_b4_v2(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
+int intersect_qfilter_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c);
+int intersect_qfilter_bsr_b4_v2(const PackBase *bases_a,
+                                const PackState *states_a, int size_a,
+                                const PackBase *bases_b,
+                                const PackState *states_b, int size_b,
+                                PackBase *bases_c, PackState *states_c);
 
 // Shuffling:
-int intersect_shuffle_uint_b4(const int *set_a, int size_a, const int *set_b,
-                              int size_b, int *set_c);
-int intersect_shuffle_uint_b8(const int *set_a, int size_a, const int *set_b,
-                              int size_b, int *set_c);
-int intersect_shuffle_uint_vec256(const int *set_a, int size_a,
-                                  const int *set_b, int size_b, int *set_c);
+// Unaligned input is fine, the stores may run 4 (b4, b8) or 8 (vec256)
+// elements past the returned count. vec256 runs as b8 below AVX2.
+int intersect_shuffle_uint_b4(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only);
+int intersect_shuffle_uint_b8(const unsigned int *set_a, int size_a,
+                              const unsigned int *set_b, int size_b,
+                              unsigned int *set_c, bool count_only);
+int intersect_shuffle_uint_vec256(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only);
 // Shuffling+BSR:
-// int intersect_shuffle_bsr_b4(int* bases_a, int* states_a, int size_a,
-//            int* bases_b, int* states_b, int size_b,
-//            int* bases_c, int* states_c);
+int intersect_shuffle_bsr_b4(const PackBase *bases_a, const PackState *states_a,
+                             int size_a, const PackBase *bases_b,
+                             const PackState *states_b, int size_b,
+                             PackBase *bases_c, PackState *states_c);
+
+// k-way: `sets` holds the addresses of k sorted lists, smallest first. Every
+// value of the first list is galloped for in the others, starting with a SIMD
+// probe of the next block, so only the final result is written. There is no
+// slack past the returned count.
+int intersect_kway_uint(const std::size_t *sets, const int *sizes, int k,
+                        unsigned int *set_c, bool count_only);
+
+// Bitmap probes: the elements x of set_a whose bit `x - base` is set in the
+// `num_words` words of a prepared set's bitmap, looked up eight at a time by
+// AVX2 gathers. set_c needs 8 elements of slack.
+int intersect_bitmap_uint(const unsigned int *set_a, int size_a,
+                          const unsigned int *words, unsigned int base,
+                          int num_words, unsigned int *set_c,
+                          bool count_only);
+
+// Batch: list `l` is `values[offsets[l]..offsets[l + 1])`, and pair `p`
+// intersects lists `pairs[2p]` and `pairs[2p + 1]`, galloping when one is
+// `gallop_overhead` times smaller, with the widest QFilter otherwise. The
+// results are packed into `set_c`, pair `p` ending at `offsets_c[p]`, which
+// needs 16 elements of slack. Returns the total count.
+std::size_t intersect_batch_uint(const unsigned int *values,
+                                 const std::size_t *offsets,
+                                 const unsigned int *pairs, int num_pairs,
+                                 int gallop_overhead, unsigned int *set_c,
+                                 std::size_t *offsets_c, bool count_only);
+
+// Positions and callbacks, with the widest galloping or QFilter kernel of the
+// current level. `positions` gets the index in set_a of every match and needs
+// 16 elements of slack. `callback` is a MatchCallback called with `context`
+// and each match in order, both passed as integers for the Rust bridge.
+typedef void (*MatchCallback)(void *context, unsigned int value);
+int intersect_galloping_uint_positions(const unsigned int *set_a, int size_a,
+                                       const unsigned int *set_b, int size_b,
+                                       unsigned int *positions);
+int intersect_qfilter_uint_positions(const unsigned int *set_a, int size_a,
+                                     const unsigned int *set_b, int size_b,
+                                     unsigned int *positions);
+int intersect_galloping_uint_callback(const unsigned int *set_a, int size_a,
+                                      const unsigned int *set_b, int size_b,
+                                      std::size_t callback,
+                                      std::size_t context);
+int intersect_qfilter_uint_callback(const unsigned int *set_a, int size_a,
+                                    const unsigned int *set_b, int size_b,
+                                    std::size_t callback, std::size_t context);
+// 64-bit and 16-bit elements: galloping over 128-bit blocks, QFilter and
+// shuffling over blocks of the widest vector the level has (only 128 bits
+// for 16-bit elements). The 16-bit QFilter compares all pairs of a block with
+// one STTNI instruction. There is no slack past the returned count.
+int intersect_galloping_u64(const uint64_t *set_a, int size_a,
+                            const uint64_t *set_b, int size_b,
+                            uint64_t *set_c, bool count_only);
+int intersect_qfilter_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only);
+int intersect_shuffle_u64(const uint64_t *set_a, int size_a,
+                          const uint64_t *set_b, int size_b,
+                          uint64_t *set_c, bool count_only);
+int intersect_galloping_u16(const uint16_t *set_a, int size_a,
+                            const uint16_t *set_b, int size_b,
+                            uint16_t *set_c, bool count_only);
+int intersect_qfilter_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only);
+int intersect_shuffle_u16(const uint16_t *set_a, int size_a,
+                          const uint16_t *set_b, int size_b,
+                          uint16_t *set_c, bool count_only);
+
+// Partitioned: each set is a run of partitions, every one its high 16 bits,
+// its length minus one and then its sorted low 16 bits, `size` counting all of
+// these words. Matching partitions are intersected 8 x 8 low halves at a time
+// with STTNI, and the matches written as full 32-bit values with no slack.
+int intersect_partitioned_u16(const uint16_t *part_a, int size_a,
+                              const uint16_t *part_b, int size_b,
+                              unsigned int *set_c, bool count_only);
+
+// Union, difference (set_a minus set_b) and symmetric difference, from a 4 x 4
+// merge network that keeps the lanes without repeats, and the shuffling
+// comparison for the difference. The stores may run 4 elements past the
+// count. The counts alone come from the size of the intersection.
+int set_union_uint(const unsigned int *set_a, int size_a,
+                   const unsigned int *set_b, int size_b, unsigned int *set_c,
+                   bool count_only);
+int set_difference_uint(const unsigned int *set_a, int size_a,
+                        const unsigned int *set_b, int size_b,
+                        unsigned int *set_c, bool count_only);
+int set_symmetric_difference_uint(const unsigned int *set_a, int size_a,
+                                  const unsigned int *set_b, int size_b,
+                                  unsigned int *set_c, bool count_only);
+
+// Early exits, with the widest galloping or QFilter kernel of the current
+// level: the first `limit` matches are written to set_c, which needs 16
+// elements of slack, and the count alone stops as soon as it reaches `limit`
+// or the elements left cannot make it up, so it is exact only up to `limit`.
+// Both return at most `limit`.
+int intersect_galloping_uint_limit(const unsigned int *set_a, int size_a,
+                                   const unsigned int *set_b, int size_b,
+                                   unsigned int *set_c, int limit,
+                                   bool count_only);
+int intersect_qfilter_uint_limit(const unsigned int *set_a, int size_a,
+                                 const unsigned int *set_b, int size_b,
+                                 unsigned int *set_c, int limit,
+                                 bool count_only);
 #endif
@@ -0,0 +1,91 @@
+#include "intersection/include/intersection_tables.hpp"
+
+uint32_t *prepare_shuffling_dict_avx() {
+  uint32_t *arr = new uint32_t[2048];
+  for (int i = 0; i < 256; ++i) {
+    int count = 0, rest = 7;
+    for (int b = 0; b < 8; ++b) {
+      if (i & (1 << b)) {
+        // n index at pos p - move nth element to pos p
+        arr[i * 8 + count] = b; // move all set bits to beginning
+        ++count;
+      } else {
+        arr[i * 8 + rest] = b; // move rest at the end
+        --rest;
+      }
+    }
+  }
+  return arr;
+}
+const uint32_t *shuffle_mask_avx = prepare_shuffling_dict_avx();
+
+int *prepare_byte_check_mask_dict2() {
+  int *mask = new int[65536];
+
+  auto trans_c_s = [](const int c) -> int {
+    switch (c) {
+    case 0:
+      return -1; // no match
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    case 8:
+      return 3;
+    default:
+      return 4; // multiple matches.
+    }
+  };
+
+  for (int x = 0; x < 65536; ++x) {
+    int c0 = (x & 0xf), c1 = ((x >> 4) & 0xf);
+    int c2 = ((x >> 8) & 0xf), c3 = ((x >> 12) & 0xf);
+    int s0 = trans_c_s(c0), s1 = trans_c_s(c1);
+    int s2 = trans_c_s(c2), s3 = trans_c_s(c3);
+
+    bool is_multiple_match = (s0 == 4) || (s1 == 4) || (s2 == 4) || (s3 == 4);
+    if (is_multiple_match) {
+      mask[x] = -1;
+      continue;
+    }
+    bool is_no_match = (s0 == -1) && (s1 == -1) && (s2 == -1) && (s3 == -1);
+    if (is_no_match) {
+      mask[x] = -2;
+      continue;
+    }
+    if (s0 == -1) {
+      s0 = 0;
+    }
+    if (s1 == -1) {
+      s1 = 1;
+    }
+    if (s2 == -1) {
+      s2 = 2;
+    }
+    if (s3 == -1) {
+      s3 = 3;
+    }
+    mask[x] = (s0) | (s1 << 2) | (s2 << 4) | (s3 << 6);
+  }
+
+  return mask;
+}
+const int *byte_check_mask_dict = prepare_byte_check_mask_dict2();
+
+uint8_t *prepare_match_shuffle_dict2() {
+  uint8_t *dict = new uint8_t[4096];
+
+  for (int x = 0; x < 256; ++x) {
+    for (int i = 0; i < 4; ++i) {
+      uint8_t c = (x >> (i << 1)) & 3; // c = 0, 1, 2, 3
+      int pos = x * 16 + i * 4;
+      for (uint8_t j = 0; j < 4; ++j)
+        dict[pos + j] = c * 4 + j;
+    }
+  }
+
+  return dict;
+}
+const __m128i *match_shuffle_dict = (__m128i *)prepare_match_shuffle_dict2();
@@ -0,0 +1,13 @@
+#ifndef _INTER_TABLES_H
+#define _INTER_TABLES_H
+
+#include "intersection/include/util.hpp"
+
+// The lookup tables built at startup. They live in intersection_tables.cpp,
+// which is compiled for the baseline ISA only, so that loading the library
+// never runs an instruction the host may lack.
+extern const uint32_t *shuffle_mask_avx;
+extern const int *byte_check_mask_dict;
+extern const __m128i *match_shuffle_dict;
+
+#endif
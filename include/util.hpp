@@ -17,11 +17,11 @@
 
 #define SIMD_STATE 4 // 0:none, 2:scalar2x, 4:simd4x
 #define SIMD_MODE 1  // 0:naive 1: filter
-typedef int PackBase;
+typedef unsigned int PackBase;
 #ifdef SI64
-typedef long long PackState;
+typedef unsigned long long PackState;
 #else
-typedef int PackState;
+typedef unsigned int PackState;
 #endif
 const int PACK_WIDTH = sizeof(PackState) * 8;
 const int PACK_SHIFT = __builtin_ctzll(PACK_WIDTH);
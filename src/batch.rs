@@ -0,0 +1,222 @@
+//! Batches of many small intersections over lists packed in one CSR.
+//!
+//! List `l` is `values[offsets[l]..offsets[l + 1]]`, and each pair names two lists, as the edges
+//! of a graph name two adjacency lists. The pairs are cut into chunks of about equal estimated
+//! cost, each chunk is one kernel call (one FFI crossing with the `simd` feature), and the chunks
+//! are spread over threads with work stealing, so a few heavy pairs do not hold up the rest.
+use std::sync::OnceLock;
+
+use crate::intersect::GALLOP_OVERHEAD;
+use crate::parallel::{concat_par, for_each_stealing, num_threads};
+
+#[cfg(not(feature = "simd"))]
+use crate::intersect::intersect;
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::intersect_simd_batch;
+
+/// Chunks per thread, so that stealing has something to balance.
+const CHUNKS_PER_THREAD: usize = 16;
+/// The least estimated cost of a chunk, which keeps chunks of tiny pairs from being too short.
+const MIN_CHUNK_COST: usize = 1 << 14;
+
+/// The intersections of each pair, packed so that pair `p` is `values[offsets[p]..offsets[p + 1]]`.
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct BatchResults {
+    pub values: Vec<u32>,
+    pub offsets: Vec<usize>,
+}
+
+impl BatchResults {
+    pub fn len(&self) -> usize {
+        self.offsets.len().saturating_sub(1)
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    pub fn get(&self, p: usize) -> &[u32] {
+        &self.values[self.offsets[p]..self.offsets[p + 1]]
+    }
+
+    pub fn counts(&self) -> impl Iterator<Item = usize> + '_ {
+        self.offsets.windows(2).map(|w| w[1] - w[0])
+    }
+}
+
+#[inline(always)]
+fn list_len(offsets: &[usize], l: u32) -> usize {
+    offsets[l as usize + 1] - offsets[l as usize]
+}
+
+/// A rough cost of a pair: linear in both sizes, or logarithmic in the larger one when galloping.
+#[inline(always)]
+fn pair_cost(offsets: &[usize], pair: [u32; 2]) -> usize {
+    let (a, b) = (list_len(offsets, pair[0]), list_len(offsets, pair[1]));
+    let (small, large) = (a.min(b), a.max(b));
+    if small < large / *GALLOP_OVERHEAD {
+        small * (usize::BITS - (large / small.max(1)).leading_zeros()) as usize + 1
+    } else {
+        small + large + 1
+    }
+}
+
+/// Cuts `pairs` into chunks of about equal cost, as ranges of pair indices.
+fn chunk_pairs(offsets: &[usize], pairs: &[[u32; 2]], threads: usize) -> Vec<(usize, usize)> {
+    let total: usize = pairs.iter().map(|&pair| pair_cost(offsets, pair)).sum();
+    let target = (total / (threads.max(1) * CHUNKS_PER_THREAD)).max(MIN_CHUNK_COST);
+
+    let mut chunks = Vec::new();
+    let (mut start, mut cost) = (0, 0);
+    for (p, &pair) in pairs.iter().enumerate() {
+        cost += pair_cost(offsets, pair);
+        if cost >= target || p - start + 1 == i32::MAX as usize {
+            chunks.push((start, p + 1));
+            start = p + 1;
+            cost = 0;
+        }
+    }
+    if start < pairs.len() {
+        chunks.push((start, pairs.len()));
+    }
+
+    chunks
+}
+
+/// Intersects the pairs of one chunk, appending to `values` and pushing each pair's end offset,
+/// relative to the chunk, onto `offsets`.
+fn run_chunk(
+    values: &[u32],
+    offsets: &[usize],
+    pairs: &[[u32; 2]],
+    results: Option<&mut Vec<u32>>,
+    offsets_c: &mut Vec<usize>,
+) {
+    #[cfg(feature = "simd")]
+    {
+        intersect_simd_batch(values, offsets, pairs, *GALLOP_OVERHEAD, results, offsets_c);
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        let mut results = results;
+        let mut size_c = 0;
+        for &[l_a, l_b] in pairs {
+            let list = |l: u32| &values[offsets[l as usize]..offsets[l as usize + 1]];
+            let (a, b) = (list(l_a), list(l_b));
+            let (a, b) = if a.len() <= b.len() { (a, b) } else { (b, a) };
+            size_c += intersect(a, b, results.as_deref_mut());
+            offsets_c.push(size_c);
+        }
+    }
+}
+
+fn intersect_batch_with(
+    values: &[u32],
+    offsets: &[usize],
+    pairs: &[[u32; 2]],
+    count_only: bool,
+    threads: usize,
+) -> BatchResults {
+    let num_lists = offsets.len().saturating_sub(1);
+    assert!(offsets.windows(2).all(|w| w[0] <= w[1]));
+    assert!(offsets.last().map_or(true, |&end| end <= values.len()));
+    assert!(pairs.iter().flatten().all(|&l| (l as usize) < num_lists));
+
+    let chunks = chunk_pairs(offsets, pairs, threads);
+    let outputs: Vec<OnceLock<(Vec<u32>, Vec<usize>)>> =
+        chunks.iter().map(|_| OnceLock::new()).collect();
+
+    for_each_stealing(chunks.len(), threads, |c| {
+        let (start, end) = chunks[c];
+        let mut values_c = Vec::new();
+        let mut offsets_c = Vec::with_capacity(end - start);
+        let results = (!count_only).then_some(&mut values_c);
+        run_chunk(values, offsets, &pairs[start..end], results, &mut offsets_c);
+        outputs[c].set((values_c, offsets_c)).unwrap();
+    });
+
+    let outputs: Vec<(Vec<u32>, Vec<usize>)> = outputs
+        .into_iter()
+        .map(|output| output.into_inner().unwrap())
+        .collect();
+
+    let mut batch = BatchResults {
+        values: Vec::new(),
+        offsets: Vec::with_capacity(pairs.len() + 1),
+    };
+    batch.offsets.push(0);
+    for (_, offsets_c) in &outputs {
+        let base = *batch.offsets.last().unwrap();
+        batch
+            .offsets
+            .extend(offsets_c.iter().map(|&end| base + end));
+    }
+
+    if !count_only {
+        let parts: Vec<Vec<u32>> = outputs.into_iter().map(|(values_c, _)| values_c).collect();
+        concat_par(&parts, threads, &mut batch.values);
+    }
+
+    batch
+}
+
+/// Intersects every pair of lists over [`num_threads`] threads.
+pub fn intersect_batch(values: &[u32], offsets: &[usize], pairs: &[[u32; 2]]) -> BatchResults {
+    intersect_batch_with(values, offsets, pairs, false, num_threads())
+}
+
+/// The size of each pair's intersection, without writing any of them.
+pub fn intersect_batch_count(values: &[u32], offsets: &[usize], pairs: &[[u32; 2]]) -> Vec<usize> {
+    intersect_batch_with(values, offsets, pairs, true, num_threads())
+        .counts()
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_intersect_batch() {
+        // list l holds the multiples of l + 1, one huge list and many small ones
+        let lists: Vec<Vec<u32>> = (0..200u32)
+            .map(|l| {
+                let len = if l == 0 {
+                    1 << 16
+                } else {
+                    1000 / (l as usize % 7 + 1)
+                };
+                (1..=len as u32).map(|i| i * (l + 1)).collect()
+            })
+            .collect();
+        let mut values = Vec::new();
+        let mut offsets = vec![0];
+        for list in &lists {
+            values.extend_from_slice(list);
+            offsets.push(values.len());
+        }
+        let pairs: Vec<[u32; 2]> = (0..200u32)
+            .flat_map(|a| [[a, (a * 7 + 3) % 200], [0, a], [a, a]])
+            .collect();
+
+        for threads in [0, 1, 3] {
+            let batch = intersect_batch_with(&values, &offsets, &pairs, false, threads);
+            let counts = intersect_batch_with(&values, &offsets, &pairs, true, threads);
+            assert_eq!(batch.len(), pairs.len());
+            assert_eq!(counts.offsets, batch.offsets);
+            for (p, &[a, b]) in pairs.iter().enumerate() {
+                let mut expected = Vec::new();
+                intersect_scalar_merge(&lists[a as usize], &lists[b as usize], Some(&mut expected));
+                assert_eq!(batch.get(p), expected);
+            }
+        }
+
+        assert!(intersect_batch(&[], &[0], &[]).is_empty());
+        assert_eq!(
+            intersect_batch_count(&[1, 2], &[0, 2, 2], &[[0, 1], [0, 0]]),
+            vec![0, 2]
+        );
+    }
+}
@@ -0,0 +1,249 @@
+//! The BSR (base + state) representation of sorted `u32` sets.
+//!
+//! Han S, Zou L, Yu J X. Speeding up set intersections in graph algorithms using simd instructions[C]
+//! Proceedings of the 2018 International Conference on Management of Data. 2018: 1587-1602.
+//!
+//! A value `v` is stored as the base `v >> PACK_SHIFT` together with the bit `v & PACK_MASK`
+//! in the state word of that base, so dense runs of values share a single (base, state) pair.
+use std::cmp::Ordering;
+
+use crate::intersect::gallop_by;
+
+/// The number of values covered by one state word, mirrors `PACK_WIDTH` in `util.hpp`.
+pub const PACK_WIDTH: u32 = u32::BITS;
+pub const PACK_SHIFT: u32 = PACK_WIDTH.trailing_zeros();
+pub const PACK_MASK: u32 = PACK_WIDTH - 1;
+
+#[derive(Clone, Debug, Default, PartialEq, Eq, Hash)]
+pub struct BsrSet {
+    bases: Vec<u32>,
+    states: Vec<u32>,
+}
+
+impl BsrSet {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Creates an empty set that holds `capacity` (base, state) pairs without reallocating.
+    pub fn with_capacity(capacity: usize) -> Self {
+        Self {
+            bases: Vec::with_capacity(capacity),
+            states: Vec::with_capacity(capacity),
+        }
+    }
+
+    /// Builds the set from sorted values, duplicates are allowed.
+    pub fn from_sorted(values: &[u32]) -> Self {
+        let mut set = Self::new();
+        for &v in values {
+            set.push(v);
+        }
+
+        set
+    }
+
+    /// Appends `v`, which must not be smaller than any value already in the set.
+    #[inline(always)]
+    pub fn push(&mut self, v: u32) {
+        let base = v >> PACK_SHIFT;
+        let state = 1 << (v & PACK_MASK);
+        match self.bases.last() {
+            Some(&last) if last == base => *self.states.last_mut().unwrap() |= state,
+            _ => {
+                debug_assert!(self.bases.last().map_or(true, |&last| last < base));
+                self.bases.push(base);
+                self.states.push(state);
+            }
+        }
+    }
+
+    #[inline(always)]
+    pub fn bases(&self) -> &[u32] {
+        &self.bases
+    }
+
+    #[inline(always)]
+    pub fn states(&self) -> &[u32] {
+        &self.states
+    }
+
+    /// The number of (base, state) pairs.
+    #[inline(always)]
+    pub fn num_bases(&self) -> usize {
+        self.bases.len()
+    }
+
+    /// The number of values in the set.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.states.iter().map(|s| s.count_ones() as usize).sum()
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.bases.is_empty()
+    }
+
+    pub fn clear(&mut self) {
+        self.bases.clear();
+        self.states.clear();
+    }
+
+    /// Iterates over the values in ascending order.
+    pub fn iter(&self) -> impl Iterator<Item = u32> + '_ {
+        self.bases
+            .iter()
+            .zip(self.states.iter())
+            .flat_map(|(&base, &state)| {
+                let mut state = state;
+                std::iter::from_fn(move || {
+                    if state == 0 {
+                        return None;
+                    }
+                    let bit = state.trailing_zeros();
+                    state &= state - 1;
+                    Some((base << PACK_SHIFT) | bit)
+                })
+            })
+    }
+
+    pub fn to_vec(&self) -> Vec<u32> {
+        self.iter().collect()
+    }
+
+    /// Reserves room for `additional` pairs in both arrays.
+    #[cfg(feature = "simd")]
+    #[inline(always)]
+    pub(crate) fn reserve_exact(&mut self, additional: usize) {
+        self.bases.reserve_exact(additional);
+        self.states.reserve_exact(additional);
+    }
+
+    #[cfg(feature = "simd")]
+    #[inline(always)]
+    pub(crate) fn spare_ptrs(&mut self) -> (*mut u32, *mut u32) {
+        let len = self.bases.len();
+        unsafe {
+            (
+                self.bases.as_mut_ptr().add(len),
+                self.states.as_mut_ptr().add(len),
+            )
+        }
+    }
+
+    /// # Safety
+    ///
+    /// The first `len` pairs of both arrays must be initialized.
+    #[cfg(feature = "simd")]
+    #[inline(always)]
+    pub(crate) unsafe fn set_len(&mut self, len: usize) {
+        self.bases.set_len(len);
+        self.states.set_len(len);
+    }
+
+    #[inline(always)]
+    fn push_pair(&mut self, base: u32, state: u32) {
+        self.bases.push(base);
+        self.states.push(state);
+    }
+}
+
+impl From<&[u32]> for BsrSet {
+    fn from(values: &[u32]) -> Self {
+        Self::from_sorted(values)
+    }
+}
+
+/// Returns the number of values in the intersection, the pairs are appended to `results`.
+#[inline(always)]
+pub fn intersect_bsr_scalar_merge(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    mut results: Option<&mut BsrSet>,
+) -> usize {
+    let mut count = 0;
+    let (mut i, mut j) = (0, 0);
+
+    while i < aaa.bases.len() && j < bbb.bases.len() {
+        match aaa.bases[i].cmp(&bbb.bases[j]) {
+            Ordering::Less => i += 1,
+            Ordering::Greater => j += 1,
+            Ordering::Equal => {
+                let state = aaa.states[i] & bbb.states[j];
+                if state != 0 {
+                    count += state.count_ones() as usize;
+                    if let Some(set) = results.as_mut() {
+                        set.push_pair(aaa.bases[i], state);
+                    }
+                }
+                i += 1;
+                j += 1;
+            }
+        }
+    }
+
+    count
+}
+
+/// Returns the number of values in the intersection, the pairs are appended to `results`.
+#[inline(always)]
+pub fn intersect_bsr_scalar_gallop(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    mut results: Option<&mut BsrSet>,
+) -> usize {
+    let mut count = 0;
+    let mut bases = &bbb.bases[..];
+
+    for (&base, &state_a) in aaa.bases.iter().zip(aaa.states.iter()) {
+        bases = gallop_by(bases, |x: &u32| base.cmp(x));
+        if bases.is_empty() {
+            break;
+        }
+        if bases[0] == base {
+            let state = state_a & bbb.states[bbb.bases.len() - bases.len()];
+            if state != 0 {
+                count += state.count_ones() as usize;
+                if let Some(set) = results.as_mut() {
+                    set.push_pair(base, state);
+                }
+            }
+        }
+    }
+
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bsr_set() {
+        let values = vec![0, 1, 31, 32, 33, 100, 1_000_000, u32::MAX - 1, u32::MAX];
+        let set = BsrSet::from_sorted(&values);
+        assert_eq!(set.bases(), &[0, 1, 3, 31_250, u32::MAX >> PACK_SHIFT]);
+        assert_eq!(set.len(), values.len());
+        assert_eq!(set.to_vec(), values);
+
+        let set = BsrSet::from_sorted(&[5, 5, 6]);
+        assert_eq!(set.to_vec(), vec![5, 6]);
+        assert!(BsrSet::from_sorted(&[]).is_empty());
+    }
+
+    #[test]
+    fn test_bsr_scalar() {
+        let x = BsrSet::from_sorted(&[1, 2, 3, 4, 40, 64, 3_000_000_000, u32::MAX]);
+        let y = BsrSet::from_sorted(&[1, 3, 5, 41, 64, 65, 3_000_000_000, u32::MAX]);
+        let expected = vec![1, 3, 64, 3_000_000_000, u32::MAX];
+
+        let mut result = BsrSet::new();
+        assert_eq!(intersect_bsr_scalar_merge(&x, &y, Some(&mut result)), 5);
+        assert_eq!(result.to_vec(), expected);
+        let mut result = BsrSet::new();
+        assert_eq!(intersect_bsr_scalar_gallop(&x, &y, Some(&mut result)), 5);
+        assert_eq!(result.to_vec(), expected);
+        assert_eq!(intersect_bsr_scalar_gallop(&y, &x, None), 5);
+    }
+}
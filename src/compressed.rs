@@ -0,0 +1,302 @@
+//! Block-compressed sorted `u32` sets with a skip table.
+//!
+//! Lemire D, Boytsov L, Kurz N. SIMD compression and the intersection of sorted integers[J].
+//! Software: Practice and Experience, 2016, 46(6): 723-749.
+//!
+//! Values go in blocks of 128, each coded as the differences to the value four places earlier
+//! (D4), and bit-packed at the block's widest difference in four interleaved lanes, so unpacking
+//! and the prefix sum run on whole 4-lane vectors. The skip table keeps each block's min and max,
+//! and the intersections skip blocks that cannot overlap, decode only candidate blocks into a
+//! stack buffer, and run [`intersect`] on them.
+use crate::intersect::intersect;
+
+pub const BLOCK_LEN: usize = 128;
+const LANES: usize = 4;
+
+/// The skip table entry of one block.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub struct Skip {
+    pub min: u32,
+    pub max: u32,
+    /// The first packed word of the block.
+    offset: u32,
+    /// The bits per difference.
+    width: u8,
+    /// The number of values, minus one.
+    last: u8,
+}
+
+impl Skip {
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.last as usize + 1
+    }
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq, Hash)]
+pub struct CompressedSet {
+    skips: Vec<Skip>,
+    words: Vec<u32>,
+    len: usize,
+}
+
+impl CompressedSet {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Builds the set from sorted values, duplicates are allowed.
+    pub fn from_sorted(values: &[u32]) -> Self {
+        let mut set = Self::new();
+        let mut block = [0u32; BLOCK_LEN];
+        let mut len = 0;
+        for (i, &v) in values.iter().enumerate() {
+            if i > 0 && values[i - 1] == v {
+                continue;
+            }
+            block[len] = v;
+            len += 1;
+            if len == BLOCK_LEN {
+                set.push_block(&block[..len]);
+                len = 0;
+            }
+        }
+        if len > 0 {
+            set.push_block(&block[..len]);
+        }
+
+        set
+    }
+
+    fn push_block(&mut self, values: &[u32]) {
+        // pad with the last value, whose differences are 0
+        let mut padded = [*values.last().unwrap(); BLOCK_LEN];
+        padded[..values.len()].copy_from_slice(values);
+
+        let mut deltas = [0u32; BLOCK_LEN];
+        for i in 0..BLOCK_LEN {
+            let previous = if i < LANES {
+                values[0]
+            } else {
+                padded[i - LANES]
+            };
+            deltas[i] = padded[i] - previous;
+        }
+        let width = 32 - deltas.iter().fold(0, |acc, &d| acc | d).leading_zeros();
+
+        self.skips.push(Skip {
+            min: values[0],
+            max: *values.last().unwrap(),
+            offset: self.words.len() as u32,
+            width: width as u8,
+            last: (values.len() - 1) as u8,
+        });
+        self.len += values.len();
+
+        // lane l holds the differences l, l + 4, ..., each packed at `width` bits
+        let start = self.words.len();
+        self.words.resize(start + LANES * width as usize, 0);
+        let words = &mut self.words[start..];
+        for k in 0..BLOCK_LEN / LANES {
+            let bit = k * width as usize;
+            let (w, shift) = (bit / 32, bit % 32);
+            for l in 0..LANES {
+                let d = deltas[k * LANES + l];
+                words[w * LANES + l] |= d << shift;
+                if shift + width as usize > 32 {
+                    words[(w + 1) * LANES + l] |= d >> (32 - shift);
+                }
+            }
+        }
+    }
+
+    /// Unpacks block `b` into `out`, returning its length.
+    #[inline(always)]
+    pub fn decode_block(&self, b: usize, out: &mut [u32; BLOCK_LEN]) -> usize {
+        let skip = self.skips[b];
+        let width = skip.width as usize;
+        let words = &self.words[skip.offset as usize..][..LANES * width];
+        let mask = if width == 32 { !0 } else { (1u32 << width) - 1 };
+
+        let mut previous = [skip.min; LANES];
+        for k in 0..BLOCK_LEN / LANES {
+            let bit = k * width;
+            let (w, shift) = (bit / 32, bit % 32);
+            let mut lanes = [0u32; LANES];
+            if width > 0 {
+                for l in 0..LANES {
+                    lanes[l] = words[w * LANES + l] >> shift;
+                }
+                if shift + width > 32 {
+                    for l in 0..LANES {
+                        lanes[l] |= words[(w + 1) * LANES + l] << (32 - shift);
+                    }
+                }
+            }
+            for l in 0..LANES {
+                previous[l] = previous[l].wrapping_add(lanes[l] & mask);
+                out[k * LANES + l] = previous[l];
+            }
+        }
+
+        skip.len()
+    }
+
+    /// The skip table, one entry per block.
+    #[inline(always)]
+    pub fn skips(&self) -> &[Skip] {
+        &self.skips
+    }
+
+    /// The number of values in the set.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// The compressed size in bytes.
+    pub fn size_in_bytes(&self) -> usize {
+        self.skips.len() * std::mem::size_of::<Skip>() + self.words.len() * 4
+    }
+
+    pub fn to_vec(&self) -> Vec<u32> {
+        let mut vec = Vec::with_capacity(self.len);
+        let mut block = [0; BLOCK_LEN];
+        for b in 0..self.skips.len() {
+            let len = self.decode_block(b, &mut block);
+            vec.extend_from_slice(&block[..len]);
+        }
+
+        vec
+    }
+}
+
+impl From<&[u32]> for CompressedSet {
+    fn from(values: &[u32]) -> Self {
+        Self::from_sorted(values)
+    }
+}
+
+/// Returns the number of values in the intersection, the values are appended to `results`.
+/// Only pairs of blocks whose [min, max] ranges overlap are decoded.
+pub fn intersect_compressed(
+    aaa: &CompressedSet,
+    bbb: &CompressedSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let (skips_a, skips_b) = (aaa.skips(), bbb.skips());
+    let (mut block_a, mut block_b) = ([0; BLOCK_LEN], [0; BLOCK_LEN]);
+    // the blocks now in the buffers, and their lengths
+    let (mut decoded_a, mut decoded_b) = (usize::MAX, usize::MAX);
+    let (mut len_a, mut len_b) = (0, 0);
+
+    let mut count = 0;
+    let (mut i, mut j) = (0, 0);
+    while i < skips_a.len() && j < skips_b.len() {
+        let (a, b) = (skips_a[i], skips_b[j]);
+        if a.max < b.min {
+            i += 1;
+        } else if b.max < a.min {
+            j += 1;
+        } else {
+            if decoded_a != i {
+                len_a = aaa.decode_block(i, &mut block_a);
+                decoded_a = i;
+            }
+            if decoded_b != j {
+                len_b = bbb.decode_block(j, &mut block_b);
+                decoded_b = j;
+            }
+            count += intersect(&block_a[..len_a], &block_b[..len_b], results.as_deref_mut());
+
+            if a.max <= b.max {
+                i += 1;
+            }
+            if b.max <= a.max {
+                j += 1;
+            }
+        }
+    }
+
+    count
+}
+
+/// [`intersect_compressed`] of a flat sorted set and a compressed one. Each candidate block is
+/// met by the run of `flat` within its [min, max] range.
+pub fn intersect_flat_compressed(
+    mut flat: &[u32],
+    set: &CompressedSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let mut block = [0; BLOCK_LEN];
+    let mut count = 0;
+    for (b, skip) in set.skips().iter().enumerate() {
+        flat = &flat[flat.partition_point(|&v| v < skip.min)..];
+        let end = flat.partition_point(|&v| v <= skip.max);
+        if flat.is_empty() {
+            break;
+        }
+        if end == 0 {
+            continue;
+        }
+
+        let len = set.decode_block(b, &mut block);
+        count += intersect(&flat[..end], &block[..len], results.as_deref_mut());
+        flat = &flat[end..];
+    }
+
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_compressed_set() {
+        // dense, sparse, and full-width runs, and a short last block
+        let mut values: Vec<u32> = (0..300).collect();
+        values.extend((0..500).map(|i| 1000 + i * 37));
+        values.extend([1 << 30, u32::MAX - 1, u32::MAX]);
+        values.extend((0..50).map(|_| u32::MAX));
+        let set = CompressedSet::from_sorted(&values);
+        values.dedup();
+        assert_eq!(set.len(), values.len());
+        assert_eq!(set.to_vec(), values);
+        assert_eq!(set.skips().len(), values.len().div_ceil(BLOCK_LEN));
+        assert!(set.size_in_bytes() < values.len() * 4);
+
+        let x: Vec<u32> = (0..20_000).map(|i| i * 3).collect();
+        let y: Vec<u32> = (0..2_000)
+            .map(|i| i * 5)
+            .chain((0..2_000).map(|i| 40_000 + i * 2))
+            .collect();
+        let (cx, cy) = (
+            CompressedSet::from_sorted(&x),
+            CompressedSet::from_sorted(&y),
+        );
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+        let mut result = Vec::new();
+        assert_eq!(
+            intersect_compressed(&cx, &cy, Some(&mut result)),
+            expected.len()
+        );
+        assert_eq!(result, expected);
+        assert_eq!(intersect_compressed(&cy, &cx, None), expected.len());
+        let mut result = Vec::new();
+        assert_eq!(
+            intersect_flat_compressed(&y, &cx, Some(&mut result)),
+            expected.len()
+        );
+        assert_eq!(result, expected);
+        assert_eq!(intersect_flat_compressed(&x, &cy, None), expected.len());
+    }
+}
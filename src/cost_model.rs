@@ -0,0 +1,527 @@
+//! A measured replacement for the `GALLOP_OVERHEAD` rule in [`intersect`](crate::intersect::intersect).
+//!
+//! [`calibrate`] times every available kernel over a grid of (|A|, |B| / |A|, selectivity) on the
+//! host and keeps the fastest kernel per size bucket. The table is saved as plain text, one
+//! `size_bucket ratio_bucket kernel` line per measured cell, and loaded at startup from the file
+//! named by the `INTERSECTION_COST_MODEL` env var. Buckets are `log2` of the smaller size and of
+//! the size ratio, cells that were not measured take the kernel of the nearest measured one. With
+//! `simd`, the table also records the ISA level it was measured at, and a table from another
+//! level is not loaded.
+use std::env;
+use std::fmt;
+use std::fs;
+use std::io;
+use std::mem::MaybeUninit;
+use std::path::Path;
+use std::str::FromStr;
+use std::time::{Duration, Instant};
+
+use crate::intersect::{
+    intersect_scalar_gallop, intersect_scalar_gallop_into, intersect_scalar_merge,
+    intersect_scalar_merge_into,
+};
+use crate::perf::measure;
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{
+    intersect_simd_gallop, intersect_simd_gallop_into, intersect_simd_qfilter,
+    intersect_simd_qfilter_b16, intersect_simd_qfilter_b16_into, intersect_simd_qfilter_b8,
+    intersect_simd_qfilter_b8_into, intersect_simd_qfilter_into, intersect_simd_shuffle,
+    intersect_simd_shuffle_b8, intersect_simd_shuffle_b8_into, intersect_simd_shuffle_into,
+    intersect_simd_shuffle_vec256, intersect_simd_shuffle_vec256_into,
+};
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{isa_level, IsaLevel};
+
+#[cfg(all(feature = "simd_new", not(feature = "simd")))]
+use crate::simd_intersection_new::{
+    intersect_simd_gallop, intersect_simd_gallop_into, intersect_simd_qfilter,
+    intersect_simd_qfilter_into,
+};
+
+pub(crate) const SIZE_BUCKETS: usize = usize::BITS as usize;
+pub(crate) const RATIO_BUCKETS: usize = 24;
+
+lazy_static! {
+    /// The table named by `INTERSECTION_COST_MODEL`, if any.
+    pub static ref COST_MODEL: Option<CostModel> = env::var("INTERSECTION_COST_MODEL").ok().map(|path| {
+        CostModel::load(&path).unwrap_or_else(|e| panic!("INTERSECTION_COST_MODEL {}: {}", path, e))
+    });
+}
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum Kernel {
+    ScalarMerge,
+    ScalarGallop,
+    #[cfg(any(feature = "simd", feature = "simd_new"))]
+    SimdGallop,
+    #[cfg(any(feature = "simd", feature = "simd_new"))]
+    QFilter,
+    #[cfg(feature = "simd")]
+    QFilterB8,
+    #[cfg(feature = "simd")]
+    QFilterB16,
+    #[cfg(feature = "simd")]
+    Shuffle,
+    #[cfg(feature = "simd")]
+    ShuffleB8,
+    #[cfg(feature = "simd")]
+    ShuffleVec256,
+}
+
+impl Kernel {
+    /// Every kernel compiled into this build.
+    pub const ALL: &'static [Kernel] = &[
+        Kernel::ScalarMerge,
+        Kernel::ScalarGallop,
+        #[cfg(any(feature = "simd", feature = "simd_new"))]
+        Kernel::SimdGallop,
+        #[cfg(any(feature = "simd", feature = "simd_new"))]
+        Kernel::QFilter,
+        #[cfg(feature = "simd")]
+        Kernel::QFilterB8,
+        #[cfg(feature = "simd")]
+        Kernel::QFilterB16,
+        #[cfg(feature = "simd")]
+        Kernel::Shuffle,
+        #[cfg(feature = "simd")]
+        Kernel::ShuffleB8,
+        #[cfg(feature = "simd")]
+        Kernel::ShuffleVec256,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Kernel::ScalarMerge => "scalar_merge",
+            Kernel::ScalarGallop => "scalar_gallop",
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::SimdGallop => "simd_gallop",
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::QFilter => "qfilter",
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB8 => "qfilter_b8",
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB16 => "qfilter_b16",
+            #[cfg(feature = "simd")]
+            Kernel::Shuffle => "shuffle",
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleB8 => "shuffle_b8",
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleVec256 => "shuffle_vec256",
+        }
+    }
+
+    #[inline(always)]
+    pub fn run(self, aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+        match self {
+            Kernel::ScalarMerge => measure("scalar_merge", aaa.len() + bbb.len(), || {
+                intersect_scalar_merge(aaa, bbb, results)
+            }),
+            Kernel::ScalarGallop => measure("scalar_gallop", aaa.len() + bbb.len(), || {
+                intersect_scalar_gallop(aaa, bbb, results)
+            }),
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::SimdGallop => intersect_simd_gallop(aaa, bbb, results),
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::QFilter => intersect_simd_qfilter(aaa, bbb, results),
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB8 => intersect_simd_qfilter_b8(aaa, bbb, results),
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB16 => intersect_simd_qfilter_b16(aaa, bbb, results),
+            #[cfg(feature = "simd")]
+            Kernel::Shuffle => intersect_simd_shuffle(aaa, bbb, results),
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleB8 => intersect_simd_shuffle_b8(aaa, bbb, results),
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleVec256 => intersect_simd_shuffle_vec256(aaa, bbb, results),
+        }
+    }
+
+    /// [`run`](Kernel::run) into `out`, see [`intersect_into`](crate::intersect::intersect_into).
+    #[inline(always)]
+    pub fn run_into(self, aaa: &[u32], bbb: &[u32], out: &mut [MaybeUninit<u32>]) -> usize {
+        match self {
+            Kernel::ScalarMerge => measure("scalar_merge", aaa.len() + bbb.len(), || {
+                intersect_scalar_merge_into(aaa, bbb, out)
+            }),
+            Kernel::ScalarGallop => measure("scalar_gallop", aaa.len() + bbb.len(), || {
+                intersect_scalar_gallop_into(aaa, bbb, out)
+            }),
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::SimdGallop => intersect_simd_gallop_into(aaa, bbb, out),
+            #[cfg(any(feature = "simd", feature = "simd_new"))]
+            Kernel::QFilter => intersect_simd_qfilter_into(aaa, bbb, out),
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB8 => intersect_simd_qfilter_b8_into(aaa, bbb, out),
+            #[cfg(feature = "simd")]
+            Kernel::QFilterB16 => intersect_simd_qfilter_b16_into(aaa, bbb, out),
+            #[cfg(feature = "simd")]
+            Kernel::Shuffle => intersect_simd_shuffle_into(aaa, bbb, out),
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleB8 => intersect_simd_shuffle_b8_into(aaa, bbb, out),
+            #[cfg(feature = "simd")]
+            Kernel::ShuffleVec256 => intersect_simd_shuffle_vec256_into(aaa, bbb, out),
+        }
+    }
+}
+
+impl fmt::Display for Kernel {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str(self.name())
+    }
+}
+
+impl FromStr for Kernel {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        Kernel::ALL
+            .iter()
+            .copied()
+            .find(|k| k.name() == s)
+            .ok_or_else(|| format!("unknown kernel {:?}", s))
+    }
+}
+
+#[inline(always)]
+fn log2_bucket(n: usize) -> usize {
+    (usize::BITS - 1 - n.max(1).leading_zeros()) as usize
+}
+
+/// The (size, ratio) bucket of a pair with `small <= large`.
+#[inline(always)]
+pub(crate) fn buckets(small: usize, large: usize) -> (usize, usize) {
+    (
+        log2_bucket(small),
+        log2_bucket(large / small.max(1)).min(RATIO_BUCKETS - 1),
+    )
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct CostModel {
+    measured: Vec<(usize, usize, Kernel)>,
+    table: Vec<Kernel>,
+    /// The level the kernels were timed at, if known.
+    #[cfg(feature = "simd")]
+    isa: Option<IsaLevel>,
+}
+
+impl CostModel {
+    /// Builds the lookup table from the measured `(size_bucket, ratio_bucket, kernel)` cells.
+    pub fn new(mut measured: Vec<(usize, usize, Kernel)>) -> Self {
+        measured.retain(|&(s, r, _)| s < SIZE_BUCKETS && r < RATIO_BUCKETS);
+        measured.sort_unstable_by_key(|&(s, r, _)| (s, r));
+        measured.dedup_by_key(|&mut (s, r, _)| (s, r));
+
+        let mut table = vec![Kernel::ScalarMerge; SIZE_BUCKETS * RATIO_BUCKETS];
+        if !measured.is_empty() {
+            for s in 0..SIZE_BUCKETS {
+                for r in 0..RATIO_BUCKETS {
+                    let &(_, _, kernel) = measured
+                        .iter()
+                        .min_by_key(|&&(ms, mr, _)| ms.abs_diff(s) + mr.abs_diff(r))
+                        .unwrap();
+                    table[s * RATIO_BUCKETS + r] = kernel;
+                }
+            }
+        }
+
+        Self {
+            measured,
+            table,
+            #[cfg(feature = "simd")]
+            isa: None,
+        }
+    }
+
+    /// The model measured at `isa`.
+    #[cfg(feature = "simd")]
+    pub fn with_isa(self, isa: IsaLevel) -> Self {
+        Self {
+            isa: Some(isa),
+            ..self
+        }
+    }
+
+    #[cfg(feature = "simd")]
+    pub fn isa(&self) -> Option<IsaLevel> {
+        self.isa
+    }
+
+    /// Whether the kernels were timed at the current ISA level, or at an unknown one.
+    pub fn fits_isa_level(&self) -> bool {
+        #[cfg(feature = "simd")]
+        {
+            self.isa.map_or(true, |isa| isa == isa_level())
+        }
+        #[cfg(not(feature = "simd"))]
+        {
+            true
+        }
+    }
+
+    /// The fastest kernel for sets of `len_a` and `len_b` values, with `len_a <= len_b`.
+    #[inline(always)]
+    pub fn kernel(&self, len_a: usize, len_b: usize) -> Kernel {
+        let (s, r) = buckets(len_a, len_b);
+        self.table[s * RATIO_BUCKETS + r]
+    }
+
+    pub fn measured(&self) -> &[(usize, usize, Kernel)] {
+        &self.measured
+    }
+
+    /// Reads a saved table, which must fit the current ISA level.
+    pub fn load<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        let model: Self = fs::read_to_string(path)?
+            .parse()
+            .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+        #[cfg(feature = "simd")]
+        if !model.fits_isa_level() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                format!(
+                    "calibrated at isa {:?}, the host runs at {:?}",
+                    model.isa.unwrap(),
+                    isa_level()
+                ),
+            ));
+        }
+
+        Ok(model)
+    }
+
+    pub fn save<P: AsRef<Path>>(&self, path: P) -> io::Result<()> {
+        fs::write(path, self.to_string())
+    }
+}
+
+impl fmt::Display for CostModel {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        #[cfg(feature = "simd")]
+        if let Some(isa) = self.isa {
+            writeln!(f, "# isa {:?}", isa)?;
+        }
+        writeln!(f, "# size_bucket ratio_bucket kernel")?;
+        for &(s, r, kernel) in &self.measured {
+            writeln!(f, "{} {} {}", s, r, kernel)?;
+        }
+
+        Ok(())
+    }
+}
+
+impl FromStr for CostModel {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let mut measured = Vec::new();
+        #[cfg(feature = "simd")]
+        let mut isa = None;
+        for (no, line) in s.lines().enumerate() {
+            let line = line.trim();
+            #[cfg(feature = "simd")]
+            if let Some(name) = line.strip_prefix("# isa ") {
+                let level = IsaLevel::ALL
+                    .into_iter()
+                    .find(|level| format!("{:?}", level) == name.trim());
+                isa = Some(level.ok_or_else(|| format!("line {}: {:?}", no + 1, line))?);
+                continue;
+            }
+            if line.is_empty() || line.starts_with('#') {
+                continue;
+            }
+
+            let fields: Vec<&str> = line.split_whitespace().collect();
+            let cell = match fields[..] {
+                [s, r, kernel] => s
+                    .parse()
+                    .ok()
+                    .zip(r.parse().ok())
+                    .and_then(|(s, r)| kernel.parse().ok().map(|k| (s, r, k))),
+                _ => None,
+            };
+            measured.push(cell.ok_or_else(|| format!("line {}: {:?}", no + 1, line))?);
+        }
+
+        let model = Self::new(measured);
+        #[cfg(feature = "simd")]
+        if let Some(isa) = isa {
+            return Ok(model.with_isa(isa));
+        }
+
+        Ok(model)
+    }
+}
+
+/// The grid [`calibrate`] measures, each |B| is `size * ratio`.
+#[derive(Clone, Debug)]
+pub struct CalibrationGrid {
+    pub sizes: Vec<usize>,
+    pub ratios: Vec<usize>,
+    /// The share of A that is also in B.
+    pub selectivities: Vec<f64>,
+    /// The time spent on each kernel per cell and selectivity.
+    pub budget: Duration,
+    pub max_len: usize,
+}
+
+impl Default for CalibrationGrid {
+    fn default() -> Self {
+        Self {
+            sizes: (0..=14).step_by(2).map(|k| 1 << k).collect(),
+            ratios: (0..=10).map(|k| 1 << k).collect(),
+            selectivities: vec![0.01, 0.1, 0.5, 0.9],
+            budget: Duration::from_millis(2),
+            max_len: 1 << 22,
+        }
+    }
+}
+
+/// Approximately `len_b` even values for B, and `len_a` values for A of which `selectivity` are
+/// drawn from B and the rest are odd.
+fn calibration_sets(
+    len_a: usize,
+    len_b: usize,
+    selectivity: f64,
+    seed: u64,
+) -> (Vec<u32>, Vec<u32>) {
+    let mut state = seed | 1;
+    let mut coin = |p: f64| {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        (state >> 11) as f64 / (1u64 << 53) as f64 <= p
+    };
+
+    let universe = 2 * len_b as u32;
+    let bbb: Vec<u32> = (0..universe).filter(|_| coin(0.5)).map(|v| 2 * v).collect();
+    let p_hit = selectivity * len_a as f64 / bbb.len().max(1) as f64;
+    let p_miss = (1.0 - selectivity) * len_a as f64 / universe as f64;
+    let mut aaa: Vec<u32> = bbb.iter().copied().filter(|_| coin(p_hit)).collect();
+    aaa.extend((0..universe).filter(|_| coin(p_miss)).map(|v| 2 * v + 1));
+    aaa.sort_unstable();
+
+    (aaa, bbb)
+}
+
+/// The mean time of one call, after running `kernel` for about `budget`.
+fn time_kernel(
+    kernel: Kernel,
+    aaa: &[u32],
+    bbb: &[u32],
+    results: &mut Vec<u32>,
+    budget: Duration,
+) -> f64 {
+    let start = Instant::now();
+    let mut runs = 0u32;
+    loop {
+        results.clear();
+        kernel.run(aaa, bbb, Some(results));
+        runs += 1;
+
+        let elapsed = start.elapsed();
+        if elapsed >= budget {
+            return elapsed.as_secs_f64() / runs as f64;
+        }
+    }
+}
+
+/// Times every kernel in [`Kernel::ALL`] over `grid` at the current ISA level.
+pub fn calibrate(grid: &CalibrationGrid) -> CostModel {
+    let mut measured = Vec::new();
+    let mut results = Vec::new();
+
+    for &size in &grid.sizes {
+        for &ratio in &grid.ratios {
+            let len_b = size * ratio;
+            if len_b > grid.max_len {
+                continue;
+            }
+
+            let mut costs = vec![0.0; Kernel::ALL.len()];
+            for (seed, &selectivity) in grid.selectivities.iter().enumerate() {
+                let (aaa, bbb) = calibration_sets(size, len_b, selectivity, seed as u64 + 1);
+                for (cost, &kernel) in costs.iter_mut().zip(Kernel::ALL) {
+                    *cost += time_kernel(kernel, &aaa, &bbb, &mut results, grid.budget);
+                }
+            }
+
+            let (_, &fastest) = costs
+                .iter()
+                .zip(Kernel::ALL)
+                .min_by(|(x, _), (y, _)| x.total_cmp(y))
+                .unwrap();
+            let (s, r) = buckets(size, len_b);
+            measured.push((s, r, fastest));
+        }
+    }
+
+    let model = CostModel::new(measured);
+    #[cfg(feature = "simd")]
+    let model = model.with_isa(isa_level());
+
+    model
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cost_model() {
+        let text = "# size_bucket ratio_bucket kernel\n0 0 scalar_merge\n8 4 scalar_gallop\n";
+        let model: CostModel = text.parse().unwrap();
+        assert_eq!(model.kernel(1, 1), Kernel::ScalarMerge);
+        assert_eq!(model.kernel(300, 300 * 20), Kernel::ScalarGallop);
+        assert_eq!(model.kernel(1 << 20, 1 << 30), Kernel::ScalarGallop);
+        assert_eq!(model.to_string().parse::<CostModel>().unwrap(), model);
+        assert!("0 0 no_such_kernel".parse::<CostModel>().is_err());
+
+        let grid = CalibrationGrid {
+            sizes: vec![1, 64],
+            ratios: vec![1, 32],
+            selectivities: vec![0.5],
+            budget: Duration::from_micros(50),
+            max_len: 1 << 12,
+        };
+        let model = calibrate(&grid);
+        assert_eq!(model.measured().len(), 4);
+
+        let (aaa, bbb) = calibration_sets(64, 64 * 32, 0.5, 1);
+        let expected = intersect_scalar_merge(&aaa, &bbb, None);
+        assert!(expected > 0);
+        assert_eq!(
+            model.kernel(aaa.len(), bbb.len()).run(&aaa, &bbb, None),
+            expected
+        );
+    }
+
+    #[cfg(feature = "simd")]
+    #[test]
+    fn test_cost_model_isa() {
+        use crate::simd_intersection::{lock_isa_level, set_isa_level, supported_isa_levels};
+
+        let _isa = lock_isa_level();
+        let model: CostModel = "# isa Avx512\n0 0 scalar_merge\n".parse().unwrap();
+        assert_eq!(model.isa(), Some(IsaLevel::Avx512));
+        assert_eq!(model.to_string().parse::<CostModel>().unwrap(), model);
+        assert_eq!("0 0 scalar_merge".parse::<CostModel>().unwrap().isa(), None);
+        assert!("# isa Avx9000\n".parse::<CostModel>().is_err());
+
+        let path = env::temp_dir().join(format!("cost_model_{}.txt", std::process::id()));
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            let other = IsaLevel::ALL.into_iter().find(|&l| l != level).unwrap();
+            model.clone().with_isa(level).save(&path).unwrap();
+            assert_eq!(CostModel::load(&path).unwrap().isa(), Some(level));
+            model.clone().with_isa(other).save(&path).unwrap();
+            let loaded: CostModel = fs::read_to_string(&path).unwrap().parse().unwrap();
+            assert_eq!(loaded.isa(), Some(other));
+            assert!(!loaded.fits_isa_level());
+            assert!(CostModel::load(&path).is_err());
+        }
+        fs::remove_file(&path).unwrap();
+    }
+}
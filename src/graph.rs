@@ -0,0 +1,579 @@
+//! Graphs in a binary CSR file, mapped into memory as is, and the mining drivers built on
+//! [`intersect`].
+//!
+//! The file is a 32-byte header (`ICSRv1\0\0`, flags, vertices, adjacency entries, as
+//! little-endian `u64`), then `n + 1` offsets as `u64`, then the neighbors as `u32`, each list
+//! sorted. A graph is either symmetric or oriented: each edge kept once, from the lower to the
+//! higher of its ends by (degree, id), which keeps every out-degree small on skewed graphs. Clique
+//! counting and listing walk the oriented graph, intersecting the candidates of each level with
+//! one more out-neighborhood, so every clique is found once, from its lowest vertex.
+use std::fs::File;
+use std::io::{self, BufRead, BufWriter, Write};
+use std::path::Path;
+use std::slice;
+use std::sync::atomic::{AtomicU64, Ordering};
+
+use crate::intersect::intersect;
+use crate::parallel::{for_each_stealing, num_threads};
+use crate::prepared::{intersect_prepared, PreparedSet};
+
+const MAGIC: [u8; 8] = *b"ICSRv1\0\0";
+const HEADER: usize = 32;
+/// Vertex ids were relabeled in ascending order of degree.
+const DEGREE_ORDERED: u64 = 1;
+/// Each edge is kept once, towards the higher end.
+const ORIENTED: u64 = 2;
+
+/// Vertices per task of the drivers.
+const TASK_VERTICES: usize = 256;
+/// The candidates from which a level prepares them once, for the neighborhoods it meets them with.
+const PREPARED_CANDIDATES: usize = 256;
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+/// A read-only private mapping of a whole file.
+#[cfg(unix)]
+struct Mmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+#[cfg(unix)]
+unsafe impl Send for Mmap {}
+#[cfg(unix)]
+unsafe impl Sync for Mmap {}
+
+#[cfg(unix)]
+impl Mmap {
+    fn open(file: &File) -> io::Result<Self> {
+        use std::os::unix::io::AsRawFd;
+
+        let len = file.metadata()?.len() as usize;
+        if len < HEADER {
+            return Err(invalid("truncated header"));
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(Self { ptr, len })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+#[cfg(unix)]
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr, self.len);
+        }
+    }
+}
+
+enum Storage {
+    Owned {
+        offsets: Vec<u64>,
+        neighbors: Vec<u32>,
+    },
+    #[cfg(unix)]
+    Mapped(Mmap),
+}
+
+pub struct CsrGraph {
+    storage: Storage,
+    flags: u64,
+    num_vertices: usize,
+    num_entries: usize,
+}
+
+impl CsrGraph {
+    fn from_parts(offsets: Vec<u64>, neighbors: Vec<u32>, flags: u64) -> Self {
+        Self {
+            num_vertices: offsets.len() - 1,
+            num_entries: neighbors.len(),
+            storage: Storage::Owned { offsets, neighbors },
+            flags,
+        }
+    }
+
+    /// The symmetric graph of `edges`, without self-loops or parallel edges, on vertices
+    /// `0..num_vertices`.
+    pub fn from_edges(num_vertices: usize, edges: &[(u32, u32)]) -> Self {
+        let mut entries: Vec<(u32, u32)> = edges
+            .iter()
+            .filter(|&&(u, v)| u != v)
+            .flat_map(|&(u, v)| [(u, v), (v, u)])
+            .collect();
+        entries.sort_unstable();
+        entries.dedup();
+        assert!(entries
+            .last()
+            .map_or(true, |&(u, _)| (u as usize) < num_vertices));
+
+        let mut offsets = vec![0u64; num_vertices + 1];
+        for &(u, _) in &entries {
+            offsets[u as usize + 1] += 1;
+        }
+        for v in 0..num_vertices {
+            offsets[v + 1] += offsets[v];
+        }
+        let neighbors = entries.into_iter().map(|(_, v)| v).collect();
+
+        Self::from_parts(offsets, neighbors, 0)
+    }
+
+    /// Reads whitespace-separated `u v` pairs, one per line, skipping `#` and `%` comments.
+    pub fn from_edge_list<R: BufRead>(reader: R) -> io::Result<Self> {
+        let mut edges = Vec::new();
+        let mut num_vertices = 0;
+        for line in reader.lines() {
+            let line = line?;
+            let line = line.trim();
+            if line.is_empty() || line.starts_with('#') || line.starts_with('%') {
+                continue;
+            }
+
+            let mut ids = line.split_whitespace().map(|id| id.parse::<u32>());
+            match (ids.next(), ids.next()) {
+                (Some(Ok(u)), Some(Ok(v))) => {
+                    num_vertices = num_vertices.max(u.max(v) as usize + 1);
+                    edges.push((u, v));
+                }
+                _ => return Err(invalid(&format!("not an edge: {:?}", line))),
+            }
+        }
+
+        Ok(Self::from_edges(num_vertices, &edges))
+    }
+
+    /// The same graph with vertices relabeled in ascending order of degree, ties by id.
+    pub fn degree_ordered(&self) -> Self {
+        assert!(!self.is_oriented());
+        let mut order: Vec<u32> = (0..self.num_vertices as u32).collect();
+        order.sort_by_key(|&v| self.degree(v));
+        let mut rank = vec![0u32; self.num_vertices];
+        for (r, &v) in order.iter().enumerate() {
+            rank[v as usize] = r as u32;
+        }
+
+        let edges: Vec<(u32, u32)> = (0..self.num_vertices as u32)
+            .flat_map(|u| self.neighbors_of(u).iter().map(move |&v| (u, v)))
+            .filter(|&(u, v)| u < v)
+            .map(|(u, v)| (rank[u as usize], rank[v as usize]))
+            .collect();
+        let mut graph = Self::from_edges(self.num_vertices, &edges);
+        graph.flags |= DEGREE_ORDERED;
+
+        graph
+    }
+
+    /// Each edge kept once, from the lower to the higher end by (degree, id).
+    pub fn oriented(&self) -> Self {
+        if self.is_oriented() {
+            let (offsets, neighbors) = (self.offsets().to_vec(), self.neighbors().to_vec());
+            return Self::from_parts(offsets, neighbors, self.flags);
+        }
+
+        let key = |v: u32| (self.degree(v), v);
+        let mut offsets = Vec::with_capacity(self.num_vertices + 1);
+        let mut neighbors = Vec::with_capacity(self.num_entries / 2);
+        offsets.push(0);
+        for u in 0..self.num_vertices as u32 {
+            neighbors.extend(self.neighbors_of(u).iter().filter(|&&v| key(v) > key(u)));
+            offsets.push(neighbors.len() as u64);
+        }
+
+        Self::from_parts(offsets, neighbors, self.flags | ORIENTED)
+    }
+
+    /// Maps the file at `path`. The offsets and neighbors are checked once, then read in place.
+    pub fn open<P: AsRef<Path>>(path: P) -> io::Result<Self> {
+        if cfg!(target_endian = "big") {
+            return Err(io::Error::new(
+                io::ErrorKind::Unsupported,
+                "CSR files are little-endian",
+            ));
+        }
+
+        let file = File::open(path)?;
+        #[cfg(unix)]
+        let (storage, header) = {
+            let map = Mmap::open(&file)?;
+            let header = parse_header(map.bytes())?;
+            (Storage::Mapped(map), header)
+        };
+        #[cfg(not(unix))]
+        let (storage, header) = {
+            use std::io::Read;
+
+            let mut bytes = Vec::new();
+            (&file).read_to_end(&mut bytes)?;
+            let header @ (_, n, _) = parse_header(&bytes)?;
+            let (offsets, neighbors) = bytes[HEADER..].split_at(8 * (n + 1));
+            let offsets = offsets
+                .chunks_exact(8)
+                .map(|w| u64::from_le_bytes(w.try_into().unwrap()))
+                .collect();
+            let neighbors = neighbors
+                .chunks_exact(4)
+                .map(|w| u32::from_le_bytes(w.try_into().unwrap()))
+                .collect();
+            (Storage::Owned { offsets, neighbors }, header)
+        };
+
+        let (flags, num_vertices, num_entries) = header;
+        let graph = Self {
+            storage,
+            flags,
+            num_vertices,
+            num_entries,
+        };
+        graph.validate()?;
+
+        Ok(graph)
+    }
+
+    fn validate(&self) -> io::Result<()> {
+        let offsets = self.offsets();
+        if offsets[0] != 0 || offsets[self.num_vertices] != self.num_entries as u64 {
+            return Err(invalid("offsets do not span the neighbors"));
+        }
+        if offsets.windows(2).any(|w| w[0] > w[1]) {
+            return Err(invalid("offsets are not ascending"));
+        }
+        for v in 0..self.num_vertices as u32 {
+            let list = self.neighbors_of(v);
+            if list.windows(2).any(|w| w[0] >= w[1]) {
+                return Err(invalid("a neighbor list is not sorted"));
+            }
+            if list
+                .last()
+                .map_or(false, |&w| w as usize >= self.num_vertices)
+            {
+                return Err(invalid("a neighbor is out of range"));
+            }
+        }
+
+        Ok(())
+    }
+
+    pub fn write<W: Write>(&self, writer: W) -> io::Result<()> {
+        let mut writer = BufWriter::new(writer);
+        writer.write_all(&MAGIC)?;
+        for word in [
+            self.flags,
+            self.num_vertices as u64,
+            self.num_entries as u64,
+        ] {
+            writer.write_all(&word.to_le_bytes())?;
+        }
+        for &offset in self.offsets() {
+            writer.write_all(&offset.to_le_bytes())?;
+        }
+        for &v in self.neighbors() {
+            writer.write_all(&v.to_le_bytes())?;
+        }
+
+        writer.flush()
+    }
+
+    pub fn save<P: AsRef<Path>>(&self, path: P) -> io::Result<()> {
+        self.write(File::create(path)?)
+    }
+
+    #[inline(always)]
+    pub fn offsets(&self) -> &[u64] {
+        match &self.storage {
+            Storage::Owned { offsets, .. } => offsets,
+            #[cfg(unix)]
+            Storage::Mapped(map) => unsafe {
+                slice::from_raw_parts(
+                    map.bytes()[HEADER..].as_ptr() as *const u64,
+                    self.num_vertices + 1,
+                )
+            },
+        }
+    }
+
+    #[inline(always)]
+    pub fn neighbors(&self) -> &[u32] {
+        match &self.storage {
+            Storage::Owned { neighbors, .. } => neighbors,
+            #[cfg(unix)]
+            Storage::Mapped(map) => unsafe {
+                slice::from_raw_parts(
+                    map.bytes()[HEADER + 8 * (self.num_vertices + 1)..].as_ptr() as *const u32,
+                    self.num_entries,
+                )
+            },
+        }
+    }
+
+    /// The sorted neighbors of `v`, only the higher ones if the graph is oriented.
+    #[inline(always)]
+    pub fn neighbors_of(&self, v: u32) -> &[u32] {
+        let offsets = self.offsets();
+        &self.neighbors()[offsets[v as usize] as usize..offsets[v as usize + 1] as usize]
+    }
+
+    #[inline(always)]
+    pub fn degree(&self, v: u32) -> usize {
+        self.neighbors_of(v).len()
+    }
+
+    pub fn num_vertices(&self) -> usize {
+        self.num_vertices
+    }
+
+    /// The number of edges, each counted once.
+    pub fn num_edges(&self) -> usize {
+        if self.is_oriented() {
+            self.num_entries
+        } else {
+            self.num_entries / 2
+        }
+    }
+
+    pub fn is_degree_ordered(&self) -> bool {
+        self.flags & DEGREE_ORDERED != 0
+    }
+
+    pub fn is_oriented(&self) -> bool {
+        self.flags & ORIENTED != 0
+    }
+
+    pub fn is_mapped(&self) -> bool {
+        !matches!(self.storage, Storage::Owned { .. })
+    }
+}
+
+/// The flags, vertex count and entry count of a file, checked against its length.
+fn parse_header(bytes: &[u8]) -> io::Result<(u64, usize, usize)> {
+    if bytes.len() < HEADER || bytes[..8] != MAGIC {
+        return Err(invalid("not a CSR graph file"));
+    }
+    let word = |i: usize| u64::from_le_bytes(bytes[8 * i..8 * i + 8].try_into().unwrap());
+    let (flags, n, m) = (word(1), word(2) as usize, word(3) as usize);
+    if n >= u32::MAX as usize {
+        return Err(invalid("too many vertices"));
+    }
+    let len = n
+        .checked_add(1)
+        .and_then(|n| n.checked_mul(8))
+        .and_then(|size| m.checked_mul(4).and_then(|m| size.checked_add(m)))
+        .and_then(|size| size.checked_add(HEADER));
+    if len != Some(bytes.len()) {
+        return Err(invalid("the file length does not match the header"));
+    }
+
+    Ok((flags, n, m))
+}
+
+/// The candidates of a level and, when there are enough of them, their [`PreparedSet`].
+struct Candidates<'a> {
+    values: &'a [u32],
+    prepared: Option<PreparedSet<'a>>,
+}
+
+impl<'a> Candidates<'a> {
+    fn new(values: &'a [u32]) -> Self {
+        let prepared = (values.len() >= PREPARED_CANDIDATES).then(|| PreparedSet::new(values));
+
+        Self { values, prepared }
+    }
+
+    /// The candidates adjacent to `v`.
+    #[inline(always)]
+    fn meet(&self, dag: &CsrGraph, v: u32, results: Option<&mut Vec<u32>>) -> usize {
+        match &self.prepared {
+            Some(prepared) => intersect_prepared(dag.neighbors_of(v), prepared, results),
+            None => intersect(self.values, dag.neighbors_of(v), results),
+        }
+    }
+}
+
+/// Counts the cliques that extend the current one by `left` more vertices, drawn from the
+/// candidates `cand`, each of which is adjacent to all of the current clique.
+fn count_from(dag: &CsrGraph, cand: &[u32], left: usize, buffers: &mut [Vec<u32>]) -> u64 {
+    match left {
+        0 => 1,
+        1 => cand.len() as u64,
+        2 => {
+            let candidates = Candidates::new(cand);
+            cand.iter()
+                .map(|&v| candidates.meet(dag, v, None) as u64)
+                .sum()
+        }
+        _ => {
+            let (next, rest) = buffers.split_first_mut().unwrap();
+            let candidates = Candidates::new(cand);
+            let mut count = 0;
+            for &v in cand {
+                next.clear();
+                if candidates.meet(dag, v, Some(next)) >= left - 1 {
+                    count += count_from(dag, next, left - 1, rest);
+                }
+            }
+
+            count
+        }
+    }
+}
+
+fn list_from<F: Fn(&[u32])>(
+    dag: &CsrGraph,
+    cand: &[u32],
+    clique: &mut Vec<u32>,
+    left: usize,
+    buffers: &mut [Vec<u32>],
+    f: &F,
+) {
+    if left == 0 {
+        f(clique);
+        return;
+    }
+
+    let (next, rest) = buffers.split_first_mut().unwrap();
+    let candidates = Candidates::new(if left > 1 { cand } else { &[] });
+    for &v in cand {
+        clique.push(v);
+        next.clear();
+        if left == 1 || candidates.meet(dag, v, Some(next)) >= left - 1 {
+            list_from(dag, next, clique, left - 1, rest, f);
+        }
+        clique.pop();
+    }
+}
+
+/// Runs `walk(dag, v, buffers)` for every vertex over `threads` threads and sums the results.
+fn drive<W>(graph: &CsrGraph, k: usize, threads: usize, walk: W) -> u64
+where
+    W: Fn(&CsrGraph, u32, &mut [Vec<u32>]) -> u64 + Sync,
+{
+    assert!(k >= 1);
+    let owned;
+    let dag = if graph.is_oriented() {
+        graph
+    } else {
+        owned = graph.oriented();
+        &owned
+    };
+
+    let n = dag.num_vertices();
+    let total = AtomicU64::new(0);
+    for_each_stealing(n.div_ceil(TASK_VERTICES), threads, |task| {
+        let mut buffers = vec![Vec::new(); k];
+        let start = task * TASK_VERTICES;
+        let count: u64 = (start..n.min(start + TASK_VERTICES))
+            .map(|v| walk(dag, v as u32, &mut buffers))
+            .sum();
+        total.fetch_add(count, Ordering::Relaxed);
+    });
+
+    total.into_inner()
+}
+
+fn count_cliques_with(graph: &CsrGraph, k: usize, threads: usize) -> u64 {
+    drive(graph, k, threads, |dag, v, buffers| {
+        count_from(dag, dag.neighbors_of(v), k - 1, buffers)
+    })
+}
+
+/// The number of `k`-cliques, over [`num_threads`] threads.
+pub fn count_cliques(graph: &CsrGraph, k: usize) -> u64 {
+    count_cliques_with(graph, k, num_threads())
+}
+
+pub fn count_triangles(graph: &CsrGraph) -> u64 {
+    count_cliques(graph, 3)
+}
+
+/// Calls `f` once on every `k`-clique, from any of [`num_threads`] threads, and returns their
+/// number. The vertices of a clique come in ascending (degree, id) order.
+pub fn list_cliques<F>(graph: &CsrGraph, k: usize, f: F) -> u64
+where
+    F: Fn(&[u32]) + Sync,
+{
+    drive(graph, k, num_threads(), |dag, v, buffers| {
+        let count = std::cell::Cell::new(0);
+        let mut clique = vec![v];
+        list_from(
+            dag,
+            dag.neighbors_of(v),
+            &mut clique,
+            k - 1,
+            buffers,
+            &|c| {
+                count.set(count.get() + 1);
+                f(c)
+            },
+        );
+
+        count.get()
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Mutex;
+
+    #[test]
+    fn test_csr_graph() {
+        // K5 on 0..5, a triangle 5-6-7 hanging off 0, and a path
+        let text = "# test\n0 1\n0 2\n0 3\n0 4\n1 2\n1 3\n1 4\n2 3\n2 4\n3 4\n\
+                    0 5\n5 6\n6 7\n7 5\n8 9\n9 10\n1 0\n4 4\n";
+        let graph = CsrGraph::from_edge_list(text.as_bytes()).unwrap();
+        assert_eq!(graph.num_vertices(), 11);
+        assert_eq!(graph.num_edges(), 16);
+        assert_eq!(graph.neighbors_of(0), &[1, 2, 3, 4, 5]);
+
+        for graph in [graph.degree_ordered(), graph.oriented()] {
+            for threads in [1, 3] {
+                let counts: Vec<u64> = (1..=6)
+                    .map(|k| count_cliques_with(&graph, k, threads))
+                    .collect();
+                assert_eq!(counts, vec![11, 16, 11, 5, 1, 0]);
+            }
+        }
+
+        let cliques = Mutex::new(Vec::new());
+        let count = list_cliques(&graph, 4, |c| {
+            let mut c = c.to_vec();
+            c.sort_unstable();
+            cliques.lock().unwrap().push(c);
+        });
+        let mut cliques = cliques.into_inner().unwrap();
+        cliques.sort_unstable();
+        assert_eq!(count, 5);
+        assert_eq!(cliques[0], vec![0, 1, 2, 3]);
+        assert_eq!(cliques[4], vec![1, 2, 3, 4]);
+
+        let path = std::env::temp_dir().join(format!("intersection-{}.csr", std::process::id()));
+        let oriented = graph.degree_ordered().oriented();
+        oriented.save(&path).unwrap();
+        let mapped = CsrGraph::open(&path).unwrap();
+        std::fs::remove_file(&path).unwrap();
+        assert!(mapped.is_oriented() && mapped.is_degree_ordered());
+        assert_eq!(mapped.offsets(), oriented.offsets());
+        assert_eq!(mapped.neighbors(), oriented.neighbors());
+        assert_eq!(count_triangles(&mapped), 11);
+
+        assert!(CsrGraph::from_edge_list("0 x\n".as_bytes()).is_err());
+    }
+}
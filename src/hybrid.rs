@@ -0,0 +1,490 @@
+//! Hybrid (Roaring-style) sets of `u32`.
+//!
+//! Chambi S, Lemire D, Kaser O, et al. Better bitmap performance with Roaring bitmaps[J].
+//! Software: Practice and Experience, 2016, 46(5): 709-719.
+//!
+//! Values are split on their high 16 bits into chunks, and each chunk keeps its low halves in
+//! whichever container is smallest: a sorted array, a bitmap of all 2^16 low halves, or a list of
+//! runs. Near-dense neighbor lists then cost a bitmap or a few runs instead of 4 bytes a value.
+use std::cmp::Ordering;
+
+use crate::intersect::{gallop_by, intersect_generic};
+
+/// The number of words in a bitmap container.
+pub const BITMAP_WORDS: usize = (1 << 16) / u64::BITS as usize;
+
+#[derive(Clone, Debug, PartialEq, Eq, Hash)]
+pub enum Container {
+    /// The sorted low halves.
+    Array(Vec<u16>),
+    /// Bit `v` is set for every low half `v`.
+    Bitmap(Box<[u64; BITMAP_WORDS]>),
+    /// Sorted, disjoint and non-adjacent ranges `(first, last)`, both ends included.
+    Run(Vec<(u16, u16)>),
+}
+
+impl Container {
+    /// Builds the smallest container holding the sorted low halves, duplicates are allowed.
+    pub fn from_sorted(lows: &[u16]) -> Self {
+        let mut array: Vec<u16> = lows.to_vec();
+        array.dedup();
+
+        let mut runs: Vec<(u16, u16)> = Vec::new();
+        for &v in &array {
+            match runs.last_mut() {
+                Some((_, last)) if *last as u32 + 1 == v as u32 => *last = v,
+                _ => runs.push((v, v)),
+            }
+        }
+
+        let (array_bytes, run_bytes) = (2 * array.len(), 4 * runs.len());
+        let bitmap_bytes = BITMAP_WORDS * 8;
+        if run_bytes < array_bytes.min(bitmap_bytes) {
+            Container::Run(runs)
+        } else if array_bytes <= bitmap_bytes {
+            Container::Array(array)
+        } else {
+            let mut bitmap = Box::new([0u64; BITMAP_WORDS]);
+            for &v in &array {
+                bitmap[v as usize >> 6] |= 1 << (v & 63);
+            }
+            Container::Bitmap(bitmap)
+        }
+    }
+
+    /// The number of values in the container.
+    pub fn len(&self) -> usize {
+        match self {
+            Container::Array(array) => array.len(),
+            Container::Bitmap(bitmap) => bitmap.iter().map(|w| w.count_ones() as usize).sum(),
+            Container::Run(runs) => runs
+                .iter()
+                .map(|&(first, last)| (last - first) as usize + 1)
+                .sum(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Calls `f` with every low half in ascending order.
+    pub fn for_each(&self, mut f: impl FnMut(u16)) {
+        match self {
+            Container::Array(array) => array.iter().for_each(|&v| f(v)),
+            Container::Bitmap(bitmap) => {
+                for (w, &word) in bitmap.iter().enumerate() {
+                    let mut word = word;
+                    while word != 0 {
+                        f((w << 6) as u16 | word.trailing_zeros() as u16);
+                        word &= word - 1;
+                    }
+                }
+            }
+            Container::Run(runs) => runs
+                .iter()
+                .for_each(|&(first, last)| (first..=last).for_each(&mut f)),
+        }
+    }
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq, Hash)]
+pub struct HybridSet {
+    keys: Vec<u16>,
+    containers: Vec<Container>,
+}
+
+impl HybridSet {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Builds the set from sorted values, duplicates are allowed.
+    pub fn from_sorted(values: &[u32]) -> Self {
+        let mut set = Self::new();
+        let mut lows = Vec::new();
+        for chunk in values.chunk_by(|a, b| a >> 16 == b >> 16) {
+            lows.clear();
+            lows.extend(chunk.iter().map(|&v| v as u16));
+            set.keys.push((chunk[0] >> 16) as u16);
+            set.containers.push(Container::from_sorted(&lows));
+        }
+
+        set
+    }
+
+    /// The high halves of the chunks, ascending.
+    #[inline(always)]
+    pub fn keys(&self) -> &[u16] {
+        &self.keys
+    }
+
+    #[inline(always)]
+    pub fn containers(&self) -> &[Container] {
+        &self.containers
+    }
+
+    /// The number of values in the set.
+    pub fn len(&self) -> usize {
+        self.containers.iter().map(|c| c.len()).sum()
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.keys.is_empty()
+    }
+
+    pub fn to_vec(&self) -> Vec<u32> {
+        let mut vec = Vec::with_capacity(self.len());
+        for (&key, container) in self.keys.iter().zip(&self.containers) {
+            container.for_each(|v| vec.push((key as u32) << 16 | v as u32));
+        }
+
+        vec
+    }
+}
+
+impl From<&[u32]> for HybridSet {
+    fn from(values: &[u32]) -> Self {
+        Self::from_sorted(values)
+    }
+}
+
+/// Either layout of a sorted set, so that flat and hybrid inputs mix without conversion.
+#[derive(Clone, Copy, Debug)]
+pub enum SetRef<'a> {
+    Flat(&'a [u32]),
+    Hybrid(&'a HybridSet),
+}
+
+impl SetRef<'_> {
+    pub fn len(&self) -> usize {
+        match self {
+            SetRef::Flat(values) => values.len(),
+            SetRef::Hybrid(set) => set.len(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        match self {
+            SetRef::Flat(values) => values.is_empty(),
+            SetRef::Hybrid(set) => set.is_empty(),
+        }
+    }
+
+    pub fn to_vec(&self) -> Vec<u32> {
+        match self {
+            SetRef::Flat(values) => values.to_vec(),
+            SetRef::Hybrid(set) => set.to_vec(),
+        }
+    }
+}
+
+impl<'a> From<&'a [u32]> for SetRef<'a> {
+    fn from(values: &'a [u32]) -> Self {
+        SetRef::Flat(values)
+    }
+}
+
+impl<'a> From<&'a Vec<u32>> for SetRef<'a> {
+    fn from(values: &'a Vec<u32>) -> Self {
+        SetRef::Flat(values)
+    }
+}
+
+impl<'a> From<&'a HybridSet> for SetRef<'a> {
+    fn from(set: &'a HybridSet) -> Self {
+        SetRef::Hybrid(set)
+    }
+}
+
+/// Counts the bits of `word`, appending `base | bit` for each to `results`.
+#[inline(always)]
+fn emit_word(results: &mut Option<&mut Vec<u32>>, base: u32, mut word: u64) -> usize {
+    let count = word.count_ones() as usize;
+    if let Some(vec) = results.as_mut() {
+        while word != 0 {
+            vec.push(base | word.trailing_zeros());
+            word &= word - 1;
+        }
+    }
+
+    count
+}
+
+#[inline(always)]
+fn emit_range(results: &mut Option<&mut Vec<u32>>, high: u32, first: u16, last: u16) -> usize {
+    if let Some(vec) = results.as_mut() {
+        vec.extend((first..=last).map(|v| high | v as u32));
+    }
+
+    (last - first) as usize + 1
+}
+
+#[inline(always)]
+fn bitmap_contains(bitmap: &[u64; BITMAP_WORDS], v: u16) -> bool {
+    bitmap[v as usize >> 6] & (1 << (v & 63)) != 0
+}
+
+/// The low halves of `array` found in `container`, written as `high | v`. Array pairs go to the
+/// 16-bit kernels through `scratch`.
+fn intersect_array(
+    array: &[u16],
+    container: &Container,
+    high: u32,
+    mut results: Option<&mut Vec<u32>>,
+    scratch: &mut Vec<u16>,
+) -> usize {
+    match container {
+        Container::Array(other) => {
+            let (small, large) = if array.len() <= other.len() {
+                (array, &other[..])
+            } else {
+                (&other[..], array)
+            };
+            match results {
+                Some(vec) => {
+                    scratch.clear();
+                    let count = intersect_generic(small, large, Some(scratch));
+                    vec.extend(scratch.iter().map(|&v| high | v as u32));
+                    count
+                }
+                None => intersect_generic(small, large, None),
+            }
+        }
+        Container::Bitmap(bitmap) => {
+            let mut count = 0;
+            for &v in array {
+                if bitmap_contains(bitmap, v) {
+                    count += 1;
+                    if let Some(vec) = results.as_mut() {
+                        vec.push(high | v as u32);
+                    }
+                }
+            }
+            count
+        }
+        Container::Run(runs) => {
+            let mut count = 0;
+            let mut runs = &runs[..];
+            for &v in array {
+                // the first run that does not end before v
+                runs = gallop_by(runs, |&(_, last)| v.cmp(&last));
+                if runs.is_empty() {
+                    break;
+                }
+                if runs[0].0 <= v {
+                    count += 1;
+                    if let Some(vec) = results.as_mut() {
+                        vec.push(high | v as u32);
+                    }
+                }
+            }
+            count
+        }
+    }
+}
+
+/// The bits of `bitmap` within each run.
+fn intersect_bitmap_runs(
+    bitmap: &[u64; BITMAP_WORDS],
+    runs: &[(u16, u16)],
+    high: u32,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let mut count = 0;
+    for &(first, last) in runs {
+        let (first, last) = (first as usize, last as usize);
+        for w in first >> 6..=last >> 6 {
+            let lo = if w == first >> 6 { first & 63 } else { 0 };
+            let hi = if w == last >> 6 { last & 63 } else { 63 };
+            let mask = (u64::MAX >> (63 - hi)) & (u64::MAX << lo);
+            count += emit_word(&mut results, high | (w << 6) as u32, bitmap[w] & mask);
+        }
+    }
+
+    count
+}
+
+/// Intersects two containers of the chunk `high`, appending the values to `results`.
+fn intersect_containers(
+    aaa: &Container,
+    bbb: &Container,
+    high: u32,
+    mut results: Option<&mut Vec<u32>>,
+    scratch: &mut Vec<u16>,
+) -> usize {
+    match (aaa, bbb) {
+        (Container::Array(array), other) | (other, Container::Array(array)) => {
+            intersect_array(array, other, high, results, scratch)
+        }
+        (Container::Bitmap(a), Container::Bitmap(b)) => match results {
+            // word-wise AND, which the compiler vectorizes
+            None => a
+                .iter()
+                .zip(b.iter())
+                .map(|(x, y)| (x & y).count_ones() as usize)
+                .sum(),
+            Some(_) => {
+                let mut count = 0;
+                for (w, (x, y)) in a.iter().zip(b.iter()).enumerate() {
+                    count += emit_word(&mut results, high | (w << 6) as u32, x & y);
+                }
+                count
+            }
+        },
+        (Container::Bitmap(bitmap), Container::Run(runs))
+        | (Container::Run(runs), Container::Bitmap(bitmap)) => {
+            intersect_bitmap_runs(bitmap, runs, high, results)
+        }
+        (Container::Run(a), Container::Run(b)) => {
+            let mut count = 0;
+            let (mut i, mut j) = (0, 0);
+            while i < a.len() && j < b.len() {
+                let (first, last) = (a[i].0.max(b[j].0), a[i].1.min(b[j].1));
+                if first <= last {
+                    count += emit_range(&mut results, high, first, last);
+                }
+                match a[i].1.cmp(&b[j].1) {
+                    Ordering::Less => i += 1,
+                    Ordering::Greater => j += 1,
+                    Ordering::Equal => {
+                        i += 1;
+                        j += 1;
+                    }
+                }
+            }
+            count
+        }
+    }
+}
+
+/// Returns the number of values in the intersection, the values are appended to `results`.
+pub fn intersect_hybrid_sets(
+    aaa: &HybridSet,
+    bbb: &HybridSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let (aaa, bbb) = if aaa.keys.len() <= bbb.keys.len() {
+        (aaa, bbb)
+    } else {
+        (bbb, aaa)
+    };
+
+    let mut count = 0;
+    let mut scratch = Vec::new();
+    let mut keys = &bbb.keys[..];
+    for (&key, container) in aaa.keys.iter().zip(&aaa.containers) {
+        keys = gallop_by(keys, |x: &u16| key.cmp(x));
+        if keys.is_empty() {
+            break;
+        }
+        if keys[0] == key {
+            let other = &bbb.containers[bbb.keys.len() - keys.len()];
+            count += intersect_containers(
+                container,
+                other,
+                (key as u32) << 16,
+                results.as_deref_mut(),
+                &mut scratch,
+            );
+        }
+    }
+
+    count
+}
+
+/// Intersects a flat set with a hybrid one, chunk by chunk, the values are appended to `results`.
+pub fn intersect_flat_hybrid(
+    aaa: &[u32],
+    bbb: &HybridSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let mut count = 0;
+    let (mut lows, mut scratch) = (Vec::new(), Vec::new());
+    let mut keys = &bbb.keys[..];
+    for chunk in aaa.chunk_by(|a, b| a >> 16 == b >> 16) {
+        let key = (chunk[0] >> 16) as u16;
+        keys = gallop_by(keys, |x: &u16| key.cmp(x));
+        if keys.is_empty() {
+            break;
+        }
+        if keys[0] == key {
+            lows.clear();
+            lows.extend(chunk.iter().map(|&v| v as u16));
+            let container = &bbb.containers[bbb.keys.len() - keys.len()];
+            count += intersect_array(
+                &lows,
+                container,
+                (key as u32) << 16,
+                results.as_deref_mut(),
+                &mut scratch,
+            );
+        }
+    }
+
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_hybrid_set() {
+        // sparse, dense and run chunks
+        let values: Vec<u32> = (0..100)
+            .map(|i| i * 97)
+            .chain((1 << 16..2 << 16).filter(|v| v % 3 != 0))
+            .chain((5 << 16) + 10..(5 << 16) + 20_000)
+            .chain([u32::MAX])
+            .collect();
+        let set = HybridSet::from_sorted(&values);
+        assert_eq!(set.keys(), &[0, 1, 5, u16::MAX]);
+        assert!(matches!(set.containers()[0], Container::Array(_)));
+        assert!(matches!(set.containers()[1], Container::Bitmap(_)));
+        assert!(matches!(set.containers()[2], Container::Run(_)));
+        assert_eq!(set.len(), values.len());
+        assert_eq!(set.to_vec(), values);
+    }
+
+    #[test]
+    fn test_intersect_hybrid() {
+        // chunk by chunk x holds array, array, bitmap, bitmap, run, run and bitmap containers, and
+        // y array, bitmap, array, bitmap, array, run and run ones, so every pair of kinds meets
+        let x: Vec<u32> = (0..7u32 << 16)
+            .filter(|&v| match v >> 16 {
+                0 | 1 => v % 31 == 0,
+                2 | 3 | 6 => v % 3 != 0,
+                _ => v & 0x3fff < 3000,
+            })
+            .collect();
+        let y: Vec<u32> = (0..7u32 << 16)
+            .filter(|&v| match v >> 16 {
+                0 | 2 | 4 => v % 41 == 0,
+                1 | 3 => v % 4 != 0,
+                _ => v & 0xfff < 1000,
+            })
+            .collect();
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+        let (hx, hy) = (HybridSet::from_sorted(&x), HybridSet::from_sorted(&y));
+        let mut result = vec![42];
+        assert_eq!(
+            intersect_hybrid_sets(&hx, &hy, Some(&mut result)),
+            expected.len()
+        );
+        assert_eq!(result[1..], expected);
+        assert_eq!(intersect_hybrid_sets(&hy, &hx, None), expected.len());
+
+        let mut result = Vec::new();
+        assert_eq!(
+            intersect_flat_hybrid(&x, &hy, Some(&mut result)),
+            expected.len()
+        );
+        assert_eq!(result, expected);
+        assert_eq!(intersect_flat_hybrid(&y, &hx, None), expected.len());
+    }
+}
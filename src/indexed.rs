@@ -0,0 +1,186 @@
+//! Sorted sets with a sampled skip index, for galloping into very large sets.
+//!
+//! The index holds the last value of every 16-value block of the set, packed in 64-byte lines. A
+//! probe gallops through the keys from the block of the previous match, then scans the single
+//! block it lands in, so its jumps cover 16 times the distance of a gallop through the set and
+//! touch a sixteenth of the lines. Probes that land in the block of the previous match read that
+//! block alone.
+use std::slice;
+
+use crate::intersect::{gallop, intersect, GALLOP_OVERHEAD};
+
+const LINE: usize = 16;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(C, align(64))]
+struct Line([u32; LINE]);
+
+/// The number of values of a full block below `x`, branch-free.
+#[inline(always)]
+fn count_less(block: &[u32; LINE], x: u32) -> usize {
+    block.iter().map(|&k| (k < x) as u32).sum::<u32>() as usize
+}
+
+/// A sorted set and its skip index.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct IndexedSet<'a> {
+    values: &'a [u32],
+    /// The last value of each block of `values`, padded to whole lines.
+    keys: Vec<Line>,
+    blocks: usize,
+}
+
+impl<'a> IndexedSet<'a> {
+    /// Builds the index of sorted `values`.
+    pub fn new(values: &'a [u32]) -> Self {
+        let keys: Vec<u32> = values.chunks(LINE).map(|b| *b.last().unwrap()).collect();
+        let lines = keys
+            .chunks(LINE)
+            .map(|c| {
+                let mut line = Line([u32::MAX; LINE]);
+                line.0[..c.len()].copy_from_slice(c);
+                line
+            })
+            .collect();
+
+        Self {
+            values,
+            keys: lines,
+            blocks: keys.len(),
+        }
+    }
+
+    #[inline(always)]
+    pub fn values(&self) -> &'a [u32] {
+        self.values
+    }
+
+    /// The last value of each block.
+    #[inline(always)]
+    pub fn keys(&self) -> &[u32] {
+        unsafe { slice::from_raw_parts(self.keys.as_ptr() as *const u32, self.blocks) }
+    }
+
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// The index of the first value not below `x`, or the length.
+    #[inline(always)]
+    pub fn lower_bound(&self, x: u32) -> usize {
+        self.lower_bound_from(x, 0)
+    }
+
+    /// [`lower_bound`](Self::lower_bound) for `x` above every value before `from`.
+    #[inline(always)]
+    pub fn lower_bound_from(&self, x: u32, from: usize) -> usize {
+        match self.seek_block(x, from / LINE) {
+            block if block < self.blocks => self.position_in(x, block),
+            _ => self.values.len(),
+        }
+    }
+
+    /// The first block from `block` on whose last value is not below `x`, or the number of
+    /// blocks. The key of `block` is checked first, then the keys past it are galloped through.
+    #[inline(always)]
+    pub fn seek_block(&self, x: u32, block: usize) -> usize {
+        let keys = self.keys();
+        if block >= keys.len() || keys[block] >= x {
+            return block;
+        }
+
+        let rest = &keys[block + 1..];
+        block + 1 + rest.len() - gallop(rest, &x).len()
+    }
+
+    /// The index of the first value of `block` not below `x`.
+    #[inline(always)]
+    fn position_in(&self, x: u32, block: usize) -> usize {
+        let start = block * LINE;
+        match self.values.get(start..start + LINE) {
+            Some(values) => start + count_less(values.try_into().unwrap(), x),
+            None => start + self.values[start..].partition_point(|&v| v < x),
+        }
+    }
+}
+
+/// Gallops every value of `aaa` into `bbb` through its index, returns the number of values in
+/// the intersection, the values are appended to `results`.
+pub fn intersect_indexed_gallop(
+    aaa: &[u32],
+    bbb: &IndexedSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let values = bbb.values();
+    let mut count = 0;
+    let mut block = 0;
+    for &a in aaa {
+        block = bbb.seek_block(a, block);
+        if block == bbb.blocks {
+            break;
+        }
+        if values[bbb.position_in(a, block)] == a {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(a);
+            }
+        }
+    }
+
+    count
+}
+
+/// [`intersect`] of a flat set and an indexed one: the index replaces galloping, other pairs
+/// run on the values.
+#[inline(always)]
+pub fn intersect_indexed(aaa: &[u32], bbb: &IndexedSet, results: Option<&mut Vec<u32>>) -> usize {
+    if aaa.len() < bbb.len() / *GALLOP_OVERHEAD {
+        intersect_indexed_gallop(aaa, bbb, results)
+    } else {
+        intersect(aaa, bbb.values(), results)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_indexed_set() {
+        for len in [0, 1, 15, 16, 17, 255, 256, 257, 5000, 70_000] {
+            let values: Vec<u32> = (0..len as u32).map(|i| i * 7 + 3).collect();
+            let set = IndexedSet::new(&values);
+            for x in (0..len as u32 * 7 + 10).step_by(5).chain([u32::MAX]) {
+                let expected = values.partition_point(|&v| v < x);
+                assert_eq!(set.lower_bound(x), expected, "len {} x {}", len, x);
+                let from = expected.saturating_sub(x as usize % 40);
+                assert_eq!(set.lower_bound_from(x, from), expected);
+            }
+        }
+
+        let y: Vec<u32> = (0..1_000_000).map(|i| i * 2).chain([u32::MAX]).collect();
+        let index = IndexedSet::new(&y);
+        for x in [
+            (0..1000).map(|i| i * 1999).collect::<Vec<u32>>(),
+            (0..1000).map(|i| i * 3).collect(),
+            vec![u32::MAX],
+        ] {
+            let mut expected = Vec::new();
+            intersect_scalar_merge(&x, &y, Some(&mut expected));
+            let mut result = Vec::new();
+            assert_eq!(
+                intersect_indexed(&x, &index, Some(&mut result)),
+                expected.len()
+            );
+            assert_eq!(result, expected);
+            assert_eq!(intersect_indexed_gallop(&x, &index, None), expected.len());
+        }
+    }
+}
@@ -1,38 +1,311 @@
 use std::borrow::Cow;
 use std::cmp::Ordering;
 use std::env;
-use std::mem;
+use std::mem::{self, MaybeUninit};
+
+use crate::bsr::BsrSet;
+use crate::cost_model::{Kernel, COST_MODEL};
+use crate::hybrid::{intersect_flat_hybrid, intersect_hybrid_sets, SetRef};
+use crate::partitioned::PartitionedSet;
+use crate::scratch::with_scratch;
+use crate::stats;
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{
+    intersect_simd_gallop_u16, intersect_simd_gallop_u64, intersect_simd_qfilter_u16,
+    intersect_simd_qfilter_u64,
+};
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{intersect_bsr_simd_gallop, intersect_bsr_simd_qfilter};
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::intersect_simd_partitioned;
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{intersect_simd_gallop_limit, intersect_simd_qfilter_limit};
 
 #[cfg(feature = "simd")]
-use crate::simd_intersection::{intersect_simd_gallop, intersect_simd_qfilter};
+use crate::simd_intersection::intersect_simd_kway;
 
-#[cfg(feature = "simd_new")]
-use crate::simd_intersection_new::{intersect_simd_gallop, intersect_simd_qfilter};
+#[cfg(not(feature = "simd"))]
+use crate::bsr::{intersect_bsr_scalar_gallop, intersect_bsr_scalar_merge};
+
+#[cfg(not(feature = "simd"))]
+use crate::partitioned::intersect_partitioned_scalar;
 
 const INTERSECTION_GALLOP_OVERHEAD: usize = 4;
 
 lazy_static! {
     /// Default magic gallop overhead # is 4
-    static ref GALLOP_OVERHEAD: usize = env::var("INTERSECTION_GALLOP_OVERHEAD").map(|n| n.parse().unwrap()).unwrap_or(INTERSECTION_GALLOP_OVERHEAD);
+    pub(crate) static ref GALLOP_OVERHEAD: usize = env::var("INTERSECTION_GALLOP_OVERHEAD").map(|n| n.parse().unwrap()).unwrap_or(INTERSECTION_GALLOP_OVERHEAD);
+
+}
+
+/// The intersection of all sets. Intermediate results live in the thread's
+/// [`Scratch`](crate::scratch::Scratch), only the final one is allocated; use the scratch directly
+/// to borrow it instead.
+#[inline(always)]
+pub fn intersect_multi(to_intersect: Vec<Cow<[u32]>>) -> Vec<u32> {
+    let sets: Vec<&[u32]> = to_intersect.iter().map(|x| &x[..]).collect();
+
+    with_scratch(|scratch| scratch.intersect_multi(&sets).to_vec())
+}
 
+/// The kernel [`intersect`] runs without a cost model, `len_a` being the first set.
+#[inline(always)]
+fn default_kernel(len_a: usize, len_b: usize) -> Kernel {
+    if len_a < len_b / *GALLOP_OVERHEAD {
+        #[cfg(any(feature = "simd", feature = "simd_new"))]
+        {
+            Kernel::SimdGallop
+        }
+        #[cfg(not(any(feature = "simd", feature = "simd_new")))]
+        {
+            Kernel::ScalarGallop
+        }
+    } else {
+        // QFilter b4, the cost model picks shuffling and the wider blocks where they measure
+        // faster.
+        #[cfg(any(feature = "simd", feature = "simd_new"))]
+        {
+            Kernel::QFilter
+        }
+        #[cfg(not(any(feature = "simd", feature = "simd_new")))]
+        {
+            Kernel::ScalarMerge
+        }
+    }
 }
 
+/// The kernel [`intersect`] runs, and the sets in the order it takes them.
 #[inline(always)]
-pub fn intersect_multi(mut to_intersect: Vec<Cow<[u32]>>) -> Vec<u32> {
+fn choose_kernel<'a>(aaa: &'a [u32], bbb: &'a [u32]) -> (&'a [u32], &'a [u32], Kernel) {
+    match COST_MODEL.as_ref() {
+        Some(model) if aaa.len() <= bbb.len() => (aaa, bbb, model.kernel(aaa.len(), bbb.len())),
+        Some(model) => (bbb, aaa, model.kernel(bbb.len(), aaa.len())),
+        None => (aaa, bbb, default_kernel(aaa.len(), bbb.len())),
+    }
+}
+
+#[inline(always)]
+pub fn intersect(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    let (aaa, bbb, kernel) = choose_kernel(aaa, bbb);
+
+    stats::record(kernel, aaa, bbb, || kernel.run(aaa, bbb, results))
+}
+
+/// [`intersect`] into a caller buffer, without allocating. `out` must hold at least
+/// `min(|A|, |B|) +` [`OUTPUT_SLACK`] elements, of which the first `count` are initialized on
+/// return.
+#[inline(always)]
+pub fn intersect_into(aaa: &[u32], bbb: &[u32], out: &mut [MaybeUninit<u32>]) -> usize {
+    assert!(
+        out.len() >= aaa.len().min(bbb.len()) + OUTPUT_SLACK,
+        "output of {} elements, {} needed",
+        out.len(),
+        aaa.len().min(bbb.len()) + OUTPUT_SLACK
+    );
+    let (aaa, bbb, kernel) = choose_kernel(aaa, bbb);
+
+    stats::record(kernel, aaa, bbb, || kernel.run_into(aaa, bbb, out))
+}
+
+/// Whether the sets share a value, stopping at the first.
+#[inline(always)]
+pub fn intersects_any(aaa: &[u32], bbb: &[u32]) -> bool {
+    intersect_at_least(aaa, bbb, 1)
+}
+
+/// Whether the sets share at least `k` values, stopping as soon as `k` are found or the values
+/// left cannot make them up.
+#[inline(always)]
+pub fn intersect_at_least(aaa: &[u32], bbb: &[u32], k: usize) -> bool {
+    k == 0 || intersect_early_exit(aaa, bbb, k, None) >= k
+}
+
+/// Appends the first `k` values of the intersection to `results`, and returns their number.
+#[inline(always)]
+pub fn intersect_limit(aaa: &[u32], bbb: &[u32], k: usize, results: &mut Vec<u32>) -> usize {
+    intersect_early_exit(aaa, bbb, k, Some(results))
+}
+
+/// Gallops or runs QFilter like [`intersect`], with the early exits of the `_limit` kernels.
+#[inline(always)]
+pub(crate) fn intersect_early_exit(
+    aaa: &[u32],
+    bbb: &[u32],
+    k: usize,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    let (aaa, bbb) = if aaa.len() <= bbb.len() {
+        (aaa, bbb)
+    } else {
+        (bbb, aaa)
+    };
+    if k == 0 || aaa.is_empty() || (results.is_none() && aaa.len() < k) {
+        return 0;
+    }
+    // disjoint ranges
+    if aaa[aaa.len() - 1] < bbb[0] || bbb[bbb.len() - 1] < aaa[0] {
+        return 0;
+    }
+
+    let gallop = aaa.len() < bbb.len() / *GALLOP_OVERHEAD;
+    #[cfg(feature = "simd")]
+    {
+        if gallop {
+            intersect_simd_gallop_limit(aaa, bbb, k, results)
+        } else {
+            intersect_simd_qfilter_limit(aaa, bbb, k, results)
+        }
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        if gallop {
+            intersect_scalar_gallop_limit(aaa, bbb, k, results)
+        } else {
+            intersect_scalar_merge_limit(aaa, bbb, k, results)
+        }
+    }
+}
+
+/// The first `k` values of [`intersect_multi`].
+pub fn intersect_multi_limit(to_intersect: Vec<Cow<[u32]>>, k: usize) -> Vec<u32> {
+    let sets: Vec<&[u32]> = to_intersect.iter().map(|x| &x[..]).collect();
+    let mut results = Vec::new();
+    intersect_multi_early_exit(&sets, k, Some(&mut results));
+
+    results
+}
+
+/// Whether all sets share at least `k` values, `k = 1` asking whether they share any.
+pub fn intersect_multi_at_least(to_intersect: Vec<Cow<[u32]>>, k: usize) -> bool {
+    let sets: Vec<&[u32]> = to_intersect.iter().map(|x| &x[..]).collect();
+
+    k == 0 || intersect_multi_early_exit(&sets, k, None) >= k
+}
+
+/// Stops as soon as the answer is known. A limit, or `k = 1`, probes each value of the smallest
+/// set through the others in turn, see [`intersect_adaptive_by`], up to the `k`-th match. A
+/// threshold intersects pair by pair in the thread's scratch instead, until fewer than `k` values
+/// are left.
+fn intersect_multi_early_exit(
+    sets: &[&[u32]],
+    k: usize,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    if k == 0 || sets.is_empty() {
+        return 0;
+    }
+    let mut sorted = sets.to_vec();
+    sorted.sort_unstable_by_key(|set| set.len());
+
+    if k > 1 && results.is_none() && sorted.len() > 1 {
+        return with_scratch(|scratch| scratch.count_up_to(&sorted, k));
+    }
+
+    let mut count = 0;
+    intersect_adaptive_by(
+        sorted.len(),
+        |l| sorted[l],
+        &mut Vec::new(),
+        |v| {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(v);
+            }
+            count < k
+        },
+    );
+
+    count
+}
+
+/// The intersection of all `sets` in one adaptive pass, see [`intersect_adaptive_by`]. Unlike
+/// [`intersect_multi`], which runs it once the sets left are skewed, it never intersects a pair.
+pub fn intersect_adaptive(sets: &[&[u32]], results: Option<&mut Vec<u32>>) -> usize {
+    #[cfg(feature = "simd")]
+    {
+        intersect_simd_kway(sets, results)
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        intersect_scalar_adaptive(sets, results)
+    }
+}
+
+/// Element types with kernels of their own, see [`intersect_generic`].
+pub trait IntersectKey: Copy + Ord {
+    fn intersect(aaa: &[Self], bbb: &[Self], results: Option<&mut Vec<Self>>) -> usize;
+}
+
+impl IntersectKey for u32 {
+    #[inline(always)]
+    fn intersect(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+        intersect(aaa, bbb, results)
+    }
+}
+
+/// Picks galloping or QFilter like [`intersect`] does for `u32` without a cost model.
+macro_rules! impl_intersect_key {
+    ($t:ty, $gallop:ident, $qfilter:ident) => {
+        impl IntersectKey for $t {
+            #[inline(always)]
+            fn intersect(aaa: &[$t], bbb: &[$t], results: Option<&mut Vec<$t>>) -> usize {
+                if aaa.len() < bbb.len() / *GALLOP_OVERHEAD {
+                    #[cfg(feature = "simd")]
+                    {
+                        $gallop(aaa, bbb, results)
+                    }
+                    #[cfg(not(feature = "simd"))]
+                    {
+                        intersect_scalar_gallop(aaa, bbb, results)
+                    }
+                } else {
+                    #[cfg(feature = "simd")]
+                    {
+                        $qfilter(aaa, bbb, results)
+                    }
+                    #[cfg(not(feature = "simd"))]
+                    {
+                        intersect_scalar_merge(aaa, bbb, results)
+                    }
+                }
+            }
+        }
+    };
+}
+
+impl_intersect_key!(u64, intersect_simd_gallop_u64, intersect_simd_qfilter_u64);
+impl_intersect_key!(u16, intersect_simd_gallop_u16, intersect_simd_qfilter_u16);
+
+/// [`intersect`] over `u16`, `u32` or `u64` sets, routed to the kernels of that width.
+#[inline(always)]
+pub fn intersect_generic<T: IntersectKey>(
+    aaa: &[T],
+    bbb: &[T],
+    results: Option<&mut Vec<T>>,
+) -> usize {
+    T::intersect(aaa, bbb, results)
+}
+
+/// [`intersect_multi`] over flat and hybrid sets in any mix, the result is flat.
+pub fn intersect_multi_hybrid(mut to_intersect: Vec<SetRef>) -> Vec<u32> {
     if to_intersect.len() == 1 {
-        return to_intersect[0].iter().copied().collect();
+        return to_intersect[0].to_vec();
     }
 
-    to_intersect.sort_unstable_by_key(|x| x.len());
+    to_intersect.sort_by_cached_key(|x| x.len());
 
-    let mut intersected = Vec::with_capacity(to_intersect[0].len());
-    intersect(&to_intersect[0], &to_intersect[1], Some(&mut intersected));
+    let mut intersected = Vec::new();
+    intersect_hybrid(to_intersect[0], to_intersect[1], Some(&mut intersected));
     let mut buffer = Vec::with_capacity(intersected.len());
 
     let mut count;
 
     for candidates in to_intersect.into_iter().skip(2) {
-        count = intersect(&intersected, &candidates, Some(&mut buffer));
+        count = intersect_hybrid(&intersected, candidates, Some(&mut buffer));
 
         if count == 0 {
             return buffer;
@@ -45,29 +318,99 @@ pub fn intersect_multi(mut to_intersect: Vec<Cow<[u32]>>) -> Vec<u32> {
     intersected
 }
 
+/// [`intersect`] over a flat or hybrid set on either side, the results are flat. Hybrid sets
+/// meet container by container, and a flat set meets a hybrid one chunk by chunk.
 #[inline(always)]
-pub fn intersect(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
-    if aaa.len() < bbb.len() / *GALLOP_OVERHEAD {
-        #[cfg(any(feature = "simd", feature = "simd_new"))]
+pub fn intersect_hybrid<'a, 'b>(
+    aaa: impl Into<SetRef<'a>>,
+    bbb: impl Into<SetRef<'b>>,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    match (aaa.into(), bbb.into()) {
+        (SetRef::Flat(aaa), SetRef::Flat(bbb)) => {
+            if aaa.len() <= bbb.len() {
+                intersect(aaa, bbb, results)
+            } else {
+                intersect(bbb, aaa, results)
+            }
+        }
+        (SetRef::Flat(flat), SetRef::Hybrid(set)) | (SetRef::Hybrid(set), SetRef::Flat(flat)) => {
+            intersect_flat_hybrid(flat, set, results)
+        }
+        (SetRef::Hybrid(aaa), SetRef::Hybrid(bbb)) => intersect_hybrid_sets(aaa, bbb, results),
+    }
+}
+
+#[inline(always)]
+pub fn intersect_multi_bsr(mut to_intersect: Vec<Cow<BsrSet>>) -> BsrSet {
+    if to_intersect.len() == 1 {
+        return to_intersect.pop().unwrap().into_owned();
+    }
+
+    to_intersect.sort_unstable_by_key(|x| x.num_bases());
+
+    let mut intersected = BsrSet::with_capacity(to_intersect[0].num_bases());
+    intersect_bsr(&to_intersect[0], &to_intersect[1], Some(&mut intersected));
+    let mut buffer = BsrSet::with_capacity(intersected.num_bases());
+
+    let mut count;
+
+    for candidates in to_intersect.into_iter().skip(2) {
+        count = intersect_bsr(&intersected, &candidates, Some(&mut buffer));
+
+        if count == 0 {
+            return buffer;
+        }
+
+        mem::swap(&mut intersected, &mut buffer);
+        buffer.clear();
+    }
+
+    intersected
+}
+
+/// The BSR counterpart of [`intersect`], returns the number of values in the intersection.
+#[inline(always)]
+pub fn intersect_bsr(aaa: &BsrSet, bbb: &BsrSet, results: Option<&mut BsrSet>) -> usize {
+    if aaa.num_bases() < bbb.num_bases() / *GALLOP_OVERHEAD {
+        #[cfg(feature = "simd")]
         {
-            intersect_simd_gallop(aaa, bbb, results)
+            intersect_bsr_simd_gallop(aaa, bbb, results)
         }
-        #[cfg(not(any(feature = "simd", feature = "simd_new")))]
+        #[cfg(not(feature = "simd"))]
         {
-            intersect_scalar_gallop(aaa, bbb, results)
+            intersect_bsr_scalar_gallop(aaa, bbb, results)
         }
     } else {
-        #[cfg(any(feature = "simd", feature = "simd_new"))]
+        #[cfg(feature = "simd")]
         {
-            intersect_simd_qfilter(aaa, bbb, results)
+            intersect_bsr_simd_qfilter(aaa, bbb, results)
         }
-        #[cfg(not(any(feature = "simd", feature = "simd_new")))]
+        #[cfg(not(feature = "simd"))]
         {
-            intersect_scalar_merge(aaa, bbb, results)
+            intersect_bsr_scalar_merge(aaa, bbb, results)
         }
     }
 }
 
+/// The partitioned counterpart of [`intersect`], returns the number of values in the
+/// intersection. The values are appended to `results` as full `u32`.
+#[inline(always)]
+pub fn intersect_partitioned(
+    aaa: &PartitionedSet,
+    bbb: &PartitionedSet,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    #[cfg(feature = "simd")]
+    {
+        intersect_simd_partitioned(aaa, bbb, results)
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        intersect_partitioned_scalar(aaa, bbb, results)
+    }
+}
+
 #[inline(always)]
 pub fn intersect_scalar_merge<T: Copy + Ord>(
     aaa: &[T],
@@ -112,6 +455,180 @@ pub fn intersect_scalar_gallop<T: Copy + Ord>(
     count
 }
 
+/// The elements past its count that an `_into` kernel may overwrite: `out` must hold at least
+/// `min(|A|, |B|) + OUTPUT_SLACK` elements.
+pub const OUTPUT_SLACK: usize = 8;
+
+/// [`intersect_scalar_merge`] into `out`, which must hold the intersection. Returns the count,
+/// the first `count` elements of `out` are initialized.
+#[inline(always)]
+pub fn intersect_scalar_merge_into<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    out: &mut [MaybeUninit<T>],
+) -> usize {
+    let mut count = 0;
+
+    for &a in aaa {
+        while !bbb.is_empty() && bbb[0] < a {
+            bbb = &bbb[1..];
+        }
+        if !bbb.is_empty() && a == bbb[0] {
+            out[count].write(a);
+            count += 1;
+        }
+    }
+
+    count
+}
+
+/// [`intersect_scalar_gallop`] into `out`, which must hold the intersection.
+#[inline(always)]
+pub fn intersect_scalar_gallop_into<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    out: &mut [MaybeUninit<T>],
+) -> usize {
+    let mut count = 0;
+
+    for a in aaa {
+        bbb = gallop(bbb, a);
+        if !bbb.is_empty() && &bbb[0] == a {
+            out[count].write(*a);
+            count += 1;
+        }
+    }
+
+    count
+}
+
+/// [`intersect_scalar_merge`] with an early exit: with `results`, after the first `limit` values,
+/// otherwise as soon as the count reaches `limit` or the values left cannot make it up. Returns
+/// at most `limit`.
+#[inline(always)]
+pub fn intersect_scalar_merge_limit<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    limit: usize,
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let cutoff = results.is_none();
+    let mut count = 0;
+
+    for (i, &a) in aaa.iter().enumerate() {
+        if count == limit || (cutoff && count + (aaa.len() - i).min(bbb.len()) < limit) {
+            break;
+        }
+        while !bbb.is_empty() && bbb[0] < a {
+            bbb = &bbb[1..];
+        }
+        if !bbb.is_empty() && a == bbb[0] {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(a);
+            }
+        }
+    }
+
+    count
+}
+
+/// [`intersect_scalar_gallop`] with the early exit of [`intersect_scalar_merge_limit`].
+#[inline(always)]
+pub fn intersect_scalar_gallop_limit<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    limit: usize,
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let cutoff = results.is_none();
+    let mut count = 0;
+
+    for (i, a) in aaa.iter().enumerate() {
+        if count == limit || (cutoff && count + (aaa.len() - i) < limit) {
+            break;
+        }
+        bbb = gallop(bbb, a);
+        if !bbb.is_empty() && &bbb[0] == a {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(*a);
+            }
+        }
+    }
+
+    count
+}
+
+/// The intersection of `k` sets by the adaptive algorithm of Demaine, Lopez-Ortiz and Munro, in
+/// the small-adaptive form of Barbay et al.: every value of `set(0)` is galloped for in the other
+/// sets from their cursors, and a set without it gives the eliminator the first one leaps to. The
+/// work follows the size of the certificate, the values and gaps that prove the result, rather
+/// than that of the sets. `cursors` is working space, and the walk stops once `emit` returns
+/// false.
+#[inline(always)]
+pub(crate) fn intersect_adaptive_by<'s, T: Copy + Ord + 's>(
+    k: usize,
+    set: impl Fn(usize) -> &'s [T],
+    cursors: &mut Vec<usize>,
+    mut emit: impl FnMut(T) -> bool,
+) {
+    if k == 0 {
+        return;
+    }
+    cursors.clear();
+    cursors.resize(k, 0);
+
+    let first = set(0);
+    let mut i = 0;
+    'candidates: while i < first.len() {
+        let candidate = first[i];
+        for l in 1..k {
+            let other = set(l);
+            let rest = gallop(&other[cursors[l]..], &candidate);
+            cursors[l] = other.len() - rest.len();
+            match rest.first() {
+                None => return,
+                Some(&eliminator) if eliminator != candidate => {
+                    i = first.len() - gallop(&first[i + 1..], &eliminator).len();
+                    continue 'candidates;
+                }
+                _ => {}
+            }
+        }
+
+        if !emit(candidate) {
+            return;
+        }
+        i += 1;
+    }
+}
+
+/// The intersection of all `sets` by [`intersect_adaptive_by`], from the smallest.
+pub fn intersect_scalar_adaptive<T: Copy + Ord>(
+    sets: &[&[T]],
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let mut sorted = sets.to_vec();
+    sorted.sort_unstable_by_key(|set| set.len());
+
+    let mut count = 0;
+    intersect_adaptive_by(
+        sorted.len(),
+        |l| sorted[l],
+        &mut Vec::new(),
+        |v| {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(v);
+            }
+            true
+        },
+    );
+
+    count
+}
+
 /// The `gallop` binary searching algorithm.
 /// **Note** it is necessary to guarantee that `slice` is sorted.
 ///
@@ -187,6 +704,7 @@ pub fn gallop_gt<'a, T: Ord>(slice: &'a [T], key: &T) -> &'a [T] {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::hybrid::HybridSet;
     use std::borrow::Cow;
 
     #[test]
@@ -216,6 +734,53 @@ mod tests {
         assert_eq!(result.to_vec(), vec![8, 9, 10]);
     }
 
+    #[test]
+    fn test_early_exit() {
+        let x: Vec<u32> = (0..1000).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..1000).map(|i| i * 3).collect();
+        let z: Vec<u32> = (0..10).map(|i| i * 600 + 1).collect();
+        let w: Vec<u32> = (0..100_000).map(|i| i * 6).collect();
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+        for (aaa, bbb) in [(&x, &y), (&y, &x), (&z, &w), (&w, &x)] {
+            let mut all = Vec::new();
+            let count = intersect(aaa, bbb, Some(&mut all));
+            assert_eq!(intersects_any(aaa, bbb), count > 0);
+            for k in [0, 1, 2, 5, 17, count, count + 1, usize::MAX] {
+                assert_eq!(intersect_at_least(aaa, bbb, k), count >= k);
+                let mut result = vec![42];
+                assert_eq!(intersect_limit(aaa, bbb, k, &mut result), count.min(k));
+                assert_eq!(result[1..], all[..count.min(k)]);
+                for limit in [intersect_scalar_merge_limit, intersect_scalar_gallop_limit] {
+                    let mut result = Vec::new();
+                    assert_eq!(limit(aaa, bbb, k, Some(&mut result)), count.min(k));
+                    assert_eq!(result[..], all[..count.min(k)]);
+                    assert_eq!(limit(aaa, bbb, k, None) >= k, count >= k);
+                }
+            }
+        }
+
+        let sets = || vec![Cow::from(&x), Cow::from(&y), Cow::from(&w)];
+        let all = intersect_multi(sets());
+        assert_eq!(intersect_multi_limit(sets(), 10), all[..10]);
+        assert!(intersect_multi_at_least(sets(), all.len()));
+        assert!(!intersect_multi_at_least(sets(), all.len() + 1));
+        assert!(!intersect_multi_at_least(
+            vec![Cow::from(&x), Cow::from(&z)],
+            1
+        ));
+        assert_eq!(intersect_multi_limit(vec![Cow::from(&z)], 3), z[..3]);
+        assert_eq!(intersect_multi_limit(sets(), all.len() + 5), all);
+        assert!(intersect_multi_at_least(sets(), 1));
+        let mut four = sets();
+        four.push(Cow::from(&z));
+        let all = intersect_multi(four.clone());
+        assert!(intersect_multi_at_least(four.clone(), all.len()));
+        assert!(!intersect_multi_at_least(four.clone(), all.len() + 1));
+        assert_eq!(intersect_multi_limit(four, 2), all[..all.len().min(2)]);
+    }
+
     #[test]
     fn test_intersect_multi() {
         let data = vec![
@@ -224,6 +789,133 @@ mod tests {
             Cow::from(vec![1, 2, 3, 5, 7, 10, 11, 90]),
         ];
 
-        assert_eq!(intersect_multi(data), vec![1, 3, 5, 10, 11])
+        assert_eq!(intersect_multi(data), vec![1, 3, 5, 10, 11]);
+
+        let skewed = vec![
+            Cow::from((0..1000).collect::<Vec<u32>>()),
+            Cow::from(vec![3, 500, 998]),
+            Cow::from((0..2000).step_by(2).collect::<Vec<u32>>()),
+        ];
+        assert_eq!(intersect_multi(skewed), vec![500, 998]);
+
+        // the two smallest agree on everything, the largest cuts them short
+        let x: Vec<u32> = (0..2000).collect();
+        let y: Vec<u32> = (0..2000).chain([5000]).collect();
+        let z: Vec<u32> = [7, 1999].into_iter().chain(3000..20_000).collect();
+        let w: Vec<u32> = (0..100_000).map(|i| i * 3).collect();
+        for sets in [
+            vec![&x[..], &y[..], &z[..]],
+            vec![&z[..], &x[..], &w[..], &y[..]],
+            vec![&w[..], &z[..]],
+            vec![&x[..]],
+            vec![&x[..], &[][..]],
+        ] {
+            let mut expected = sets[0].to_vec();
+            for set in &sets[1..] {
+                expected.retain(|v| set.binary_search(v).is_ok());
+            }
+
+            let cows = sets.iter().map(|&s| Cow::from(s)).collect();
+            assert_eq!(intersect_multi(cows), expected);
+            let mut result = vec![42];
+            assert_eq!(intersect_adaptive(&sets, Some(&mut result)), expected.len());
+            assert_eq!(result[1..], expected[..]);
+            let mut result = Vec::new();
+            intersect_scalar_adaptive(&sets, Some(&mut result));
+            assert_eq!(result, expected);
+        }
+    }
+
+    #[test]
+    fn test_intersect_multi_hybrid() {
+        let dense: Vec<u32> = (0..1 << 18).filter(|v| v % 3 != 0).collect();
+        let runs: Vec<u32> = (0..1 << 18).filter(|v| v & 0xffff < 20_000).collect();
+        let sparse: Vec<u32> = (0..1 << 18).step_by(101).collect();
+        let (dense_set, runs_set) = (
+            HybridSet::from_sorted(&dense),
+            HybridSet::from_sorted(&runs),
+        );
+        let expected: Vec<u32> = sparse
+            .iter()
+            .copied()
+            .filter(|&v| v % 3 != 0 && v & 0xffff < 20_000)
+            .collect();
+
+        let mixed = vec![
+            SetRef::from(&dense_set),
+            SetRef::from(&sparse),
+            SetRef::from(&runs_set),
+        ];
+        assert_eq!(intersect_multi_hybrid(mixed), expected);
+        assert_eq!(
+            intersect_hybrid(&dense_set, &runs, None),
+            intersect(&dense, &runs, None)
+        );
+    }
+
+    #[test]
+    fn test_intersect_generic() {
+        let x: Vec<u64> = (0..1000).map(|i| i * 3 << 32 | i).collect();
+        let y: Vec<u64> = (0..3000).map(|i| i << 32 | i / 3).collect();
+        let mut result = Vec::new();
+        assert_eq!(intersect_generic(&x, &y, Some(&mut result)), 1000);
+        assert_eq!(result, x);
+        assert_eq!(intersect_generic(&x[..10], &y, None), 10);
+
+        let x: Vec<u16> = (0..u16::MAX).step_by(6).collect();
+        let y: Vec<u16> = (0..u16::MAX).step_by(4).collect();
+        let mut result = Vec::new();
+        assert_eq!(
+            intersect_generic(&x, &y, Some(&mut result)),
+            (x.len() + 1) / 2
+        );
+        assert!(result.iter().all(|v| v % 12 == 0));
+        assert_eq!(intersect_generic(&y[..100], &x, None), 34);
+    }
+
+    #[test]
+    fn test_intersect_into() {
+        let x: Vec<u32> = (0..1000).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..3000).map(|i| i * 3).collect();
+        let z: Vec<u32> = (0..50).map(|i| i * 60).collect();
+        let mut out = vec![MaybeUninit::uninit(); 1000 + OUTPUT_SLACK];
+        for (a, b) in [(&x, &y), (&y, &x), (&z, &y), (&x, &z)] {
+            let mut expected = Vec::new();
+            intersect_scalar_merge(a, b, Some(&mut expected));
+            let count = intersect_into(a, b, &mut out);
+            let result: Vec<u32> = out[..count]
+                .iter()
+                .map(|v| unsafe { v.assume_init() })
+                .collect();
+            assert_eq!(result, expected);
+
+            let count = intersect_scalar_gallop_into(a, b, &mut out);
+            assert_eq!(count, expected.len());
+        }
+    }
+
+    #[test]
+    fn test_intersect_multi_bsr() {
+        let data = vec![
+            Cow::Owned(BsrSet::from_sorted(&[
+                0,
+                1,
+                2,
+                3,
+                5,
+                10,
+                11,
+                20,
+                30,
+                u32::MAX,
+            ])),
+            Cow::Owned(BsrSet::from_sorted(&[1, 3, 5, 10, 11, 70, u32::MAX])),
+            Cow::Owned(BsrSet::from_sorted(&[1, 2, 3, 5, 7, 10, 11, 90, u32::MAX])),
+        ];
+
+        assert_eq!(
+            intersect_multi_bsr(data).to_vec(),
+            vec![1, 3, 5, 10, 11, u32::MAX]
+        );
     }
 }
@@ -1,11 +1,35 @@
 #[macro_use]
 extern crate lazy_static;
 
+pub mod batch;
+pub mod bsr;
+pub mod compressed;
+pub mod cost_model;
+pub mod graph;
+pub mod hybrid;
+pub mod indexed;
 pub mod intersect;
+pub mod parallel;
+pub mod partitioned;
+pub mod perf;
+pub mod prepared;
+pub mod scratch;
+pub mod set_ops;
 #[cfg(feature = "simd")]
 pub mod simd_intersection;
+pub mod stats;
+pub mod stream;
 
 #[cfg(feature = "simd_new")]
 pub mod simd_intersection_new;
 
+pub use crate::bsr::BsrSet;
+pub use crate::compressed::CompressedSet;
+pub use crate::hybrid::HybridSet;
+pub use crate::indexed::IndexedSet;
 pub use crate::intersect::intersect_multi;
+pub use crate::parallel::intersect_par;
+pub use crate::partitioned::PartitionedSet;
+pub use crate::prepared::PreparedSet;
+pub use crate::set_ops::{difference_multi, union_multi};
+pub use crate::stream::IntersectStream;
@@ -0,0 +1,304 @@
+//! Multi-threaded intersection of very large pairs.
+//!
+//! Both inputs are cut at the same values, found by a merge-path search on the diagonals of the
+//! merged order, so every thread gets about the same number of elements and no match spans two
+//! chunks. The chunk results are then copied into the output in parallel.
+use std::env;
+use std::mem::MaybeUninit;
+use std::ptr;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::thread;
+
+use crate::intersect::intersect;
+
+/// Below this many elements per thread a pair is intersected on the calling thread.
+const INTERSECTION_PAR_MIN_LEN: usize = 1 << 16;
+
+lazy_static! {
+    /// Default is the available parallelism, 0 counts as 1
+    static ref THREADS: usize = env::var("INTERSECTION_THREADS").map(|n| n.parse::<usize>().unwrap().max(1)).unwrap_or_else(|_| {
+        thread::available_parallelism().map_or(1, |n| n.get())
+    });
+}
+
+/// The number of threads [`intersect_par`] splits a pair over, `INTERSECTION_THREADS` if set.
+pub fn num_threads() -> usize {
+    *THREADS
+}
+
+/// The split `(i, j)` with `i + j` close to `diagonal`, such that no value of `aaa[i..]` or
+/// `bbb[j..]` is below any value of `aaa[..i]` or `bbb[..j]`, and equal values stay together.
+fn merge_path(aaa: &[u32], bbb: &[u32], diagonal: usize) -> (usize, usize) {
+    // the number of values taken from `aaa` among the first `diagonal` of the merged order
+    let (mut lo, mut hi) = (diagonal.saturating_sub(bbb.len()), diagonal.min(aaa.len()));
+    while lo < hi {
+        let i = (lo + hi) / 2;
+        if aaa[i] < bbb[diagonal - i - 1] {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+
+    let (i, j) = (lo, diagonal - lo);
+    let pivot = match (aaa.get(i), bbb.get(j)) {
+        (Some(&a), Some(&b)) => a.min(b),
+        (Some(&a), None) => a,
+        (None, Some(&b)) => b,
+        (None, None) => return (i, j),
+    };
+
+    (
+        aaa.partition_point(|&x| x < pivot),
+        bbb.partition_point(|&x| x < pivot),
+    )
+}
+
+/// Cuts both inputs into `parts` chunk pairs of balanced total length.
+fn partition<'a>(aaa: &'a [u32], bbb: &'a [u32], parts: usize) -> Vec<(&'a [u32], &'a [u32])> {
+    let total = aaa.len() + bbb.len();
+    let mut splits: Vec<(usize, usize)> = (1..parts)
+        .map(|p| merge_path(aaa, bbb, total * p / parts))
+        .collect();
+    splits.insert(0, (0, 0));
+    splits.push((aaa.len(), bbb.len()));
+
+    splits
+        .windows(2)
+        .map(|w| (&aaa[w[0].0..w[1].0], &bbb[w[0].1..w[1].1]))
+        .collect()
+}
+
+/// [`intersect`] over [`num_threads`] threads.
+pub fn intersect_par(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    intersect_par_with(intersect, num_threads(), aaa, bbb, results)
+}
+
+/// Runs `kernel` on value-range chunks of both inputs over up to `threads` threads, the results
+/// are appended in order.
+pub fn intersect_par_with<F>(
+    kernel: F,
+    threads: usize,
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize
+where
+    F: Fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize + Sync,
+{
+    let parts = threads.min((aaa.len() + bbb.len()) / INTERSECTION_PAR_MIN_LEN);
+    if parts <= 1 || aaa.is_empty() || bbb.is_empty() {
+        return kernel(aaa, bbb, results);
+    }
+
+    let chunks = partition(aaa, bbb, parts);
+    let kernel = &kernel;
+
+    let results = match results {
+        Some(vec) => vec,
+        None => {
+            return thread::scope(|s| {
+                let handles: Vec<_> = chunks
+                    .iter()
+                    .map(|&(a, b)| s.spawn(move || kernel(a, b, None)))
+                    .collect();
+                handles.into_iter().map(|h| h.join().unwrap()).sum()
+            });
+        }
+    };
+
+    let partial: Vec<Vec<u32>> = thread::scope(|s| {
+        let handles: Vec<_> = chunks
+            .iter()
+            .map(|&(a, b)| {
+                s.spawn(move || {
+                    let mut vec = Vec::new();
+                    kernel(a, b, Some(&mut vec));
+                    vec
+                })
+            })
+            .collect();
+        handles.into_iter().map(|h| h.join().unwrap()).collect()
+    });
+
+    concat_par(&partial, threads, results)
+}
+
+/// Appends `parts` to `results` in order. The parts are cut into at most `threads` runs of
+/// consecutive parts of about equal length, each run copied on its own thread.
+pub(crate) fn concat_par(parts: &[Vec<u32>], threads: usize, results: &mut Vec<u32>) -> usize {
+    let count: usize = parts.iter().map(|vec| vec.len()).sum();
+    let len = results.len();
+    if count == 0 {
+        return 0;
+    }
+    results.reserve(count);
+
+    let threads = threads.clamp(1, parts.len());
+    let mut runs: Vec<&[Vec<u32>]> = Vec::with_capacity(threads);
+    let (mut start, mut copied) = (0, 0);
+    for (p, vec) in parts.iter().enumerate() {
+        copied += vec.len();
+        if copied * threads >= count * (runs.len() + 1) {
+            runs.push(&parts[start..p + 1]);
+            start = p + 1;
+        }
+    }
+
+    thread::scope(|s| {
+        let mut spare: &mut [MaybeUninit<u32>] = &mut results.spare_capacity_mut()[..count];
+        let mut first = None;
+        for run in runs {
+            let (dst, rest) = spare.split_at_mut(run.iter().map(|vec| vec.len()).sum());
+            spare = rest;
+            match first {
+                None => first = Some((run, dst)),
+                Some(_) => {
+                    s.spawn(move || copy_run(run, dst));
+                }
+            }
+        }
+        if let Some((run, dst)) = first {
+            copy_run(run, dst);
+        }
+    });
+
+    unsafe {
+        results.set_len(len + count);
+    }
+
+    count
+}
+
+/// Copies the consecutive `run` of parts into `dst`, which holds exactly their values.
+fn copy_run(run: &[Vec<u32>], dst: &mut [MaybeUninit<u32>]) {
+    let mut dst = dst.as_mut_ptr() as *mut u32;
+    for vec in run {
+        unsafe {
+            ptr::copy_nonoverlapping(vec.as_ptr(), dst, vec.len());
+            dst = dst.add(vec.len());
+        }
+    }
+}
+
+/// The tasks `[front, back)` one worker owns, packed into one word so that the owner popping
+/// the front and thieves taking the back agree through a single compare-and-swap.
+struct TaskRange(AtomicU64);
+
+impl TaskRange {
+    fn new(front: usize, back: usize) -> Self {
+        Self(AtomicU64::new(((front as u64) << 32) | back as u64))
+    }
+
+    fn take(&self, from_back: bool) -> Option<usize> {
+        let mut current = self.0.load(Ordering::Acquire);
+        loop {
+            let (front, back) = (current >> 32, current & u32::MAX as u64);
+            if front >= back {
+                return None;
+            }
+
+            let (next, task) = if from_back {
+                (current - 1, back - 1)
+            } else {
+                (current + (1 << 32), front)
+            };
+            match self
+                .0
+                .compare_exchange_weak(current, next, Ordering::AcqRel, Ordering::Acquire)
+            {
+                Ok(_) => return Some(task as usize),
+                Err(actual) => current = actual,
+            }
+        }
+    }
+}
+
+/// Runs `task(0..num_tasks)` over `threads` workers. Each worker starts on its own contiguous
+/// share of the tasks, and once that runs dry steals from the back of the others.
+pub(crate) fn for_each_stealing<F>(num_tasks: usize, threads: usize, task: F)
+where
+    F: Fn(usize) + Sync,
+{
+    assert!(num_tasks <= u32::MAX as usize);
+    let threads = threads.clamp(1, num_tasks.max(1));
+    let ranges: Vec<TaskRange> = (0..threads)
+        .map(|t| TaskRange::new(num_tasks * t / threads, num_tasks * (t + 1) / threads))
+        .collect();
+    let (ranges, task) = (&ranges, &task);
+
+    let worker = move |t: usize| {
+        while let Some(i) = ranges[t].take(false) {
+            task(i);
+        }
+        for victim in (1..threads).map(|v| (t + v) % threads) {
+            while let Some(i) = ranges[victim].take(true) {
+                task(i);
+            }
+        }
+    };
+
+    thread::scope(|s| {
+        for t in 1..threads {
+            s.spawn(move || worker(t));
+        }
+        worker(0);
+    });
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+    use std::sync::atomic::AtomicUsize;
+
+    #[test]
+    fn test_intersect_par() {
+        let x: Vec<u32> = (0..300_000).map(|i| i * 3).collect();
+        let y: Vec<u32> = (0..200_000).map(|i| i * 2).chain([u32::MAX]).collect();
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+        for (a, b) in partition(&x, &y, 7) {
+            assert!(a.len() + b.len() < (x.len() + y.len()) / 7 + 2);
+        }
+
+        for threads in [1, 2, 3, 8] {
+            let mut result = vec![42];
+            assert_eq!(
+                intersect_par_with(intersect, threads, &x, &y, Some(&mut result)),
+                expected.len()
+            );
+            assert_eq!(result[1..], expected);
+            assert_eq!(
+                intersect_par_with(intersect, threads, &y, &x, None),
+                expected.len()
+            );
+        }
+    }
+
+    #[test]
+    fn test_concat_par() {
+        let parts: Vec<Vec<u32>> = (0..50u32)
+            .map(|p| (0..p * 7 % 13).map(|i| p * 100 + i).collect())
+            .collect();
+        let expected: Vec<u32> = [42].into_iter().chain(parts.concat()).collect();
+        for threads in [1, 3, 8, 64] {
+            let mut result = vec![42];
+            assert_eq!(concat_par(&parts, threads, &mut result), expected.len() - 1);
+            assert_eq!(result, expected);
+        }
+        assert_eq!(concat_par(&[vec![], vec![]], 4, &mut Vec::new()), 0);
+    }
+
+    #[test]
+    fn test_for_each_stealing() {
+        for (num_tasks, threads) in [(0, 4), (1, 4), (100, 3), (1000, 8)] {
+            let runs: Vec<AtomicUsize> = (0..num_tasks).map(|_| AtomicUsize::new(0)).collect();
+            for_each_stealing(num_tasks, threads, |i| {
+                runs[i].fetch_add(1, Ordering::Relaxed);
+            });
+            assert!(runs.iter().all(|n| n.load(Ordering::Relaxed) == 1));
+        }
+    }
+}
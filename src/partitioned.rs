@@ -0,0 +1,142 @@
+//! The 16-bit partitioned layout of sorted `u32` sets.
+//!
+//! Schlegel B, Willhalm T, Lehner W. Fast sorted-set intersection using SIMD instructions[C]
+//! ADMS@VLDB. 2011: 1-8.
+//!
+//! Values are grouped by their high 16 bits, and each partition is stored as its high half, its
+//! length minus one, then its low halves, all as `u16`. Matching partitions compare 8 x 8 low
+//! halves per STTNI instruction, twice the density of the 4 x 4 kernels over 32-bit values.
+use crate::intersect::intersect_scalar_merge;
+
+#[derive(Clone, Debug, Default, PartialEq, Eq, Hash)]
+pub struct PartitionedSet {
+    words: Vec<u16>,
+    len: usize,
+}
+
+impl PartitionedSet {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Builds the set from sorted values, duplicates are allowed.
+    pub fn from_sorted(values: &[u32]) -> Self {
+        let mut set = Self::new();
+        set.words.reserve(values.len() + 2);
+        for chunk in values.chunk_by(|a, b| a >> 16 == b >> 16) {
+            let start = set.words.len();
+            set.words.extend([(chunk[0] >> 16) as u16, 0]);
+            for &v in chunk {
+                if set.words.len() == start + 2 || *set.words.last().unwrap() != v as u16 {
+                    set.words.push(v as u16);
+                }
+            }
+            let len = set.words.len() - start - 2;
+            set.words[start + 1] = (len - 1) as u16;
+            set.len += len;
+        }
+
+        set
+    }
+
+    /// The partitions back to back, as `[high, len - 1, low...]`.
+    #[inline(always)]
+    pub fn words(&self) -> &[u16] {
+        &self.words
+    }
+
+    /// The number of values in the set.
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Iterates over the partitions as (high half, low halves).
+    pub fn partitions(&self) -> impl Iterator<Item = (u16, &[u16])> + '_ {
+        let mut words = &self.words[..];
+        std::iter::from_fn(move || {
+            let (&[high, len], rest) = words.split_first_chunk()?;
+            let (lows, rest) = rest.split_at(len as usize + 1);
+            words = rest;
+            Some((high, lows))
+        })
+    }
+
+    pub fn to_vec(&self) -> Vec<u32> {
+        let mut vec = Vec::with_capacity(self.len);
+        for (high, lows) in self.partitions() {
+            vec.extend(lows.iter().map(|&v| (high as u32) << 16 | v as u32));
+        }
+
+        vec
+    }
+}
+
+impl From<&[u32]> for PartitionedSet {
+    fn from(values: &[u32]) -> Self {
+        Self::from_sorted(values)
+    }
+}
+
+/// Returns the number of values in the intersection, the values are appended to `results`.
+pub fn intersect_partitioned_scalar(
+    aaa: &PartitionedSet,
+    bbb: &PartitionedSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    let mut count = 0;
+    let mut lows = Vec::new();
+    let (mut parts_a, mut parts_b) = (aaa.partitions(), bbb.partitions());
+    let (mut a, mut b) = (parts_a.next(), parts_b.next());
+
+    while let (Some((high_a, lows_a)), Some((high_b, lows_b))) = (a, b) {
+        if high_a == high_b {
+            match results.as_mut() {
+                Some(vec) => {
+                    lows.clear();
+                    count += intersect_scalar_merge(lows_a, lows_b, Some(&mut lows));
+                    vec.extend(lows.iter().map(|&v| (high_a as u32) << 16 | v as u32));
+                }
+                None => count += intersect_scalar_merge(lows_a, lows_b, None),
+            }
+        }
+        if high_a <= high_b {
+            a = parts_a.next();
+        }
+        if high_b <= high_a {
+            b = parts_b.next();
+        }
+    }
+
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_partitioned_set() {
+        let values = vec![0, 1, 1, 2, 65_535, 65_536, 1 << 20, u32::MAX - 1, u32::MAX];
+        let set = PartitionedSet::from_sorted(&values);
+        assert_eq!(
+            set.words(),
+            &[0, 3, 0, 1, 2, 65_535, 1, 0, 0, 16, 0, 0, 65_535, 1, 65_534, 65_535]
+        );
+        assert_eq!(set.len(), 8);
+        let mut expected = values.clone();
+        expected.dedup();
+        assert_eq!(set.to_vec(), expected);
+
+        let x = PartitionedSet::from_sorted(&[1, 5, 65_536, 65_537, 1 << 20]);
+        let y = PartitionedSet::from_sorted(&[5, 6, 65_537, 1 << 20]);
+        let mut result = Vec::new();
+        assert_eq!(intersect_partitioned_scalar(&x, &y, Some(&mut result)), 3);
+        assert_eq!(result, vec![5, 65_537, 1 << 20]);
+    }
+}
@@ -0,0 +1,286 @@
+//! Hardware performance counters per kernel and size bucket.
+//!
+//! With the `perf` feature, every kernel call can be wrapped in a group of `perf_event_open`
+//! counters (cycles, instructions, branch misses, L1D read misses and LLC misses) on the calling
+//! thread. The deltas are summed per kernel name and per `log2` of `|A| + |B|`, so a regression
+//! can be pinned on, say, mispredicted double-jumps in galloping or cache misses on the QFilter
+//! tables. Counting is off until [`enable`] is called or `INTERSECTION_PERF=1` is set, and costs
+//! two `read` syscalls per call while on. Without the feature [`measure`] compiles to the call.
+
+/// Runs `f`, a call of `kernel` on inputs of `len` elements in total, counting it if enabled.
+#[cfg(not(feature = "perf"))]
+#[inline(always)]
+pub(crate) fn measure<R>(_kernel: &'static str, _len: usize, f: impl FnOnce() -> R) -> R {
+    f()
+}
+
+#[cfg(feature = "perf")]
+pub use self::counters::*;
+
+#[cfg(feature = "perf")]
+mod counters {
+    use std::cell::RefCell;
+    use std::collections::HashMap;
+    use std::env;
+    use std::io;
+    use std::mem;
+    use std::ops::AddAssign;
+    use std::sync::atomic::{AtomicBool, Ordering};
+    use std::sync::Mutex;
+
+    const PERF_TYPE_HARDWARE: u32 = 0;
+    const PERF_TYPE_HW_CACHE: u32 = 3;
+    const PERF_COUNT_HW_CPU_CYCLES: u64 = 0;
+    const PERF_COUNT_HW_INSTRUCTIONS: u64 = 1;
+    const PERF_COUNT_HW_CACHE_MISSES: u64 = 3;
+    const PERF_COUNT_HW_BRANCH_MISSES: u64 = 5;
+    /// L1D, read, miss.
+    const PERF_COUNT_HW_CACHE_L1D_READ_MISS: u64 = 1 << 16;
+    const PERF_FORMAT_GROUP: u64 = 1 << 3;
+    const PERF_FLAG_FD_CLOEXEC: libc::c_ulong = 1 << 3;
+    const EXCLUDE_KERNEL: u64 = 1 << 5;
+    const EXCLUDE_HV: u64 = 1 << 6;
+
+    /// The events of a group, the first one leading.
+    const EVENTS: [(u32, u64); 5] = [
+        (PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES),
+        (PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS),
+        (PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES),
+        (PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D_READ_MISS),
+        (PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES),
+    ];
+
+    /// `struct perf_event_attr` up to `PERF_ATTR_SIZE_VER5`.
+    #[repr(C)]
+    #[derive(Default)]
+    struct PerfEventAttr {
+        type_: u32,
+        size: u32,
+        config: u64,
+        sample_period: u64,
+        sample_type: u64,
+        read_format: u64,
+        flags: u64,
+        wakeup_events: u32,
+        bp_type: u32,
+        config1: u64,
+        config2: u64,
+        branch_sample_type: u64,
+        sample_regs_user: u64,
+        sample_stack_user: u32,
+        clockid: i32,
+        sample_regs_intr: u64,
+        aux_watermark: u32,
+        sample_max_stack: u16,
+        reserved: u16,
+    }
+
+    /// Summed counts of the calls in one (kernel, size bucket) cell.
+    #[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+    pub struct Counters {
+        pub calls: u64,
+        pub cycles: u64,
+        pub instructions: u64,
+        pub branch_misses: u64,
+        pub l1d_misses: u64,
+        pub llc_misses: u64,
+    }
+
+    impl Counters {
+        fn from_deltas(deltas: [u64; EVENTS.len()]) -> Self {
+            Counters {
+                calls: 1,
+                cycles: deltas[0],
+                instructions: deltas[1],
+                branch_misses: deltas[2],
+                l1d_misses: deltas[3],
+                llc_misses: deltas[4],
+            }
+        }
+    }
+
+    impl AddAssign for Counters {
+        fn add_assign(&mut self, other: Self) {
+            self.calls += other.calls;
+            self.cycles += other.cycles;
+            self.instructions += other.instructions;
+            self.branch_misses += other.branch_misses;
+            self.l1d_misses += other.l1d_misses;
+            self.llc_misses += other.llc_misses;
+        }
+    }
+
+    /// One thread's counter group.
+    struct Group {
+        fds: Vec<libc::c_int>,
+    }
+
+    impl Group {
+        fn open() -> io::Result<Self> {
+            let mut group = Group { fds: Vec::new() };
+            for (type_, config) in EVENTS {
+                let attr = PerfEventAttr {
+                    type_,
+                    size: mem::size_of::<PerfEventAttr>() as u32,
+                    config,
+                    read_format: PERF_FORMAT_GROUP,
+                    flags: EXCLUDE_KERNEL | EXCLUDE_HV,
+                    ..Default::default()
+                };
+                let leader = group.fds.first().copied().unwrap_or(-1);
+                let fd = unsafe {
+                    libc::syscall(
+                        libc::SYS_perf_event_open,
+                        &attr as *const PerfEventAttr,
+                        0,
+                        -1,
+                        leader,
+                        PERF_FLAG_FD_CLOEXEC,
+                    )
+                };
+                if fd < 0 {
+                    return Err(io::Error::last_os_error());
+                }
+                group.fds.push(fd as libc::c_int);
+            }
+
+            Ok(group)
+        }
+
+        fn read(&self) -> [u64; EVENTS.len()] {
+            // nr, then one value per event
+            let mut buf = [0u64; EVENTS.len() + 1];
+            let size = mem::size_of_val(&buf);
+            let n = unsafe { libc::read(self.fds[0], buf.as_mut_ptr() as *mut libc::c_void, size) };
+            let mut values = [0; EVENTS.len()];
+            if n as usize == size {
+                values.copy_from_slice(&buf[1..]);
+            }
+
+            values
+        }
+    }
+
+    impl Drop for Group {
+        fn drop(&mut self) {
+            for &fd in &self.fds {
+                unsafe {
+                    libc::close(fd);
+                }
+            }
+        }
+    }
+
+    lazy_static! {
+        static ref ENABLED: AtomicBool =
+            AtomicBool::new(env::var("INTERSECTION_PERF").map_or(false, |v| v == "1"));
+        static ref TOTALS: Mutex<HashMap<(&'static str, u32), Counters>> =
+            Mutex::new(HashMap::new());
+    }
+
+    thread_local! {
+        /// Opened on the first counted call, `None` if the host refused.
+        static GROUP: RefCell<Option<Option<Group>>> = const { RefCell::new(None) };
+    }
+
+    /// Starts counting on every thread. Fails, and stays off, if the calling thread cannot open
+    /// the counters, e.g. under a restrictive `perf_event_paranoid` or without a PMU.
+    pub fn enable() -> io::Result<()> {
+        GROUP.with(|group| -> io::Result<()> {
+            let mut group = group.borrow_mut();
+            if !matches!(*group, Some(Some(_))) {
+                *group = Some(Some(Group::open()?));
+            }
+            Ok(())
+        })?;
+        ENABLED.store(true, Ordering::Relaxed);
+
+        Ok(())
+    }
+
+    pub fn disable() {
+        ENABLED.store(false, Ordering::Relaxed);
+    }
+
+    pub fn is_enabled() -> bool {
+        ENABLED.load(Ordering::Relaxed)
+    }
+
+    /// The counts so far as (kernel, size bucket, counters), sorted. The bucket is
+    /// `log2(|A| + |B|)` rounded up.
+    pub fn snapshot() -> Vec<(&'static str, u32, Counters)> {
+        let mut cells: Vec<_> = TOTALS
+            .lock()
+            .unwrap()
+            .iter()
+            .map(|(&(kernel, bucket), &counters)| (kernel, bucket, counters))
+            .collect();
+        cells.sort_unstable_by_key(|&(kernel, bucket, _)| (kernel, bucket));
+
+        cells
+    }
+
+    pub fn reset() {
+        TOTALS.lock().unwrap().clear();
+    }
+
+    /// Runs `f`, a call of `kernel` on inputs of `len` elements in total, counting it if enabled.
+    #[inline(always)]
+    pub(crate) fn measure<R>(kernel: &'static str, len: usize, f: impl FnOnce() -> R) -> R {
+        if !is_enabled() {
+            return f();
+        }
+
+        GROUP.with(|group| {
+            let mut group = group.borrow_mut();
+            let group = group.get_or_insert_with(|| Group::open().ok());
+            let Some(group) = group.as_ref() else {
+                return f();
+            };
+
+            let before = group.read();
+            let result = f();
+            let after = group.read();
+
+            let mut deltas = [0; EVENTS.len()];
+            for e in 0..EVENTS.len() {
+                deltas[e] = after[e].wrapping_sub(before[e]);
+            }
+            let bucket = usize::BITS - len.saturating_sub(1).leading_zeros();
+            *TOTALS.lock().unwrap().entry((kernel, bucket)).or_default() +=
+                Counters::from_deltas(deltas);
+
+            result
+        })
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+        use crate::intersect::intersect;
+
+        #[test]
+        fn test_perf_counters() {
+            // hosts without a PMU, or with counting locked down, have nothing to check
+            if enable().is_err() {
+                return;
+            }
+            reset();
+
+            let x: Vec<u32> = (0..10_000).map(|i| i * 3).collect();
+            let y: Vec<u32> = (0..10_000).map(|i| i * 2).collect();
+            for _ in 0..10 {
+                intersect(&x, &y, None);
+            }
+
+            // other tests may run kernels meanwhile, so only check the cells of these calls
+            let cells: Vec<_> = snapshot()
+                .into_iter()
+                .filter(|&(_, bucket, _)| bucket == 15)
+                .collect();
+            assert!(cells.iter().map(|(_, _, c)| c.calls).sum::<u64>() >= 10);
+            assert!(cells.iter().all(|(_, _, c)| c.instructions > 0));
+            disable();
+        }
+    }
+}
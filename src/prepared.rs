@@ -0,0 +1,239 @@
+//! Large sets prepared once for many intersections with small ones.
+//!
+//! A [`PreparedSet`] answers membership in constant time, so [`intersect_prepared`] costs one
+//! probe per value of the small set, however large the prepared one. A set whose range is within
+//! 64 times its length gets a bitmap of that range, probed by AVX2 gathers with the `simd`
+//! feature. Any other set gets a hash table of 64-byte lines, each probe hashing to a line it
+//! compares whole, then moving to the next line only while the line is full.
+use crate::intersect::{intersect, GALLOP_OVERHEAD};
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::intersect_simd_bitmap;
+
+const LINE: usize = 16;
+/// Marks an empty slot of the hash table, `u32::MAX` itself is kept aside.
+const EMPTY: u32 = u32::MAX;
+/// The range over the length up to which a set gets a bitmap, 8 bytes a value at most.
+const BITMAP_SPREAD: u64 = 64;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+#[repr(C, align(64))]
+struct Line([u32; LINE]);
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+enum Probe {
+    /// Bit `x - base` is set for every `x`.
+    Bitmap { base: u32, words: Vec<u32> },
+    /// Open addressing by lines, half full at most.
+    Hash {
+        lines: Vec<Line>,
+        bits: u32,
+        has_max: bool,
+    },
+}
+
+/// The line of `x` in a table of `2^bits` lines, by Fibonacci hashing.
+#[inline(always)]
+fn line_of(x: u32, bits: u32) -> usize {
+    ((x.wrapping_mul(0x9e37_79b9) as u64) << bits >> 32) as usize
+}
+
+/// Whether `line` holds `x`, and whether it holds an empty slot, branch-free.
+#[inline(always)]
+fn scan(line: &Line, x: u32) -> (bool, bool) {
+    line.0.iter().fold((false, false), |(found, empty), &k| {
+        (found | (k == x), empty | (k == EMPTY))
+    })
+}
+
+/// A sorted set and its probe structure.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct PreparedSet<'a> {
+    values: &'a [u32],
+    probe: Probe,
+}
+
+impl<'a> PreparedSet<'a> {
+    /// Builds the bitmap or hash table of sorted `values`.
+    pub fn new(values: &'a [u32]) -> Self {
+        let probe = match (values.first(), values.last()) {
+            (Some(&min), Some(&max))
+                if (max - min) as u64 + 1 <= BITMAP_SPREAD * values.len() as u64 =>
+            {
+                let mut words = vec![0u32; ((max - min) as usize >> 5) + 1];
+                for &v in values {
+                    let bit = (v - min) as usize;
+                    words[bit >> 5] |= 1 << (bit & 31);
+                }
+                Probe::Bitmap { base: min, words }
+            }
+            _ => {
+                let bits = (2 * values.len())
+                    .div_ceil(LINE)
+                    .next_power_of_two()
+                    .trailing_zeros();
+                let mut lines = vec![Line([EMPTY; LINE]); 1 << bits];
+                let mask = lines.len() - 1;
+                for &v in values.iter().filter(|&&v| v != EMPTY) {
+                    let mut l = line_of(v, bits);
+                    loop {
+                        if let Some(slot) = lines[l].0.iter_mut().find(|k| **k == EMPTY) {
+                            *slot = v;
+                            break;
+                        }
+                        l = (l + 1) & mask;
+                    }
+                }
+                Probe::Hash {
+                    lines,
+                    bits,
+                    has_max: values.last() == Some(&EMPTY),
+                }
+            }
+        };
+
+        Self { values, probe }
+    }
+
+    #[inline(always)]
+    pub fn values(&self) -> &'a [u32] {
+        self.values
+    }
+
+    #[inline(always)]
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    #[inline(always)]
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// Whether the set got a bitmap rather than a hash table.
+    #[inline(always)]
+    pub fn is_bitmap(&self) -> bool {
+        matches!(self.probe, Probe::Bitmap { .. })
+    }
+
+    #[inline(always)]
+    pub fn contains(&self, x: u32) -> bool {
+        match &self.probe {
+            Probe::Bitmap { base, words } => {
+                let bit = x.wrapping_sub(*base) as usize;
+                words
+                    .get(bit >> 5)
+                    .is_some_and(|&word| word >> (bit & 31) & 1 != 0)
+            }
+            Probe::Hash {
+                lines,
+                bits,
+                has_max,
+            } => {
+                if x == EMPTY {
+                    return *has_max;
+                }
+                let mask = lines.len() - 1;
+                let mut l = line_of(x, *bits);
+                loop {
+                    match scan(&lines[l], x) {
+                        (true, _) => return true,
+                        (false, true) => return false,
+                        _ => l = (l + 1) & mask,
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Probes every value of `aaa` in `bbb`, returns the number of values in the intersection, the
+/// values are appended to `results`.
+pub fn intersect_prepared_probe(
+    aaa: &[u32],
+    bbb: &PreparedSet,
+    mut results: Option<&mut Vec<u32>>,
+) -> usize {
+    #[cfg(feature = "simd")]
+    if let Probe::Bitmap { base, words } = &bbb.probe {
+        return intersect_simd_bitmap(aaa, words, *base, results);
+    }
+
+    let mut count = 0;
+    for &a in aaa {
+        if bbb.contains(a) {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(a);
+            }
+        }
+    }
+
+    count
+}
+
+/// [`intersect`] of a flat set and a prepared one: probes replace galloping, other pairs run on
+/// the values.
+#[inline(always)]
+pub fn intersect_prepared(aaa: &[u32], bbb: &PreparedSet, results: Option<&mut Vec<u32>>) -> usize {
+    if aaa.len() < bbb.len() / *GALLOP_OVERHEAD {
+        intersect_prepared_probe(aaa, bbb, results)
+    } else {
+        intersect(aaa, bbb.values(), results)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_prepared_set() {
+        let dense: Vec<u32> = (0..5000).map(|i| i * 3 + 100).collect();
+        let sparse: Vec<u32> = (0..5000u32)
+            .map(|i| i.wrapping_mul(0x9e37_79b9) >> 2)
+            .collect::<std::collections::BTreeSet<_>>()
+            .into_iter()
+            .chain([u32::MAX - 1, u32::MAX])
+            .collect();
+        let full = [0, u32::MAX];
+
+        for (values, bitmap) in [(&dense[..], true), (&sparse[..], false), (&full[..], false)] {
+            let set = PreparedSet::new(values);
+            assert_eq!(set.is_bitmap(), bitmap);
+            for &v in values {
+                assert!(set.contains(v));
+            }
+
+            let probes: Vec<u32> = (0..3000u32)
+                .map(|i| i.wrapping_mul(7919) % 20_000)
+                .chain(values.iter().step_by(7).copied())
+                .chain([0, 99, 100, u32::MAX - 1, u32::MAX])
+                .collect::<std::collections::BTreeSet<_>>()
+                .into_iter()
+                .collect();
+            for &x in &probes {
+                assert_eq!(set.contains(x), values.binary_search(&x).is_ok(), "{}", x);
+            }
+
+            let mut expected = Vec::new();
+            intersect_scalar_merge(&probes, values, Some(&mut expected));
+            for small in [&probes[..], &probes[..20], &[]] {
+                let expected: Vec<u32> = expected
+                    .iter()
+                    .copied()
+                    .filter(|v| small.binary_search(v).is_ok())
+                    .collect();
+                let mut result = vec![42];
+                assert_eq!(
+                    intersect_prepared_probe(small, &set, Some(&mut result)),
+                    expected.len()
+                );
+                assert_eq!(result[1..], expected[..]);
+                assert_eq!(intersect_prepared(small, &set, None), expected.len());
+            }
+        }
+        assert!(!PreparedSet::new(&[]).contains(0));
+    }
+}
@@ -0,0 +1,256 @@
+//! Reusable buffers for multi-way and pairwise intersections.
+//!
+//! A [`Scratch`] keeps two 64-byte aligned buffers, padded by
+//! [`OUTPUT_SLACK`](crate::intersect::OUTPUT_SLACK), that the intermediate and final results are
+//! written into, and the index vectors a multi-way intersection sorts, so once it has grown to
+//! the working set a query allocates nothing. Results are borrowed from the scratch until its
+//! next use. [`with_scratch`] lends out the calling thread's own.
+use std::cell::RefCell;
+use std::mem::{self, MaybeUninit};
+use std::slice;
+
+use crate::intersect::{intersect_early_exit, intersect_into, GALLOP_OVERHEAD, OUTPUT_SLACK};
+use crate::stats;
+
+#[cfg(not(feature = "simd"))]
+use crate::intersect::intersect_adaptive_by;
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::intersect_simd_kway_into;
+
+const BLOCK: usize = 16;
+
+#[derive(Clone, Copy)]
+#[repr(C, align(64))]
+struct Block([u32; BLOCK]);
+
+/// A growable buffer of whole cache lines.
+#[derive(Default)]
+struct Buffer {
+    blocks: Vec<Block>,
+}
+
+impl Buffer {
+    /// At least `len` elements. They are initialized, if only to stale values.
+    #[inline(always)]
+    fn get(&mut self, len: usize) -> &mut [MaybeUninit<u32>] {
+        let blocks = len.div_ceil(BLOCK);
+        if self.blocks.len() < blocks {
+            self.blocks.resize(blocks, Block([0; BLOCK]));
+        }
+
+        let len = self.blocks.len() * BLOCK;
+        unsafe { slice::from_raw_parts_mut(self.blocks.as_mut_ptr() as *mut MaybeUninit<u32>, len) }
+    }
+
+    #[inline(always)]
+    fn as_slice(&self, len: usize) -> &[u32] {
+        assert!(len <= self.blocks.len() * BLOCK);
+        unsafe { slice::from_raw_parts(self.blocks.as_ptr() as *const u32, len) }
+    }
+}
+
+/// The vectors a walk over all sets at once keeps.
+#[derive(Default)]
+struct Walk {
+    #[cfg(feature = "simd")]
+    addresses: Vec<usize>,
+    #[cfg(feature = "simd")]
+    sizes: Vec<i32>,
+    #[cfg(not(feature = "simd"))]
+    cursors: Vec<usize>,
+}
+
+impl Walk {
+    /// The intersection of `first` and the `sets` at `rest`, by the adaptive k-way kernel or
+    /// [`intersect_adaptive_by`], into `out`, which must hold `first`.
+    #[inline(always)]
+    fn run(
+        &mut self,
+        first: &[u32],
+        sets: &[&[u32]],
+        rest: &[usize],
+        out: &mut [MaybeUninit<u32>],
+    ) -> usize {
+        #[cfg(feature = "simd")]
+        {
+            self.addresses.clear();
+            self.addresses.push(first.as_ptr() as usize);
+            self.addresses
+                .extend(rest.iter().map(|&i| sets[i].as_ptr() as usize));
+            self.sizes.clear();
+            self.sizes.push(first.len() as i32);
+            self.sizes
+                .extend(rest.iter().map(|&i| sets[i].len() as i32));
+
+            unsafe { intersect_simd_kway_into(&self.addresses, &self.sizes, out) }
+        }
+        #[cfg(not(feature = "simd"))]
+        {
+            let set = |l: usize| if l == 0 { first } else { sets[rest[l - 1]] };
+            let mut count = 0;
+            intersect_adaptive_by(rest.len() + 1, set, &mut self.cursors, |v| {
+                out[count].write(v);
+                count += 1;
+                true
+            });
+
+            count
+        }
+    }
+}
+
+#[derive(Default)]
+pub struct Scratch {
+    buffers: [Buffer; 2],
+    order: Vec<usize>,
+    walk: Walk,
+}
+
+impl Scratch {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The intersection of `aaa` and `bbb` by [`intersect`](crate::intersect::intersect).
+    pub fn intersect(&mut self, aaa: &[u32], bbb: &[u32]) -> &[u32] {
+        let buffer = &mut self.buffers[0];
+        let count = intersect_into(
+            aaa,
+            bbb,
+            buffer.get(aaa.len().min(bbb.len()) + OUTPUT_SLACK),
+        );
+
+        buffer.as_slice(count)
+    }
+
+    /// The intersection of all `sets`, as [`intersect_multi`](crate::intersect::intersect_multi)
+    /// computes it. With a single set, that set is returned.
+    pub fn intersect_multi<'a>(&'a mut self, sets: &[&'a [u32]]) -> &'a [u32] {
+        match sets {
+            [] => return &[],
+            [set] => return set,
+            _ => {}
+        }
+
+        self.order.clear();
+        self.order.extend(0..sets.len());
+        self.order.sort_unstable_by_key(|&i| sets[i].len());
+        let (first, second) = (sets[self.order[0]], sets[self.order[1]]);
+
+        // Walk them all at once when the smallest would be galloped through every other one. The
+        // SIMD probes of the kernel pay for the walk over galloping pair by pair.
+        #[cfg(feature = "simd")]
+        if sets.len() > 2 && first.len() < second.len() / *GALLOP_OVERHEAD {
+            let buffer = &mut self.buffers[0];
+            let count = self
+                .walk
+                .run(first, sets, &self.order[1..], buffer.get(first.len()));
+            stats::record_multi(true, 0);
+
+            return buffer.as_slice(count);
+        }
+
+        let [mut intersected, mut buffer] = self.buffers.each_mut();
+        let out = intersected.get(first.len().min(second.len()) + OUTPUT_SLACK);
+        let mut count = intersect_into(first, second, out);
+
+        for (i, &s) in self.order.iter().enumerate().skip(2) {
+            if count == 0 {
+                stats::record_multi(false, sets.len() - i);
+                return &[];
+            }
+
+            // The same once the result so far would be galloped through every set left, which
+            // may then cut it short together.
+            if count < sets[s].len() / *GALLOP_OVERHEAD {
+                let partial = intersected.as_slice(count);
+                let count = self
+                    .walk
+                    .run(partial, sets, &self.order[i..], buffer.get(count));
+                stats::record_multi(true, 0);
+
+                return buffer.as_slice(count);
+            }
+
+            let out = buffer.get(count + OUTPUT_SLACK);
+            count = intersect_into(intersected.as_slice(count), sets[s], out);
+            mem::swap(&mut intersected, &mut buffer);
+        }
+        stats::record_multi(false, 0);
+
+        intersected.as_slice(count)
+    }
+
+    /// The number of values at least two `sets`, sorted by length, share, counted up to `k`. They
+    /// are intersected pair by pair from the smallest, stopping as soon as fewer than `k` values
+    /// are left, and the last pair stops at the `k`-th match.
+    pub(crate) fn count_up_to(&mut self, sets: &[&[u32]], k: usize) -> usize {
+        let (largest, rest) = sets.split_last().unwrap();
+        let [mut intersected, mut buffer] = self.buffers.each_mut();
+        let mut count = rest[0].len();
+        let mut partial = rest[0];
+
+        for (i, &set) in rest.iter().enumerate().skip(1) {
+            if count < k {
+                stats::record_multi(false, sets.len() - i);
+                return count;
+            }
+
+            let out = buffer.get(count.min(set.len()) + OUTPUT_SLACK);
+            count = intersect_into(partial, set, out);
+            mem::swap(&mut intersected, &mut buffer);
+            partial = intersected.as_slice(count);
+        }
+        stats::record_multi(false, 0);
+
+        intersect_early_exit(partial, largest, k, None)
+    }
+}
+
+thread_local! {
+    static SCRATCH: RefCell<Scratch> = RefCell::new(Scratch::new());
+}
+
+/// Runs `f` with the calling thread's scratch, or with a fresh one when called from inside `f`.
+pub fn with_scratch<R>(f: impl FnOnce(&mut Scratch) -> R) -> R {
+    SCRATCH.with(|scratch| match scratch.try_borrow_mut() {
+        Ok(mut scratch) => f(&mut scratch),
+        Err(_) => f(&mut Scratch::new()),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_scalar_merge;
+
+    #[test]
+    fn test_scratch() {
+        let x: Vec<u32> = (0..1000).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..3000).map(|i| i * 3).collect();
+        let z: Vec<u32> = (0..100).map(|i| i * 12 + 6).collect();
+        let w: Vec<u32> = (0..2000).map(|i| i * 2 + 1).collect();
+
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+        let mut scratch = Scratch::new();
+        assert_eq!(scratch.intersect(&x, &y), expected);
+        assert_eq!(scratch.intersect_multi(&[&x, &y]), expected);
+        assert_eq!(scratch.intersect_multi(&[&y]), y);
+        assert!(scratch.intersect_multi(&[]).is_empty());
+
+        let xyz: Vec<u32> = z.iter().copied().filter(|v| v % 6 == 0).collect();
+        assert_eq!(scratch.intersect_multi(&[&x, &y, &z]), xyz);
+        assert!(scratch.intersect_multi(&[&x, &w, &y, &z]).is_empty());
+
+        // the buffers are 64-byte aligned
+        let result = with_scratch(|scratch| {
+            let result = scratch.intersect_multi(&[&y, &x, &x]);
+            assert_eq!(result.as_ptr() as usize % 64, 0);
+            with_scratch(|nested| assert_eq!(nested.intersect(&x, &y), expected));
+            result.to_vec()
+        });
+        assert_eq!(result, expected);
+    }
+}
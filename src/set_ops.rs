@@ -0,0 +1,305 @@
+//! Union, difference and symmetric difference of sorted `u32` sets, the counterparts of
+//! [`intersect`] and [`intersect_multi`](crate::intersect::intersect_multi).
+//!
+//! With the `simd` feature they run the C++ kernels, which merge both sets through a 4 x 4
+//! min/max network and keep the lanes that are not repeated. Counts alone follow from the size
+//! of the intersection, and a difference from a much smaller set gallops.
+use std::borrow::Cow;
+use std::cmp::{Ordering, Reverse};
+use std::collections::BinaryHeap;
+use std::mem;
+
+use crate::intersect::{gallop, intersect, GALLOP_OVERHEAD};
+
+#[cfg(feature = "simd")]
+use crate::simd_intersection::{difference_simd, symmetric_difference_simd, union_simd};
+
+#[inline(always)]
+pub fn union_scalar_merge<T: Copy + Ord>(
+    mut aaa: &[T],
+    mut bbb: &[T],
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let mut count = 0;
+    let mut push = |v: T| {
+        count += 1;
+        if let Some(vec) = results.as_mut() {
+            vec.push(v);
+        }
+    };
+
+    while let (Some(&a), Some(&b)) = (aaa.first(), bbb.first()) {
+        match a.cmp(&b) {
+            Ordering::Less => {
+                push(a);
+                aaa = &aaa[1..];
+            }
+            Ordering::Greater => {
+                push(b);
+                bbb = &bbb[1..];
+            }
+            Ordering::Equal => {
+                push(a);
+                aaa = &aaa[1..];
+                bbb = &bbb[1..];
+            }
+        }
+    }
+    if let Some(vec) = results {
+        vec.extend_from_slice(aaa);
+        vec.extend_from_slice(bbb);
+    }
+
+    count + aaa.len() + bbb.len()
+}
+
+/// The values of `aaa` not in `bbb`.
+#[inline(always)]
+pub fn difference_scalar_merge<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let mut count = 0;
+
+    for &a in aaa {
+        while !bbb.is_empty() && bbb[0] < a {
+            bbb = &bbb[1..];
+        }
+        if bbb.first() != Some(&a) {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(a);
+            }
+        }
+    }
+
+    count
+}
+
+/// [`difference_scalar_merge`] galloping through `bbb`, for a much smaller `aaa`.
+#[inline(always)]
+pub fn difference_scalar_gallop<T: Copy + Ord>(
+    aaa: &[T],
+    mut bbb: &[T],
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let mut count = 0;
+
+    for a in aaa {
+        bbb = gallop(bbb, a);
+        if bbb.first() != Some(a) {
+            count += 1;
+            if let Some(vec) = results.as_mut() {
+                vec.push(*a);
+            }
+        }
+    }
+
+    count
+}
+
+/// The values in exactly one of `aaa` and `bbb`.
+#[inline(always)]
+pub fn symmetric_difference_scalar_merge<T: Copy + Ord>(
+    mut aaa: &[T],
+    mut bbb: &[T],
+    mut results: Option<&mut Vec<T>>,
+) -> usize {
+    let mut count = 0;
+    let mut push = |v: T| {
+        count += 1;
+        if let Some(vec) = results.as_mut() {
+            vec.push(v);
+        }
+    };
+
+    while let (Some(&a), Some(&b)) = (aaa.first(), bbb.first()) {
+        match a.cmp(&b) {
+            Ordering::Less => {
+                push(a);
+                aaa = &aaa[1..];
+            }
+            Ordering::Greater => {
+                push(b);
+                bbb = &bbb[1..];
+            }
+            Ordering::Equal => {
+                aaa = &aaa[1..];
+                bbb = &bbb[1..];
+            }
+        }
+    }
+    if let Some(vec) = results {
+        vec.extend_from_slice(aaa);
+        vec.extend_from_slice(bbb);
+    }
+
+    count + aaa.len() + bbb.len()
+}
+
+/// Returns the number of values in the union, the values are appended to `results`.
+#[inline(always)]
+pub fn union(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    #[cfg(feature = "simd")]
+    {
+        union_simd(aaa, bbb, results)
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        match results {
+            Some(vec) => union_scalar_merge(aaa, bbb, Some(vec)),
+            None => aaa.len() + bbb.len() - intersect(aaa, bbb, None),
+        }
+    }
+}
+
+/// Returns the number of values of `aaa` not in `bbb`, the values are appended to `results`.
+#[inline(always)]
+pub fn difference(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    if results.is_none() {
+        return aaa.len() - intersect(aaa, bbb, None);
+    }
+    if aaa.len() < bbb.len() / *GALLOP_OVERHEAD {
+        return difference_scalar_gallop(aaa, bbb, results);
+    }
+
+    #[cfg(feature = "simd")]
+    {
+        difference_simd(aaa, bbb, results)
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        difference_scalar_merge(aaa, bbb, results)
+    }
+}
+
+/// Returns the number of values in exactly one of `aaa` and `bbb`, the values are appended to
+/// `results`.
+#[inline(always)]
+pub fn symmetric_difference(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    #[cfg(feature = "simd")]
+    {
+        symmetric_difference_simd(aaa, bbb, results)
+    }
+    #[cfg(not(feature = "simd"))]
+    {
+        match results {
+            Some(vec) => symmetric_difference_scalar_merge(aaa, bbb, Some(vec)),
+            None => aaa.len() + bbb.len() - 2 * intersect(aaa, bbb, None),
+        }
+    }
+}
+
+/// The union of all sets. The two smallest are merged first, so every value is copied about
+/// `log2(k)` times at most.
+pub fn union_multi(to_union: Vec<Cow<[u32]>>) -> Vec<u32> {
+    let mut sets = to_union;
+    let mut heap: BinaryHeap<Reverse<(usize, usize)>> = sets
+        .iter()
+        .enumerate()
+        .map(|(i, set)| Reverse((set.len(), i)))
+        .collect();
+
+    while heap.len() > 1 {
+        let Reverse((_, i)) = heap.pop().unwrap();
+        let Reverse((_, j)) = heap.pop().unwrap();
+        let mut merged = Vec::new();
+        union(&sets[i], &sets[j], Some(&mut merged));
+        sets[i] = Cow::Owned(merged);
+        sets[j] = Cow::default();
+        heap.push(Reverse((sets[i].len(), i)));
+    }
+
+    heap.pop().map_or(Vec::new(), |Reverse((_, i))| {
+        mem::take(&mut sets[i]).into_owned()
+    })
+}
+
+/// The values of the first set in none of the others.
+pub fn difference_multi(to_subtract: Vec<Cow<[u32]>>) -> Vec<u32> {
+    let mut sets = to_subtract.into_iter();
+    let mut result = match sets.next() {
+        Some(first) => first.into_owned(),
+        None => return Vec::new(),
+    };
+
+    let mut buffer = Vec::new();
+    for set in sets {
+        if result.is_empty() {
+            break;
+        }
+        buffer.clear();
+        difference(&result, &set, Some(&mut buffer));
+        mem::swap(&mut result, &mut buffer);
+    }
+
+    result
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::BTreeSet;
+
+    #[test]
+    fn test_set_ops() {
+        let sets: Vec<Vec<u32>> = vec![
+            vec![],
+            vec![7],
+            vec![0, 1, 2, u32::MAX],
+            (0..1000).map(|i| i * 2).collect(),
+            (0..1000).map(|i| i * 3).collect(),
+            (0..100).map(|i| i * 37 + 1).collect(),
+            (0..3001).collect(),
+            (0..20).map(|i| i * 500 + 4).chain([u32::MAX]).collect(),
+        ];
+
+        for x in &sets {
+            for y in &sets {
+                let (bx, by): (BTreeSet<u32>, BTreeSet<u32>) =
+                    (x.iter().copied().collect(), y.iter().copied().collect());
+                let expected: [Vec<u32>; 3] = [
+                    bx.union(&by).copied().collect(),
+                    bx.difference(&by).copied().collect(),
+                    bx.symmetric_difference(&by).copied().collect(),
+                ];
+                let ops: [fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize; 3] =
+                    [union, difference, symmetric_difference];
+                let scalar: [fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize; 3] = [
+                    union_scalar_merge,
+                    difference_scalar_merge,
+                    symmetric_difference_scalar_merge,
+                ];
+
+                for ((op, scalar), expected) in ops.iter().zip(scalar).zip(&expected) {
+                    let mut result = vec![42];
+                    assert_eq!(op(x, y, Some(&mut result)), expected.len());
+                    assert_eq!(result[1..], expected[..]);
+                    assert_eq!(op(x, y, None), expected.len());
+                    let mut result = Vec::new();
+                    assert_eq!(scalar(x, y, Some(&mut result)), expected.len());
+                    assert_eq!(&result, expected);
+                }
+                let mut result = Vec::new();
+                difference_scalar_gallop(x, y, Some(&mut result));
+                assert_eq!(result, expected[1]);
+            }
+        }
+
+        let all: BTreeSet<u32> = sets.iter().flatten().copied().collect();
+        let cows: Vec<Cow<[u32]>> = sets.iter().map(Cow::from).collect();
+        assert_eq!(
+            union_multi(cows.clone()),
+            all.into_iter().collect::<Vec<_>>()
+        );
+        let rest: BTreeSet<u32> = sets[4..].iter().flatten().copied().collect();
+        let expected: Vec<u32> = sets[3]
+            .iter()
+            .copied()
+            .filter(|v| !rest.contains(v))
+            .collect();
+        assert_eq!(difference_multi(cows[3..].to_vec()), expected);
+        assert!(union_multi(Vec::new()).is_empty());
+    }
+}
@@ -1,7 +1,16 @@
 /// https://github.com/pkumod/GraphSetIntersection/blob/master/src/intersection_algos.cpp
 /// Han S, Zou L, Yu J X. Speeding up set intersections in graph algorithms using simd instructions[C]
 /// Proceedings of the 2018 International Conference on Management of Data. 2018: 1587-1602.
-use crate::intersect::{intersect_scalar_gallop, intersect_scalar_merge};
+use std::mem::MaybeUninit;
+use std::ptr::NonNull;
+
+use crate::bsr::BsrSet;
+use crate::intersect::{
+    intersect_scalar_gallop, intersect_scalar_gallop_into, intersect_scalar_merge,
+    intersect_scalar_merge_into,
+};
+use crate::partitioned::PartitionedSet;
+use crate::perf::measure;
 
 #[cxx::bridge]
 mod ffi {
@@ -9,6 +18,12 @@ mod ffi {
     unsafe extern "C++" {
         include!("intersection/include/intersection_algos.hpp");
 
+        fn intersection_max_isa_level() -> i32;
+
+        fn intersection_isa_level() -> i32;
+
+        fn intersection_set_isa_level(level: i32) -> bool;
+
         unsafe fn intersect_simdgalloping_uint(
             set_a: *const u32,
             size_a: i32,
@@ -27,13 +42,289 @@ mod ffi {
             count_only: bool,
         ) -> i32;
 
-        // unsafe fn intersect_shuffle_uint_b4(
-        //     set_a: *const i32,
-        //     size_a: i32,
-        //     set_b: *const i32,
-        //     size_b: i32,
-        //     set_c: *mut i32,
-        // ) -> i32;
+        unsafe fn intersect_qfilter_uint_b8(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_uint_b16(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_scalarmerge_bsr(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_scalargalloping_bsr(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_simdgalloping_bsr(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_bsr_b4(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_bsr_b4_v2(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_bsr_b4(
+            bases_a: *const u32,
+            states_a: *const u32,
+            size_a: i32,
+            bases_b: *const u32,
+            states_b: *const u32,
+            size_b: i32,
+            bases_c: *mut u32,
+            states_c: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_uint_b4(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_uint_b8(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_uint_vec256(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_kway_uint(
+            sets: *const usize,
+            sizes: *const i32,
+            k: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_bitmap_uint(
+            set_a: *const u32,
+            size_a: i32,
+            words: *const u32,
+            base: u32,
+            num_words: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_batch_uint(
+            values: *const u32,
+            offsets: *const usize,
+            pairs: *const u32,
+            num_pairs: i32,
+            gallop_overhead: i32,
+            set_c: *mut u32,
+            offsets_c: *mut usize,
+            count_only: bool,
+        ) -> usize;
+
+        unsafe fn intersect_galloping_uint_positions(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            positions: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_galloping_uint_callback(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            callback: usize,
+            context: usize,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_uint_positions(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            positions: *mut u32,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_uint_callback(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            callback: usize,
+            context: usize,
+        ) -> i32;
+
+        unsafe fn intersect_galloping_u64(
+            set_a: *const u64,
+            size_a: i32,
+            set_b: *const u64,
+            size_b: i32,
+            set_c: *mut u64,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_u64(
+            set_a: *const u64,
+            size_a: i32,
+            set_b: *const u64,
+            size_b: i32,
+            set_c: *mut u64,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_u64(
+            set_a: *const u64,
+            size_a: i32,
+            set_b: *const u64,
+            size_b: i32,
+            set_c: *mut u64,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_galloping_u16(
+            set_a: *const u16,
+            size_a: i32,
+            set_b: *const u16,
+            size_b: i32,
+            set_c: *mut u16,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_u16(
+            set_a: *const u16,
+            size_a: i32,
+            set_b: *const u16,
+            size_b: i32,
+            set_c: *mut u16,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_shuffle_u16(
+            set_a: *const u16,
+            size_a: i32,
+            set_b: *const u16,
+            size_b: i32,
+            set_c: *mut u16,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_partitioned_u16(
+            part_a: *const u16,
+            size_a: i32,
+            part_b: *const u16,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn set_union_uint(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn set_difference_uint(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn set_symmetric_difference_uint(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_galloping_uint_limit(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            limit: i32,
+            count_only: bool,
+        ) -> i32;
+
+        unsafe fn intersect_qfilter_uint_limit(
+            set_a: *const u32,
+            size_a: i32,
+            set_b: *const u32,
+            size_b: i32,
+            set_c: *mut u32,
+            limit: i32,
+            count_only: bool,
+        ) -> i32;
 
         // unsafe fn intersect_qfilter_uint_b4_v2(
         //     set_a: *const i32,
@@ -45,90 +336,1053 @@ mod ffi {
     }
 }
 
+/// The instruction set levels the C++ kernels are compiled for, see `include/dispatch.hpp`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum IsaLevel {
+    Scalar,
+    Sse42,
+    Avx2,
+    Avx512,
+}
+
+impl IsaLevel {
+    pub const ALL: [IsaLevel; 4] = [
+        IsaLevel::Scalar,
+        IsaLevel::Sse42,
+        IsaLevel::Avx2,
+        IsaLevel::Avx512,
+    ];
+
+    fn from_raw(level: i32) -> Self {
+        Self::ALL[level as usize]
+    }
+}
+
+/// The highest level the host supports, detected with cpuid at startup.
+pub fn max_isa_level() -> IsaLevel {
+    IsaLevel::from_raw(ffi::intersection_max_isa_level())
+}
+
+/// The level every kernel currently runs at. It defaults to [`max_isa_level`], unless the
+/// `INTERSECTION_ISA` env var (`scalar`, `sse4.2`, `avx2` or `avx512`) names a lower one.
+pub fn isa_level() -> IsaLevel {
+    IsaLevel::from_raw(ffi::intersection_isa_level())
+}
+
+/// Runs every kernel at `level` from now on, so that benchmarks and tests can cover each
+/// variant on one machine. Returns `false`, keeping the current level, if the host lacks it.
+pub fn set_isa_level(level: IsaLevel) -> bool {
+    ffi::intersection_set_isa_level(level as i32)
+}
+
+/// Goes back to the level picked at startup.
+pub fn reset_isa_level() {
+    ffi::intersection_set_isa_level(-1);
+}
+
+/// The levels the host supports, from the lowest to the highest.
+pub fn supported_isa_levels() -> impl Iterator<Item = IsaLevel> {
+    let max = max_isa_level();
+    IsaLevel::ALL.into_iter().filter(move |&level| level <= max)
+}
+
+type Kernel<T> = unsafe fn(*const T, i32, *const T, i32, *mut T, bool) -> i32;
+
+#[inline(always)]
+fn call<T>(
+    name: &'static str,
+    kernel: Kernel<T>,
+    aaa: &[T],
+    bbb: &[T],
+    set_c: *mut T,
+    count_only: bool,
+) -> usize {
+    measure(name, aaa.len() + bbb.len(), || unsafe {
+        kernel(
+            aaa.as_ptr(),
+            aaa.len() as i32,
+            bbb.as_ptr(),
+            bbb.len() as i32,
+            set_c,
+            count_only,
+        ) as usize
+    })
+}
+
+/// Runs a kernel that may store up to `slack` elements past its count into `out`, which must
+/// hold `min(|A|, |B|) + slack` elements.
+#[inline(always)]
+fn intersect_into_with<T>(
+    name: &'static str,
+    kernel: Kernel<T>,
+    slack: usize,
+    aaa: &[T],
+    bbb: &[T],
+    out: &mut [MaybeUninit<T>],
+) -> usize {
+    assert!(
+        out.len() >= aaa.len().min(bbb.len()) + slack,
+        "output of {} elements, {} needed",
+        out.len(),
+        aaa.len().min(bbb.len()) + slack
+    );
+
+    call(name, kernel, aaa, bbb, out.as_mut_ptr() as *mut T, false)
+}
+
+/// Runs a kernel that may store up to `slack` elements past its count, the results are appended
+/// in place.
+#[inline(always)]
+fn intersect_with<T>(
+    name: &'static str,
+    kernel: Kernel<T>,
+    slack: usize,
+    aaa: &[T],
+    bbb: &[T],
+    results: Option<&mut Vec<T>>,
+) -> usize {
+    if let Some(vec) = results {
+        vec.reserve(aaa.len().min(bbb.len()) + slack);
+        let out = vec.spare_capacity_mut();
+        let count = intersect_into_with(name, kernel, slack, aaa, bbb, out);
+
+        unsafe {
+            vec.set_len(vec.len() + count);
+        }
+
+        count
+    } else {
+        call(name, kernel, aaa, bbb, NonNull::dangling().as_ptr(), true)
+    }
+}
+
 #[inline(always)]
 pub fn intersect_simd_gallop(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
     if aaa.len() < 4 {
         return intersect_scalar_gallop(aaa, bbb, results);
     }
 
-    if let Some(vec) = results {
-        vec.reserve_exact(aaa.len() + 4);
+    intersect_with(
+        "simd_gallop",
+        ffi::intersect_simdgalloping_uint,
+        4,
+        aaa,
+        bbb,
+        results,
+    )
+}
 
-        let count = unsafe {
-            ffi::intersect_simdgalloping_uint(
-                aaa.as_ptr(),
-                aaa.len() as i32,
-                bbb.as_ptr(),
-                bbb.len() as i32,
-                vec.as_mut_ptr(),
-                false,
+#[inline(always)]
+pub fn intersect_simd_qfilter(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge(aaa, bbb, results);
+    }
+
+    intersect_with(
+        "qfilter",
+        ffi::intersect_qfilter_uint_b4,
+        4,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// QFilter over 8 x 8 blocks, it runs as b4 below [`IsaLevel::Avx2`].
+#[inline(always)]
+pub fn intersect_simd_qfilter_b8(
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge(aaa, bbb, results);
+    }
+
+    intersect_with(
+        "qfilter_b8",
+        ffi::intersect_qfilter_uint_b8,
+        8,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// QFilter over 16 x 16 blocks, it runs as the widest variant below [`IsaLevel::Avx512`].
+#[inline(always)]
+pub fn intersect_simd_qfilter_b16(
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge(aaa, bbb, results);
+    }
+
+    intersect_with(
+        "qfilter_b16",
+        ffi::intersect_qfilter_uint_b16,
+        8,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Shuffling over 4 x 4 blocks.
+#[inline(always)]
+pub fn intersect_simd_shuffle(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    intersect_with(
+        "shuffle",
+        ffi::intersect_shuffle_uint_b4,
+        4,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Shuffling over 8 x 8 blocks as two SSE halves.
+#[inline(always)]
+pub fn intersect_simd_shuffle_b8(
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    intersect_with(
+        "shuffle_b8",
+        ffi::intersect_shuffle_uint_b8,
+        4,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Shuffling over 8 x 8 blocks in one AVX2 register, it runs as b8 below [`IsaLevel::Avx2`].
+#[inline(always)]
+pub fn intersect_simd_shuffle_vec256(
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    intersect_with(
+        "shuffle_vec256",
+        ffi::intersect_shuffle_uint_vec256,
+        8,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// [`intersect_simd_gallop`] into `out`, which must hold `min(|A|, |B|) +`
+/// [`OUTPUT_SLACK`](crate::intersect::OUTPUT_SLACK) elements, as do the other `_into` kernels.
+/// Returns the count, the first `count` elements of `out` are initialized.
+#[inline(always)]
+pub fn intersect_simd_gallop_into(aaa: &[u32], bbb: &[u32], out: &mut [MaybeUninit<u32>]) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_gallop_into(aaa, bbb, out);
+    }
+
+    intersect_into_with(
+        "simd_gallop",
+        ffi::intersect_simdgalloping_uint,
+        4,
+        aaa,
+        bbb,
+        out,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_simd_qfilter_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge_into(aaa, bbb, out);
+    }
+
+    intersect_into_with("qfilter", ffi::intersect_qfilter_uint_b4, 4, aaa, bbb, out)
+}
+
+#[inline(always)]
+pub fn intersect_simd_qfilter_b8_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge_into(aaa, bbb, out);
+    }
+
+    intersect_into_with(
+        "qfilter_b8",
+        ffi::intersect_qfilter_uint_b8,
+        8,
+        aaa,
+        bbb,
+        out,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_simd_qfilter_b16_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    if aaa.len() < 4 {
+        return intersect_scalar_merge_into(aaa, bbb, out);
+    }
+
+    intersect_into_with(
+        "qfilter_b16",
+        ffi::intersect_qfilter_uint_b16,
+        8,
+        aaa,
+        bbb,
+        out,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_simd_shuffle_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    intersect_into_with("shuffle", ffi::intersect_shuffle_uint_b4, 4, aaa, bbb, out)
+}
+
+#[inline(always)]
+pub fn intersect_simd_shuffle_b8_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    intersect_into_with(
+        "shuffle_b8",
+        ffi::intersect_shuffle_uint_b8,
+        4,
+        aaa,
+        bbb,
+        out,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_simd_shuffle_vec256_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    intersect_into_with(
+        "shuffle_vec256",
+        ffi::intersect_shuffle_uint_vec256,
+        8,
+        aaa,
+        bbb,
+        out,
+    )
+}
+
+/// Galloping over 64-bit elements, probing blocks of 2.
+#[inline(always)]
+pub fn intersect_simd_gallop_u64(
+    aaa: &[u64],
+    bbb: &[u64],
+    results: Option<&mut Vec<u64>>,
+) -> usize {
+    intersect_with(
+        "gallop_u64",
+        ffi::intersect_galloping_u64,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// QFilter over 4 x 4 blocks of 64-bit elements, it runs as shuffling below [`IsaLevel::Avx2`].
+#[inline(always)]
+pub fn intersect_simd_qfilter_u64(
+    aaa: &[u64],
+    bbb: &[u64],
+    results: Option<&mut Vec<u64>>,
+) -> usize {
+    intersect_with(
+        "qfilter_u64",
+        ffi::intersect_qfilter_u64,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Shuffling over blocks of 64-bit elements, 2 x 2 up to 8 x 8 with the ISA level.
+#[inline(always)]
+pub fn intersect_simd_shuffle_u64(
+    aaa: &[u64],
+    bbb: &[u64],
+    results: Option<&mut Vec<u64>>,
+) -> usize {
+    intersect_with(
+        "shuffle_u64",
+        ffi::intersect_shuffle_u64,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Galloping over 16-bit elements, probing blocks of 8.
+#[inline(always)]
+pub fn intersect_simd_gallop_u16(
+    aaa: &[u16],
+    bbb: &[u16],
+    results: Option<&mut Vec<u16>>,
+) -> usize {
+    intersect_with(
+        "gallop_u16",
+        ffi::intersect_galloping_u16,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// QFilter over 8 x 8 blocks of 16-bit elements, each compared with one STTNI instruction.
+#[inline(always)]
+pub fn intersect_simd_qfilter_u16(
+    aaa: &[u16],
+    bbb: &[u16],
+    results: Option<&mut Vec<u16>>,
+) -> usize {
+    intersect_with(
+        "qfilter_u16",
+        ffi::intersect_qfilter_u16,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Shuffling over 8 x 8 blocks of 16-bit elements.
+#[inline(always)]
+pub fn intersect_simd_shuffle_u16(
+    aaa: &[u16],
+    bbb: &[u16],
+    results: Option<&mut Vec<u16>>,
+) -> usize {
+    intersect_with(
+        "shuffle_u16",
+        ffi::intersect_shuffle_u16,
+        0,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// Partitioned sets, 8 x 8 low halves per STTNI compare. Returns the number of values in the
+/// intersection, the values are appended to `results`.
+#[inline(always)]
+pub fn intersect_simd_partitioned(
+    aaa: &PartitionedSet,
+    bbb: &PartitionedSet,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    let (part_a, part_b) = (aaa.words(), bbb.words());
+    let run = |set_c: *mut u32, count_only: bool| {
+        measure("partitioned", aaa.len() + bbb.len(), || unsafe {
+            ffi::intersect_partitioned_u16(
+                part_a.as_ptr(),
+                part_a.len() as i32,
+                part_b.as_ptr(),
+                part_b.len() as i32,
+                set_c,
+                count_only,
             ) as usize
-        };
+        })
+    };
+
+    if let Some(vec) = results {
+        vec.reserve(aaa.len().min(bbb.len()));
+        let count = run(vec.spare_capacity_mut().as_mut_ptr() as *mut u32, false);
 
         unsafe {
-            vec.set_len(count);
+            vec.set_len(vec.len() + count);
         }
 
         count
     } else {
+        run(NonNull::dangling().as_ptr(), true)
+    }
+}
+
+/// Runs a union or difference kernel whose result has at most `len` elements, and that may store
+/// 4 past its count, the results are appended in place.
+#[inline(always)]
+fn merge_with(
+    name: &'static str,
+    kernel: Kernel<u32>,
+    len: usize,
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    if let Some(vec) = results {
+        vec.reserve(len + 4);
+        let set_c = vec.spare_capacity_mut().as_mut_ptr() as *mut u32;
+        let count = call(name, kernel, aaa, bbb, set_c, false);
+
         unsafe {
-            ffi::intersect_simdgalloping_uint(
+            vec.set_len(vec.len() + count);
+        }
+
+        count
+    } else {
+        call(name, kernel, aaa, bbb, NonNull::dangling().as_ptr(), true)
+    }
+}
+
+/// Returns the number of values in the union, the values are appended to `results`. Counts
+/// alone come from the intersection.
+#[inline(always)]
+pub fn union_simd(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    merge_with(
+        "union",
+        ffi::set_union_uint,
+        aaa.len() + bbb.len(),
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// The values of `aaa` not in `bbb`.
+#[inline(always)]
+pub fn difference_simd(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
+    merge_with(
+        "difference",
+        ffi::set_difference_uint,
+        aaa.len(),
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+/// The values in exactly one of `aaa` and `bbb`.
+#[inline(always)]
+pub fn symmetric_difference_simd(
+    aaa: &[u32],
+    bbb: &[u32],
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    merge_with(
+        "symmetric_difference",
+        ffi::set_symmetric_difference_uint,
+        aaa.len() + bbb.len(),
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+type LimitKernel = unsafe fn(*const u32, i32, *const u32, i32, *mut u32, i32, bool) -> i32;
+
+/// Runs an early-exit kernel: with `results`, the first `limit` values of the intersection are
+/// appended, otherwise the count stops as soon as it reaches `limit` or the values left cannot
+/// make it up. Returns at most `limit`.
+#[inline(always)]
+fn limit_with(
+    name: &'static str,
+    kernel: LimitKernel,
+    aaa: &[u32],
+    bbb: &[u32],
+    limit: usize,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    let limit = limit.min(i32::MAX as usize);
+    let run = |set_c: *mut u32, count_only: bool| {
+        measure(name, aaa.len() + bbb.len(), || unsafe {
+            kernel(
                 aaa.as_ptr(),
                 aaa.len() as i32,
                 bbb.as_ptr(),
                 bbb.len() as i32,
-                Vec::new().as_mut_ptr(),
-                true,
+                set_c,
+                limit as i32,
+                count_only,
             ) as usize
+        })
+    };
+
+    if let Some(vec) = results {
+        vec.reserve(aaa.len().min(bbb.len()).min(limit) + 16);
+        let count = run(vec.spare_capacity_mut().as_mut_ptr() as *mut u32, false);
+
+        unsafe {
+            vec.set_len(vec.len() + count);
         }
+
+        count
+    } else {
+        run(NonNull::dangling().as_ptr(), true)
     }
 }
 
+/// Galloping with an early exit, see [`limit_with`].
 #[inline(always)]
-pub fn intersect_simd_qfilter(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
-    if aaa.len() < 4 {
-        return intersect_scalar_merge(aaa, bbb, results);
-    }
+pub fn intersect_simd_gallop_limit(
+    aaa: &[u32],
+    bbb: &[u32],
+    limit: usize,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    limit_with(
+        "simd_gallop_limit",
+        ffi::intersect_galloping_uint_limit,
+        aaa,
+        bbb,
+        limit,
+        results,
+    )
+}
 
-    if let Some(vec) = results {
-        vec.reserve_exact(aaa.len() + 4);
+/// The widest QFilter with an early exit, see [`limit_with`].
+#[inline(always)]
+pub fn intersect_simd_qfilter_limit(
+    aaa: &[u32],
+    bbb: &[u32],
+    limit: usize,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    limit_with(
+        "qfilter_limit",
+        ffi::intersect_qfilter_uint_limit,
+        aaa,
+        bbb,
+        limit,
+        results,
+    )
+}
 
-        let count = unsafe {
-            ffi::intersect_qfilter_uint_b4(
+/// The values `x` of `aaa` whose bit `x - base` is set in `words`, a bitmap of at most `2^27`
+/// words, looked up by AVX2 gathers. Returns their number, the values are appended to `results`.
+pub fn intersect_simd_bitmap(
+    aaa: &[u32],
+    words: &[u32],
+    base: u32,
+    results: Option<&mut Vec<u32>>,
+) -> usize {
+    assert!(words.len() <= 1 << 27);
+    let run = |set_c: *mut u32, count_only: bool| {
+        measure("bitmap", aaa.len(), || unsafe {
+            ffi::intersect_bitmap_uint(
                 aaa.as_ptr(),
                 aaa.len() as i32,
-                bbb.as_ptr(),
-                bbb.len() as i32,
-                vec.as_mut_ptr(),
-                false,
+                words.as_ptr(),
+                base,
+                words.len() as i32,
+                set_c,
+                count_only,
             ) as usize
-        };
+        })
+    };
+
+    if let Some(vec) = results {
+        vec.reserve(aaa.len() + 8);
+        let count = run(vec.spare_capacity_mut().as_mut_ptr() as *mut u32, false);
 
         unsafe {
-            vec.set_len(count);
+            vec.set_len(vec.len() + count);
         }
 
         count
     } else {
+        run(NonNull::dangling().as_ptr(), true)
+    }
+}
+
+type PositionKernel = unsafe fn(*const u32, i32, *const u32, i32, *mut u32) -> i32;
+type CallbackKernel = unsafe fn(*const u32, i32, *const u32, i32, usize, usize) -> i32;
+
+#[inline(always)]
+fn positions_with(
+    kernel: PositionKernel,
+    aaa: &[u32],
+    bbb: &[u32],
+    positions: &mut Vec<u32>,
+) -> usize {
+    let len = positions.len();
+    positions.reserve_exact(aaa.len().min(bbb.len()) + 16);
+
+    let count = unsafe {
+        kernel(
+            aaa.as_ptr(),
+            aaa.len() as i32,
+            bbb.as_ptr(),
+            bbb.len() as i32,
+            positions.as_mut_ptr().add(len),
+        ) as usize
+    };
+
+    unsafe {
+        positions.set_len(len + count);
+    }
+
+    count
+}
+
+extern "C" fn call_back<F: FnMut(u32)>(context: usize, value: u32) {
+    unsafe { (*(context as *mut F))(value) }
+}
+
+#[inline(always)]
+fn for_each_with<F: FnMut(u32)>(
+    kernel: CallbackKernel,
+    aaa: &[u32],
+    bbb: &[u32],
+    mut f: F,
+) -> usize {
+    let callback: extern "C" fn(usize, u32) = call_back::<F>;
+    unsafe {
+        kernel(
+            aaa.as_ptr(),
+            aaa.len() as i32,
+            bbb.as_ptr(),
+            bbb.len() as i32,
+            callback as usize,
+            &mut f as *mut F as usize,
+        ) as usize
+    }
+}
+
+/// Appends the index in `aaa` of every match, galloping through `bbb`.
+pub fn intersect_simd_gallop_positions(
+    aaa: &[u32],
+    bbb: &[u32],
+    positions: &mut Vec<u32>,
+) -> usize {
+    positions_with(ffi::intersect_galloping_uint_positions, aaa, bbb, positions)
+}
+
+/// Appends the index in `aaa` of every match, with the widest QFilter.
+pub fn intersect_simd_qfilter_positions(
+    aaa: &[u32],
+    bbb: &[u32],
+    positions: &mut Vec<u32>,
+) -> usize {
+    positions_with(ffi::intersect_qfilter_uint_positions, aaa, bbb, positions)
+}
+
+/// Calls `f` with every match in order, galloping through `bbb`. A panic in `f` aborts.
+pub fn intersect_simd_gallop_for_each<F: FnMut(u32)>(aaa: &[u32], bbb: &[u32], f: F) -> usize {
+    for_each_with(ffi::intersect_galloping_uint_callback, aaa, bbb, f)
+}
+
+/// Calls `f` with every match in order, with the widest QFilter. A panic in `f` aborts.
+pub fn intersect_simd_qfilter_for_each<F: FnMut(u32)>(aaa: &[u32], bbb: &[u32], f: F) -> usize {
+    for_each_with(ffi::intersect_qfilter_uint_callback, aaa, bbb, f)
+}
+
+/// Intersects all of `sets` in one pass, writing only the final result.
+pub fn intersect_simd_kway(sets: &[&[u32]], results: Option<&mut Vec<u32>>) -> usize {
+    if sets.is_empty() {
+        return 0;
+    }
+
+    let mut sorted = sets.to_vec();
+    sorted.sort_unstable_by_key(|set| set.len());
+    let addresses: Vec<usize> = sorted.iter().map(|set| set.as_ptr() as usize).collect();
+    let sizes: Vec<i32> = sorted.iter().map(|set| set.len() as i32).collect();
+
+    if let Some(vec) = results {
+        vec.reserve(sorted[0].len());
+        let count =
+            unsafe { intersect_simd_kway_into(&addresses, &sizes, vec.spare_capacity_mut()) };
         unsafe {
-            ffi::intersect_qfilter_uint_b4(
-                aaa.as_ptr(),
-                aaa.len() as i32,
-                bbb.as_ptr(),
-                bbb.len() as i32,
-                Vec::new().as_mut_ptr(),
-                true,
-            ) as usize
+            vec.set_len(vec.len() + count);
+        }
+
+        count
+    } else {
+        unsafe { kway(&addresses, &sizes, NonNull::dangling().as_ptr(), true) }
+    }
+}
+
+#[inline(always)]
+unsafe fn kway(addresses: &[usize], sizes: &[i32], set_c: *mut u32, count_only: bool) -> usize {
+    let total = sizes.iter().map(|&size| size as usize).sum();
+    measure("kway", total, || unsafe {
+        ffi::intersect_kway_uint(
+            addresses.as_ptr(),
+            sizes.as_ptr(),
+            sizes.len() as i32,
+            set_c,
+            count_only,
+        ) as usize
+    })
+}
+
+/// [`intersect_simd_kway`] over sets given by address and size, writing into `out`, which must
+/// hold the smallest set.
+///
+/// # Safety
+///
+/// Each address must point at a sorted `u32` set of the matching size, and the sets must come in
+/// ascending order of size.
+pub(crate) unsafe fn intersect_simd_kway_into(
+    addresses: &[usize],
+    sizes: &[i32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    assert_eq!(addresses.len(), sizes.len());
+    if sizes.is_empty() {
+        return 0;
+    }
+    assert!(out.len() >= sizes[0] as usize);
+
+    kway(addresses, sizes, out.as_mut_ptr() as *mut u32, false)
+}
+
+/// Intersects the pairs of lists of one CSR in a single call, see [`crate::batch`]. The results
+/// are appended, and the end of each pair's result, relative to the call, is pushed on `offsets_c`.
+pub fn intersect_simd_batch(
+    values: &[u32],
+    offsets: &[usize],
+    pairs: &[[u32; 2]],
+    gallop_overhead: usize,
+    results: Option<&mut Vec<u32>>,
+    offsets_c: &mut Vec<usize>,
+) -> usize {
+    let end = offsets_c.len();
+    offsets_c.reserve_exact(pairs.len());
+
+    let total = pairs
+        .iter()
+        .map(|&[a, b]| {
+            let len = |l: u32| offsets[l as usize + 1] - offsets[l as usize];
+            len(a) + len(b)
+        })
+        .sum();
+    let mut batch = |set_c: *mut u32, count_only: bool| {
+        measure("batch", total, || unsafe {
+            let count = ffi::intersect_batch_uint(
+                values.as_ptr(),
+                offsets.as_ptr(),
+                pairs.as_ptr() as *const u32,
+                pairs.len() as i32,
+                gallop_overhead as i32,
+                set_c,
+                offsets_c.as_mut_ptr().add(end),
+                count_only,
+            );
+            offsets_c.set_len(end + pairs.len());
+
+            count
+        })
+    };
+
+    if let Some(vec) = results {
+        let bound: usize = pairs
+            .iter()
+            .map(|&[a, b]| {
+                let len = |l: u32| offsets[l as usize + 1] - offsets[l as usize];
+                len(a).min(len(b))
+            })
+            .sum();
+        let len = vec.len();
+        vec.reserve_exact(bound + 16);
+
+        let count = batch(unsafe { vec.as_mut_ptr().add(len) }, false);
+        unsafe {
+            vec.set_len(len + count);
         }
+
+        count
+    } else {
+        batch(NonNull::dangling().as_ptr(), true)
+    }
+}
+
+type BsrKernel =
+    unsafe fn(*const u32, *const u32, i32, *const u32, *const u32, i32, *mut u32, *mut u32) -> i32;
+
+/// Runs a BSR kernel and returns the number of values in the intersection.
+/// As the kernels always materialize, counting goes through a scratch set.
+#[inline(always)]
+fn intersect_bsr_with(
+    name: &'static str,
+    kernel: BsrKernel,
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    let mut scratch;
+    let set = match results {
+        Some(set) => set,
+        None => {
+            scratch = BsrSet::new();
+            &mut scratch
+        }
+    };
+
+    let len = set.num_bases();
+    set.reserve_exact(aaa.num_bases().min(bbb.num_bases()) + 4);
+    let (bases_c, states_c) = set.spare_ptrs();
+
+    let size_c = measure(name, aaa.num_bases() + bbb.num_bases(), || unsafe {
+        kernel(
+            aaa.bases().as_ptr(),
+            aaa.states().as_ptr(),
+            aaa.num_bases() as i32,
+            bbb.bases().as_ptr(),
+            bbb.states().as_ptr(),
+            bbb.num_bases() as i32,
+            bases_c,
+            states_c,
+        ) as usize
+    });
+
+    unsafe {
+        set.set_len(len + size_c);
+    }
+
+    set.states()[len..]
+        .iter()
+        .map(|s| s.count_ones() as usize)
+        .sum()
+}
+
+#[inline(always)]
+pub fn intersect_bsr_scalar_merge(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_scalar_merge",
+        ffi::intersect_scalarmerge_bsr,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_bsr_scalar_gallop(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_scalar_gallop",
+        ffi::intersect_scalargalloping_bsr,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_bsr_simd_gallop(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_simd_gallop",
+        ffi::intersect_simdgalloping_bsr,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_bsr_simd_qfilter(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_qfilter",
+        ffi::intersect_qfilter_bsr_b4,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_bsr_simd_qfilter_v2(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_qfilter_v2",
+        ffi::intersect_qfilter_bsr_b4_v2,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[inline(always)]
+pub fn intersect_bsr_simd_shuffle(
+    aaa: &BsrSet,
+    bbb: &BsrSet,
+    results: Option<&mut BsrSet>,
+) -> usize {
+    intersect_bsr_with(
+        "bsr_shuffle",
+        ffi::intersect_shuffle_bsr_b4,
+        aaa,
+        bbb,
+        results,
+    )
+}
+
+#[cfg(test)]
+static ISA_LOCK: std::sync::Mutex<()> = std::sync::Mutex::new(());
+
+/// Keeps the tests that set the process-wide ISA level or run at the one they expect from
+/// running at once, and goes back to the startup level on drop.
+#[cfg(test)]
+pub(crate) struct IsaGuard(#[allow(dead_code)] std::sync::MutexGuard<'static, ()>);
+
+#[cfg(test)]
+impl Drop for IsaGuard {
+    fn drop(&mut self) {
+        reset_isa_level();
     }
 }
 
+#[cfg(test)]
+pub(crate) fn lock_isa_level() -> IsaGuard {
+    IsaGuard(ISA_LOCK.lock().unwrap_or_else(|e| e.into_inner()))
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::intersect::OUTPUT_SLACK;
 
     #[test]
     fn test_simd() {
+        let _isa = lock_isa_level();
         let x = vec![1, 2];
         let y = vec![1, 2, 6];
         let mut result = Vec::new();
@@ -156,4 +1410,334 @@ mod tests {
         assert_eq!(intersect_simd_qfilter(&x, &y, Some(&mut result)), 5);
         assert_eq!(result, vec![1, 2, 3, 4, 3_000_000_000]);
     }
+
+    #[test]
+    fn test_isa_levels() {
+        let _isa = lock_isa_level();
+        let x: Vec<u32> = (0..1000).map(|i| i * 3).chain([3_000_000_000]).collect();
+        let y: Vec<u32> = (0..1500).map(|i| i * 2).chain([3_000_000_000]).collect();
+        let expected: Vec<u32> = (0..500).map(|i| i * 6).chain([3_000_000_000]).collect();
+        let (bsr_x, bsr_y) = (BsrSet::from_sorted(&x), BsrSet::from_sorted(&y));
+
+        let default = isa_level();
+        assert!(supported_isa_levels().any(|level| level == IsaLevel::Scalar));
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            assert_eq!(isa_level(), level);
+
+            let mut result = Vec::new();
+            assert_eq!(intersect_simd_gallop(&x[..20], &y, Some(&mut result)), 10);
+            assert_eq!(result, expected[..10]);
+            let mut result = Vec::new();
+            assert_eq!(intersect_simd_qfilter(&x, &y, Some(&mut result)), 501);
+            assert_eq!(result, expected);
+
+            let mut result = BsrSet::new();
+            assert_eq!(
+                intersect_bsr_simd_qfilter(&bsr_x, &bsr_y, Some(&mut result)),
+                501
+            );
+            assert_eq!(result.to_vec(), expected);
+        }
+
+        reset_isa_level();
+        assert_eq!(isa_level(), default);
+    }
+
+    /// Sorted values drawn from the top `range` values of `u32`.
+    fn random_set(len: usize, range: u64, seed: u64) -> Vec<u32> {
+        let mut state = seed;
+        let mut set: Vec<u32> = (0..len)
+            .map(|_| {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                (u32::MAX as u64 + 1 - range + state % range) as u32
+            })
+            .collect();
+        set.sort_unstable();
+        set.dedup();
+        set
+    }
+
+    #[test]
+    fn test_block_kernels() {
+        let _isa = lock_isa_level();
+        let kernels: [fn(&[u32], &[u32], Option<&mut Vec<u32>>) -> usize; 6] = [
+            intersect_simd_qfilter,
+            intersect_simd_qfilter_b8,
+            intersect_simd_qfilter_b16,
+            intersect_simd_shuffle,
+            intersect_simd_shuffle_b8,
+            intersect_simd_shuffle_vec256,
+        ];
+
+        // Values on both sides of 2^31, and a slice off any 32-byte boundary.
+        let around_sign_bit = |set: Vec<u32>| -> Vec<u32> {
+            set.into_iter()
+                .map(|v| v.wrapping_add((1 << 31) + 2000))
+                .collect()
+        };
+        let x = around_sign_bit(random_set(1000, 4000, 3));
+        let y = around_sign_bit(random_set(1500, 4000, 7));
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x[1..], &y, Some(&mut expected));
+        assert!(expected.len() > 100);
+        for kernel in kernels {
+            assert_eq!(kernel(&x[1..], &y, None), expected.len());
+        }
+
+        for (len_a, len_b, range) in [
+            (5, 7, 16),
+            (100, 300, 400),
+            (1000, 1000, 4000),
+            (3000, 777, 1 << 20),
+        ] {
+            let x = random_set(len_a, range, 17);
+            let y = random_set(len_b, range, 29);
+            let mut expected = Vec::new();
+            intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+            for level in supported_isa_levels() {
+                assert!(set_isa_level(level));
+                for kernel in kernels {
+                    let mut result = vec![42];
+                    assert_eq!(kernel(&x, &y, Some(&mut result)), expected.len());
+                    assert_eq!(result[1..], expected);
+                    assert_eq!(kernel(&y, &x, None), expected.len());
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_into_kernels() {
+        let _isa = lock_isa_level();
+        let kernels: [fn(&[u32], &[u32], &mut [MaybeUninit<u32>]) -> usize; 7] = [
+            intersect_simd_gallop_into,
+            intersect_simd_qfilter_into,
+            intersect_simd_qfilter_b8_into,
+            intersect_simd_qfilter_b16_into,
+            intersect_simd_shuffle_into,
+            intersect_simd_shuffle_b8_into,
+            intersect_simd_shuffle_vec256_into,
+        ];
+
+        for (len_a, len_b) in [(3, 50), (100, 300), (1000, 1000)] {
+            let x = random_set(len_a, 4000, 5);
+            let y = random_set(len_b, 4000, 11);
+            let mut expected = Vec::new();
+            intersect_scalar_merge(&x, &y, Some(&mut expected));
+
+            let mut out = vec![MaybeUninit::uninit(); len_a.min(len_b) + OUTPUT_SLACK];
+            for level in supported_isa_levels() {
+                assert!(set_isa_level(level));
+                for kernel in kernels {
+                    let count = kernel(&x, &y, &mut out);
+                    let result: Vec<u32> = out[..count]
+                        .iter()
+                        .map(|v| unsafe { v.assume_init() })
+                        .collect();
+                    assert_eq!(result, expected);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_wide_kernels() {
+        let _isa = lock_isa_level();
+        // 64-bit values with few distinct low bytes, so the byte filter of QFilter often passes
+        // on pairs that differ in their high half, and every third value of x also in y.
+        let spread = |v: u32| ((v as u64 & 0xff) << 40) | (v as u64 >> 8 & 0xf);
+        let mut x: Vec<u64> = random_set(2000, 1 << 12, 3)
+            .into_iter()
+            .map(spread)
+            .collect();
+        x.sort_unstable();
+        let mut y: Vec<u64> = random_set(2000, 1 << 12, 11)
+            .into_iter()
+            .map(|v| spread(v) | 1 << 63)
+            .chain(x.iter().step_by(3).copied())
+            .collect();
+        y.sort_unstable();
+        y.dedup();
+        let x16: Vec<u16> = random_set(3000, 1 << 14, 5)
+            .iter()
+            .map(|&v| v as u16)
+            .collect();
+        let y16: Vec<u16> = random_set(1000, 1 << 14, 13)
+            .iter()
+            .map(|&v| v as u16)
+            .collect();
+
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+        let mut expected16 = Vec::new();
+        intersect_scalar_merge(&x16, &y16, Some(&mut expected16));
+        assert_eq!(expected.len(), (x.len() + 2) / 3);
+        assert!(!expected16.is_empty());
+
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            for kernel in [
+                intersect_simd_gallop_u64,
+                intersect_simd_qfilter_u64,
+                intersect_simd_shuffle_u64,
+            ] {
+                let mut result = vec![42];
+                assert_eq!(kernel(&x, &y, Some(&mut result)), expected.len());
+                assert_eq!(result[1..], expected);
+                assert_eq!(kernel(&y, &x, None), expected.len());
+            }
+            for kernel in [
+                intersect_simd_gallop_u16,
+                intersect_simd_qfilter_u16,
+                intersect_simd_shuffle_u16,
+            ] {
+                let mut result = vec![42];
+                assert_eq!(kernel(&x16, &y16, Some(&mut result)), expected16.len());
+                assert_eq!(result[1..], expected16);
+                assert_eq!(kernel(&y16, &x16, None), expected16.len());
+            }
+        }
+    }
+
+    #[test]
+    fn test_partitioned() {
+        let _isa = lock_isa_level();
+        // values over the last 4 partitions, every seventh of x also in y
+        let x: Vec<u32> = random_set(20_000, 1 << 18, 21);
+        let y: Vec<u32> = random_set(5_000, 1 << 18, 23)
+            .into_iter()
+            .chain(x.iter().step_by(7).copied())
+            .collect::<std::collections::BTreeSet<u32>>()
+            .into_iter()
+            .collect();
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+        let (px, py) = (
+            PartitionedSet::from_sorted(&x),
+            PartitionedSet::from_sorted(&y),
+        );
+
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            let mut result = vec![42];
+            assert_eq!(
+                intersect_simd_partitioned(&px, &py, Some(&mut result)),
+                expected.len()
+            );
+            assert_eq!(result[1..], expected);
+            assert_eq!(intersect_simd_partitioned(&py, &px, None), expected.len());
+        }
+    }
+
+    #[test]
+    fn test_output_policies() {
+        let _isa = lock_isa_level();
+        let x = random_set(3000, 1 << 14, 5);
+        let y = random_set(2000, 1 << 14, 9);
+        let mut expected = Vec::new();
+        intersect_scalar_merge(&x, &y, Some(&mut expected));
+        let expected_positions: Vec<u32> = expected
+            .iter()
+            .map(|v| x.binary_search(v).unwrap() as u32)
+            .collect();
+
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            for positions in [
+                intersect_simd_gallop_positions,
+                intersect_simd_qfilter_positions,
+            ] {
+                let mut result = vec![42];
+                assert_eq!(positions(&x, &y, &mut result), expected.len());
+                assert_eq!(result[1..], expected_positions);
+            }
+
+            let mut seen = Vec::new();
+            assert_eq!(
+                intersect_simd_gallop_for_each(&x, &y, |v| seen.push(v)),
+                expected.len()
+            );
+            assert_eq!(seen, expected);
+            seen.clear();
+            assert_eq!(
+                intersect_simd_qfilter_for_each(&x, &y, |v| seen.push(v)),
+                expected.len()
+            );
+            assert_eq!(seen, expected);
+        }
+
+        assert_eq!(
+            intersect_simd_gallop_for_each(&[1, 5], &[5], |v| assert_eq!(v, 5)),
+            1
+        );
+    }
+
+    #[test]
+    fn test_kway() {
+        let _isa = lock_isa_level();
+        let sets: Vec<Vec<u32>> = (0..6)
+            .map(|i| random_set(300 << i, 2000, i as u64 + 11))
+            .collect();
+        let mut slices: Vec<&[u32]> = sets.iter().map(|set| &set[..]).collect();
+        slices.reverse();
+        for level in supported_isa_levels() {
+            assert!(set_isa_level(level));
+            for k in 1..=slices.len() {
+                let mut pairwise = slices[0].to_vec();
+                for set in &slices[1..k] {
+                    pairwise.retain(|x| set.binary_search(x).is_ok());
+                }
+                assert!(!pairwise.is_empty());
+                let mut result = vec![42];
+                assert_eq!(
+                    intersect_simd_kway(&slices[..k], Some(&mut result)),
+                    pairwise.len()
+                );
+                assert_eq!(result[1..], pairwise);
+                assert_eq!(intersect_simd_kway(&slices[..k], None), pairwise.len());
+            }
+        }
+
+        assert_eq!(intersect_simd_kway(&[&[1, 2], &[], &[2]], None), 0);
+        assert_eq!(intersect_simd_kway(&[], None), 0);
+    }
+
+    #[test]
+    fn test_simd_bsr() {
+        let _isa = lock_isa_level();
+        let kernels: [fn(&BsrSet, &BsrSet, Option<&mut BsrSet>) -> usize; 6] = [
+            intersect_bsr_scalar_merge,
+            intersect_bsr_scalar_gallop,
+            intersect_bsr_simd_gallop,
+            intersect_bsr_simd_qfilter,
+            intersect_bsr_simd_qfilter_v2,
+            intersect_bsr_simd_shuffle,
+        ];
+
+        let x: Vec<u32> = (0..2000)
+            .map(|i| i * 3)
+            .chain([3_000_000_000, u32::MAX])
+            .collect();
+        let y: Vec<u32> = (0..3000)
+            .map(|i| i * 2)
+            .chain([3_000_000_000, u32::MAX])
+            .collect();
+        let expected: Vec<u32> = (0..1000)
+            .map(|i| i * 6)
+            .chain([3_000_000_000, u32::MAX])
+            .collect();
+        let (x, y) = (BsrSet::from_sorted(&x), BsrSet::from_sorted(&y));
+
+        for kernel in kernels {
+            let mut result = BsrSet::new();
+            assert_eq!(kernel(&x, &y, Some(&mut result)), expected.len());
+            assert_eq!(result.to_vec(), expected);
+            assert_eq!(kernel(&y, &x, None), expected.len());
+            assert_eq!(kernel(&x, &BsrSet::from_sorted(&[1, 2]), None), 0);
+        }
+    }
 }
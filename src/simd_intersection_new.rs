@@ -1,19 +1,46 @@
 use setops::intersect::{galloping_avx512, qfilter};
-use setops::visitor::{Counter, SliceWriter, VecWriter};
-use std::mem;
+use setops::visitor::{Counter, VecWriter};
+use std::mem::{self, MaybeUninit};
+
+use crate::intersect::OUTPUT_SLACK;
+
+#[inline(always)]
+fn as_i32(set: &[u32]) -> &[i32] {
+    unsafe { mem::transmute::<&[u32], &[i32]>(set) }
+}
+
+/// Runs a setops kernel into a `VecWriter`, and copies the result into `out`, which must hold
+/// `min(|A|, |B|) +` [`OUTPUT_SLACK`] elements.
+#[inline(always)]
+fn write_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+    kernel: impl FnOnce(&[i32], &[i32], &mut VecWriter<i32>),
+) -> usize {
+    assert!(
+        out.len() >= aaa.len().min(bbb.len()) + OUTPUT_SLACK,
+        "output of {} elements, {} needed",
+        out.len(),
+        aaa.len().min(bbb.len()) + OUTPUT_SLACK
+    );
+
+    let mut writer = VecWriter::<i32>::new();
+    kernel(as_i32(aaa), as_i32(bbb), &mut writer);
+    for (slot, &a) in out.iter_mut().zip(writer.as_ref()) {
+        slot.write(a as u32);
+    }
+
+    writer.as_ref().len()
+}
 
 #[inline(always)]
 pub fn intersect_simd_gallop(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
     if let Some(vec) = results {
-        let mut writer =  VecWriter::<i32>::new();
+        let mut writer = VecWriter::<i32>::new();
 
         unsafe {
-
-            galloping_avx512(
-                mem::transmute::<&[u32], &[i32]>(aaa),
-                mem::transmute::<&[u32], &[i32]>(bbb),
-                &mut writer,
-            );
+            galloping_avx512(as_i32(aaa), as_i32(bbb), &mut writer);
         }
 
         vec.extend(writer.as_ref().iter().map(|&a| a as u32));
@@ -23,31 +50,29 @@ pub fn intersect_simd_gallop(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<
         let mut counter = Counter::new();
 
         unsafe {
-            galloping_avx512(
-                mem::transmute::<&[u32], &[i32]>(aaa),
-                mem::transmute::<&[u32], &[i32]>(bbb),
-                &mut counter,
-            );
+            galloping_avx512(as_i32(aaa), as_i32(bbb), &mut counter);
         }
 
         counter.count()
     }
 }
 
+/// [`intersect_simd_gallop`] into `out`, which must hold `min(|A|, |B|) +` [`OUTPUT_SLACK`]
+/// elements.
+#[inline(always)]
+pub fn intersect_simd_gallop_into(aaa: &[u32], bbb: &[u32], out: &mut [MaybeUninit<u32>]) -> usize {
+    write_into(aaa, bbb, out, |a, b, writer| unsafe {
+        galloping_avx512(a, b, writer)
+    })
+}
+
 #[inline(always)]
 pub fn intersect_simd_qfilter(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec<u32>>) -> usize {
-    // unimplemented!()
     if let Some(vec) = results {
         let mut writer = VecWriter::<i32>::new();
 
         unsafe {
-            let mut writer =
-                SliceWriter::from(mem::transmute::<&mut [u32], &mut [i32]>(vec.as_mut_slice()));
-            qfilter(
-                mem::transmute::<&[u32], &[i32]>(aaa),
-                mem::transmute::<&[u32], &[i32]>(bbb),
-                &mut writer,
-            );
+            qfilter(as_i32(aaa), as_i32(bbb), &mut writer);
         }
 
         vec.extend(writer.as_ref().iter().map(|&a| a as u32));
@@ -57,17 +82,24 @@ pub fn intersect_simd_qfilter(aaa: &[u32], bbb: &[u32], results: Option<&mut Vec
         let mut counter = Counter::new();
 
         unsafe {
-            qfilter(
-                mem::transmute::<&[u32], &[i32]>(aaa),
-                mem::transmute::<&[u32], &[i32]>(bbb),
-                &mut counter,
-            );
+            qfilter(as_i32(aaa), as_i32(bbb), &mut counter);
         }
 
         counter.count()
     }
 }
 
+#[inline(always)]
+pub fn intersect_simd_qfilter_into(
+    aaa: &[u32],
+    bbb: &[u32],
+    out: &mut [MaybeUninit<u32>],
+) -> usize {
+    write_into(aaa, bbb, out, |a, b, writer| unsafe {
+        qfilter(a, b, writer)
+    })
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -0,0 +1,384 @@
+//! Always-on statistics of the dispatch in [`intersect`](crate::intersect::intersect).
+//!
+//! Every call records the kernel chosen, the `log2` size and ratio buckets of the pair (as in the
+//! [cost model](crate::cost_model)) and the share of the smaller set that matched. One call in
+//! [`LATENCY_SAMPLE`] of each kernel also records its latency, as the clock reads cost more than
+//! a small pair, in a log-linear histogram with 8 sub-buckets per power of two, so percentiles
+//! are within 12.5%.
+//! [`intersect_multi`](crate::intersect::intersect_multi) also counts its k-way walks and the
+//! sets it skipped on an empty intermediate result.
+//!
+//! Each thread writes only its own shard, with plain relaxed loads and stores, and [`snapshot`]
+//! sums the shards. A thread that exits adds its shard into the totals of the retired ones and
+//! drops it, so short-lived worker threads do not pile up shards. [`reset`] keeps the current totals as a baseline to subtract, so it never
+//! races with a writer. `INTERSECTION_STATS=0` or [`set_enabled`] turns the recording off.
+use std::env;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+
+use crate::cost_model::{buckets, Kernel, RATIO_BUCKETS, SIZE_BUCKETS};
+
+/// Selectivity buckets are tenths of the smaller set, the last one is an exact match.
+pub const SELECTIVITY_BUCKETS: usize = 11;
+/// Latencies below 8 ns get a bucket each, then 8 per power of two up to `2^64` ns.
+pub const LATENCY_BUCKETS: usize = 8 + 61 * 8;
+/// Each thread times one call in this many of each kernel, starting with the first.
+pub const LATENCY_SAMPLE: u64 = 64;
+
+// the layout of one kernel's counters in a shard
+const CALLS: usize = 0;
+const INPUT: usize = 1;
+const OUTPUT: usize = 2;
+const SIZES: usize = 3;
+const RATIOS: usize = SIZES + SIZE_BUCKETS;
+const SELECTIVITY: usize = RATIOS + RATIO_BUCKETS;
+const LATENCY: usize = SELECTIVITY + SELECTIVITY_BUCKETS;
+const STRIDE: usize = LATENCY + LATENCY_BUCKETS;
+
+// then the intersect_multi counters
+const MULTI: usize = Kernel::ALL.len() * STRIDE;
+const MULTI_CALLS: usize = MULTI;
+const MULTI_KWAY: usize = MULTI + 1;
+const MULTI_EARLY_EXITS: usize = MULTI + 2;
+const MULTI_SETS_SKIPPED: usize = MULTI + 3;
+const SHARD_LEN: usize = MULTI + 4;
+
+/// One thread's counters, written by that thread only.
+struct Shard(Box<[AtomicU64]>);
+
+impl Shard {
+    #[inline(always)]
+    fn get(&self, i: usize) -> u64 {
+        self.0[i].load(Ordering::Relaxed)
+    }
+
+    #[inline(always)]
+    fn add(&self, i: usize, n: u64) {
+        let c = &self.0[i];
+        c.store(c.load(Ordering::Relaxed).wrapping_add(n), Ordering::Relaxed);
+    }
+
+    fn add_to(&self, totals: &mut [u64]) {
+        for (total, c) in totals.iter_mut().zip(self.0.iter()) {
+            *total = total.wrapping_add(c.load(Ordering::Relaxed));
+        }
+    }
+}
+
+/// The shards of the live threads, and the sums of those of the threads that exited.
+struct Shards {
+    live: Vec<Arc<Shard>>,
+    retired: Vec<u64>,
+}
+
+/// The calling thread's shard, retired when the thread exits.
+struct ShardGuard(Arc<Shard>);
+
+impl Drop for ShardGuard {
+    fn drop(&mut self) {
+        let mut shards = SHARDS.lock().unwrap_or_else(|e| e.into_inner());
+        if let Some(i) = shards.live.iter().position(|s| Arc::ptr_eq(s, &self.0)) {
+            shards.live.swap_remove(i);
+        }
+        self.0.add_to(&mut shards.retired);
+    }
+}
+
+lazy_static! {
+    static ref ENABLED: AtomicBool =
+        AtomicBool::new(env::var("INTERSECTION_STATS").map_or(true, |v| v != "0"));
+    static ref SHARDS: Mutex<Shards> = Mutex::new(Shards {
+        live: Vec::new(),
+        retired: vec![0; SHARD_LEN],
+    });
+    static ref BASELINE: Mutex<Vec<u64>> = Mutex::new(vec![0; SHARD_LEN]);
+}
+
+thread_local! {
+    static SHARD: ShardGuard = {
+        let shard = Arc::new(Shard((0..SHARD_LEN).map(|_| AtomicU64::new(0)).collect()));
+        SHARDS.lock().unwrap().live.push(shard.clone());
+        ShardGuard(shard)
+    };
+}
+
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+#[inline(always)]
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+#[inline(always)]
+fn latency_bucket(ns: u64) -> usize {
+    if ns < 8 {
+        return ns as usize;
+    }
+    let e = 63 - ns.leading_zeros() as usize;
+    (e - 2) * 8 + ((ns >> (e - 3)) as usize & 7)
+}
+
+/// The least latency in nanoseconds of bucket `b`.
+fn latency_floor(b: usize) -> u64 {
+    if b < 8 {
+        return b as u64;
+    }
+    let e = b / 8 + 2;
+    (8 + (b % 8) as u64) << (e - 3)
+}
+
+/// Runs `f`, the call of `kernel` on `aaa` and `bbb`, and records it.
+#[inline(always)]
+pub(crate) fn record(kernel: Kernel, aaa: &[u32], bbb: &[u32], f: impl FnOnce() -> usize) -> usize {
+    if !is_enabled() {
+        return f();
+    }
+
+    // once the thread's shard is gone, in the destructors of other thread locals, calls run
+    // unrecorded
+    let base = kernel as usize * STRIDE;
+    let mut f = Some(f);
+    SHARD
+        .try_with(|ShardGuard(shard)| {
+            let f = f.take().unwrap();
+            let start = (shard.get(base + CALLS) % LATENCY_SAMPLE == 0).then(Instant::now);
+            let count = f();
+            if let Some(start) = start {
+                let ns = start.elapsed().as_nanos().min(u64::MAX as u128) as u64;
+                shard.add(base + LATENCY + latency_bucket(ns), 1);
+            }
+
+            let (small, large) = (aaa.len().min(bbb.len()), aaa.len().max(bbb.len()));
+            let (s, r) = buckets(small, large);
+            let selectivity = (count * 10).checked_div(small).unwrap_or(0).min(10);
+            shard.add(base + CALLS, 1);
+            shard.add(base + INPUT, (small + large) as u64);
+            shard.add(base + OUTPUT, count as u64);
+            shard.add(base + SIZES + s, 1);
+            shard.add(base + RATIOS + r, 1);
+            shard.add(base + SELECTIVITY + selectivity, 1);
+
+            count
+        })
+        .unwrap_or_else(|_| f.take().unwrap()())
+}
+
+/// Records one call of `intersect_multi`, whether it walked all sets at once, and how many sets
+/// were left when an intermediate result came out empty.
+#[inline(always)]
+pub(crate) fn record_multi(kway: bool, sets_skipped: usize) {
+    if !is_enabled() {
+        return;
+    }
+
+    let _ = SHARD.try_with(|ShardGuard(shard)| {
+        shard.add(MULTI_CALLS, 1);
+        shard.add(MULTI_KWAY, kway as u64);
+        if sets_skipped > 0 {
+            shard.add(MULTI_EARLY_EXITS, 1);
+            shard.add(MULTI_SETS_SKIPPED, sets_skipped as u64);
+        }
+    });
+}
+
+/// A latency histogram with log-linear buckets.
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Histogram {
+    buckets: Vec<u64>,
+}
+
+impl Histogram {
+    pub fn count(&self) -> u64 {
+        self.buckets.iter().sum()
+    }
+
+    /// The latency at or below which a `q` share of the calls fell, as the upper bound of its
+    /// bucket. Zero if the histogram is empty.
+    pub fn quantile(&self, q: f64) -> Duration {
+        let rank = (q.clamp(0.0, 1.0) * self.count() as f64).ceil().max(1.0) as u64;
+        let mut seen = 0;
+        for (b, &n) in self.buckets.iter().enumerate() {
+            seen += n;
+            if seen >= rank {
+                let upper = match b + 1 {
+                    LATENCY_BUCKETS => u64::MAX,
+                    next => latency_floor(next) - 1,
+                };
+                return Duration::from_nanos(upper);
+            }
+        }
+
+        Duration::ZERO
+    }
+
+    /// The non-empty buckets as (least latency, calls).
+    pub fn iter(&self) -> impl Iterator<Item = (Duration, u64)> + '_ {
+        self.buckets
+            .iter()
+            .enumerate()
+            .filter(|&(_, &n)| n > 0)
+            .map(|(b, &n)| (Duration::from_nanos(latency_floor(b)), n))
+    }
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct KernelStats {
+    pub kernel: Kernel,
+    pub calls: u64,
+    /// The values in both inputs, summed over the calls.
+    pub input: u64,
+    /// The values in the intersections, summed over the calls.
+    pub output: u64,
+    /// Calls per `log2` of the smaller set.
+    pub sizes: Vec<u64>,
+    /// Calls per `log2` of the larger set over the smaller one.
+    pub ratios: Vec<u64>,
+    /// Calls per tenth of the smaller set that matched.
+    pub selectivity: Vec<u64>,
+    /// The sampled calls, one in [`LATENCY_SAMPLE`].
+    pub latency: Histogram,
+}
+
+#[derive(Clone, Debug, Default, PartialEq, Eq)]
+pub struct MultiStats {
+    pub calls: u64,
+    /// Calls that walked all sets, or all those left after a first pair, at once.
+    pub kway: u64,
+    /// Calls that stopped on an empty intermediate result.
+    pub early_exits: u64,
+    /// The sets those calls did not have to intersect.
+    pub sets_skipped: u64,
+}
+
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub struct Stats {
+    /// One entry per kernel in [`Kernel::ALL`], called or not.
+    pub kernels: Vec<KernelStats>,
+    pub multi: MultiStats,
+}
+
+fn totals() -> Vec<u64> {
+    let shards = SHARDS.lock().unwrap();
+    let mut totals = shards.retired.clone();
+    for shard in &shards.live {
+        shard.add_to(&mut totals);
+    }
+
+    totals
+}
+
+/// The counts of all threads since the last [`reset`].
+pub fn snapshot() -> Stats {
+    let baseline = BASELINE.lock().unwrap();
+    let counts: Vec<u64> = totals()
+        .iter()
+        .zip(baseline.iter())
+        .map(|(&total, &base)| total.wrapping_sub(base))
+        .collect();
+
+    let kernels = Kernel::ALL
+        .iter()
+        .map(|&kernel| {
+            let c = &counts[kernel as usize * STRIDE..][..STRIDE];
+            KernelStats {
+                kernel,
+                calls: c[CALLS],
+                input: c[INPUT],
+                output: c[OUTPUT],
+                sizes: c[SIZES..RATIOS].to_vec(),
+                ratios: c[RATIOS..SELECTIVITY].to_vec(),
+                selectivity: c[SELECTIVITY..LATENCY].to_vec(),
+                latency: Histogram {
+                    buckets: c[LATENCY..].to_vec(),
+                },
+            }
+        })
+        .collect();
+
+    Stats {
+        kernels,
+        multi: MultiStats {
+            calls: counts[MULTI_CALLS],
+            kway: counts[MULTI_KWAY],
+            early_exits: counts[MULTI_EARLY_EXITS],
+            sets_skipped: counts[MULTI_SETS_SKIPPED],
+        },
+    }
+}
+
+/// Starts the counts of every thread over.
+pub fn reset() {
+    let mut baseline = BASELINE.lock().unwrap();
+    *baseline = totals();
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::{intersect, intersect_multi};
+    use std::borrow::Cow;
+
+    #[test]
+    fn test_latency_buckets() {
+        for ns in [0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 123_456_789, u64::MAX] {
+            let b = latency_bucket(ns);
+            assert!(b < LATENCY_BUCKETS);
+            assert!(latency_floor(b) <= ns);
+            assert!(b + 1 == LATENCY_BUCKETS || ns < latency_floor(b + 1));
+        }
+
+        let mut buckets = vec![0; LATENCY_BUCKETS];
+        buckets[latency_bucket(10)] = 90;
+        buckets[latency_bucket(1000)] = 10;
+        let histogram = Histogram { buckets };
+        assert_eq!(histogram.count(), 100);
+        assert_eq!(histogram.quantile(0.5), Duration::from_nanos(10));
+        assert_eq!(histogram.quantile(0.99), Duration::from_nanos(1023));
+    }
+
+    #[test]
+    fn test_stats() {
+        let before = snapshot();
+        let x: Vec<u32> = (0..1000).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..1000).map(|i| i * 3).collect();
+        let z: Vec<u32> = (0..1000).map(|i| i * 2 + 1).collect();
+        let w: Vec<u32> = (0..1000).collect();
+        let sets = vec![Cow::from(&x), Cow::from(&y), Cow::from(&z), Cow::from(&w)];
+        assert!(intersect_multi(sets).is_empty());
+        let after = snapshot();
+
+        // other tests may run kernels meanwhile, so only check lower bounds
+        let calls = |stats: &Stats| stats.kernels.iter().map(|k| k.calls).sum::<u64>();
+        assert!(calls(&after) >= calls(&before) + 2);
+        assert!(after.multi.calls > before.multi.calls);
+        assert!(after.multi.sets_skipped > before.multi.sets_skipped);
+        assert!(after.kernels.iter().any(|k| k.latency.count() > 0));
+    }
+
+    #[test]
+    fn test_retired_shards() {
+        let before = snapshot();
+        let x: Vec<u32> = (0..100).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..100).map(|i| i * 3).collect();
+        for _ in 0..30 {
+            std::thread::scope(|s| {
+                for _ in 0..10 {
+                    s.spawn(|| {
+                        intersect(&x, &y, None);
+                        record_multi(false, 0);
+                    });
+                }
+            });
+        }
+        let after = snapshot();
+
+        // other tests' threads may still hold shards, but not the 300 above
+        assert!(SHARDS.lock().unwrap().live.len() < 100);
+        let calls = |stats: &Stats| stats.kernels.iter().map(|k| k.calls).sum::<u64>();
+        assert!(calls(&after) >= calls(&before) + 300);
+        assert!(after.multi.calls >= before.multi.calls + 300);
+    }
+}
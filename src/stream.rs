@@ -0,0 +1,157 @@
+//! Intersections that produce their results a block at a time.
+//!
+//! An [`IntersectStream`] keeps a cursor into every set. Each step takes the next block of the
+//! smallest set, narrows every other set to the block's range by galloping from its cursor, and
+//! runs [`intersect`] over these windows, smallest first. The cursors then move past the range,
+//! so a consumer can start on the first block at once, and dropping the stream leaves the rest
+//! of the work undone.
+use std::mem;
+
+use crate::intersect::{gallop, gallop_gt, intersect};
+
+/// The values of the smallest set each step intersects, at most as many results.
+pub const DEFAULT_BLOCK_LEN: usize = 64;
+
+pub struct IntersectStream<'a> {
+    /// What is left of each set, the smallest first.
+    sets: Vec<&'a [u32]>,
+    block_len: usize,
+    /// The current block of results, and the next one to hand out.
+    block: Vec<u32>,
+    pos: usize,
+    buffer: Vec<u32>,
+}
+
+impl<'a> IntersectStream<'a> {
+    pub fn new(sets: &[&'a [u32]]) -> Self {
+        let mut sets = sets.to_vec();
+        sets.sort_unstable_by_key(|set| set.len());
+
+        Self {
+            sets,
+            block_len: DEFAULT_BLOCK_LEN,
+            block: Vec::new(),
+            pos: 0,
+            buffer: Vec::new(),
+        }
+    }
+
+    /// Takes `block_len` values of the smallest set per step.
+    pub fn with_block_len(mut self, block_len: usize) -> Self {
+        self.block_len = block_len.max(1);
+        self
+    }
+
+    /// The rest of the current block of results, or the next non-empty one. `None` once the
+    /// intersection is exhausted.
+    pub fn next_block(&mut self) -> Option<&[u32]> {
+        if self.pos == self.block.len() && !self.step() {
+            return None;
+        }
+
+        let pos = self.pos;
+        self.pos = self.block.len();
+        Some(&self.block[pos..])
+    }
+
+    /// Computes blocks until one is not empty, returns false when none is left.
+    fn step(&mut self) -> bool {
+        loop {
+            let first = match self.sets.first() {
+                Some(first) if !first.is_empty() => *first,
+                _ => return false,
+            };
+            let (values, rest) = first.split_at(self.block_len.min(first.len()));
+            self.sets[0] = rest;
+            let (lo, hi) = (values[0], values[values.len() - 1]);
+
+            self.block.clear();
+            self.block.extend_from_slice(values);
+            for set in self.sets.iter_mut().skip(1) {
+                let from = gallop(set, &lo);
+                let window = &from[..from.len() - gallop_gt(from, &hi).len()];
+                *set = &from[window.len()..];
+                if window.is_empty() && set.is_empty() {
+                    // nothing past this block can match
+                    self.sets[0] = &[];
+                    self.block.clear();
+                    break;
+                }
+
+                self.buffer.clear();
+                intersect(&self.block, window, Some(&mut self.buffer));
+                mem::swap(&mut self.block, &mut self.buffer);
+                if self.block.is_empty() {
+                    break;
+                }
+            }
+
+            self.pos = 0;
+            if !self.block.is_empty() {
+                return true;
+            }
+        }
+    }
+}
+
+impl Iterator for IntersectStream<'_> {
+    type Item = u32;
+
+    #[inline(always)]
+    fn next(&mut self) -> Option<u32> {
+        if self.pos == self.block.len() && !self.step() {
+            return None;
+        }
+
+        self.pos += 1;
+        Some(self.block[self.pos - 1])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::intersect::intersect_multi;
+    use std::borrow::Cow;
+
+    #[test]
+    fn test_stream() {
+        let x: Vec<u32> = (0..10_000).map(|i| i * 2).collect();
+        let y: Vec<u32> = (0..10_000).map(|i| i * 3).collect();
+        let z: Vec<u32> = (0..500).map(|i| i * 30 + 6).collect();
+        let w: Vec<u32> = (0..40).map(|i| i * 1000).collect();
+
+        for sets in [
+            vec![&x[..], &y[..]],
+            vec![&x[..], &y[..], &z[..]],
+            vec![&w[..], &x[..], &y[..]],
+            vec![&x[..]],
+            vec![&x[..], &[][..]],
+        ] {
+            let expected = intersect_multi(sets.iter().map(|&s| Cow::from(s)).collect());
+            for block_len in [1, 3, DEFAULT_BLOCK_LEN, 100_000] {
+                let stream = IntersectStream::new(&sets).with_block_len(block_len);
+                assert_eq!(stream.collect::<Vec<_>>(), expected);
+
+                let mut stream = IntersectStream::new(&sets).with_block_len(block_len);
+                let mut blocks = Vec::new();
+                while let Some(block) = stream.next_block() {
+                    assert!(!block.is_empty() && block.len() <= block_len);
+                    blocks.extend_from_slice(block);
+                }
+                assert_eq!(blocks, expected);
+            }
+
+            // stopping early, and mixing both ways of reading
+            let mut stream = IntersectStream::new(&sets);
+            let head: Vec<u32> = stream.by_ref().take(5).collect();
+            assert_eq!(head[..], expected[..5.min(expected.len())]);
+            let mut rest = head;
+            while let Some(block) = stream.next_block() {
+                rest.extend_from_slice(block);
+            }
+            assert_eq!(rest, expected);
+        }
+        assert_eq!(IntersectStream::new(&[]).next(), None);
+    }
+}